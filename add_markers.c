@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Add a TLM to the main header and a PLT to every tile-part header lacking
+ * one, so that a reader can seek to any tile-part or packet without walking
+ * the whole codestream.
+ * Packet lengths are found from the SOP marker segments (A.8.1) when each
+ * packet starts with one (Nsop is checked), by decoding the packet headers
+ * otherwise. An existing TLM is regenerated, existing PLT are kept.
+ *
+ * Usage: addmarkers input.j2k output.j2k (or input.jp2 output.jp2)
+ */
+#include <simpleparser.h>
+#include <simplewriter.h>
+#include <simpleindex.h>
+#include <simplepacket.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h> /* off_t */
+
+static const uint_fast16_t tlmonly[] = { TLM, 0 };
+
+static uint32_t *lengths;
+static size_t nlengths;
+static size_t maxlengths;
+
+static bool appendlength( uint64_t len )
+{
+  if( len > UINT32_MAX ) return false;
+  if( nlengths == maxlengths )
+    {
+    const size_t n = maxlengths ? 2 * maxlengths : 1024;
+    uint32_t *p = realloc( lengths, n * sizeof(uint32_t) );
+    if( !p ) return false;
+    lengths = p;
+    maxlengths = n;
+    }
+  lengths[nlengths++] = (uint32_t)len;
+  return true;
+}
+
+/*
+ * Scan the bit stream of tile-part `tp` for SOP marker segments and append
+ * the packet lengths. `nsop` is the expected Nsop of the first packet.
+ * Coded data never contains 0xFF followed by a value above 0x8F (A.8.1 and
+ * D.6), so there cannot be any false positive.
+ */
+static bool scansop( FILE *in, const tilepartinfo *tp, uint16_t *nsop )
+{
+  uint8_t buffer[64 * 1024];
+  const uint64_t end = tp->dataoffset + tp->datalength;
+  uint64_t bufstart = tp->dataoffset; /* file position of buffer[0] */
+  uint64_t next = tp->dataoffset;     /* next file position to read */
+  uint64_t packetstart = UINT64_MAX;
+  size_t have = 0;
+
+  if( !tp->datalength ) return true;
+  if( fseeko( in, (off_t)next, SEEK_SET ) != 0 ) return false;
+  for( ;; )
+    {
+    const uint64_t left = end - next;
+    const size_t n = left < sizeof(buffer) - have ? (size_t)left : sizeof(buffer) - have;
+    if( fread( buffer + have, 1, n, in ) != n ) return false;
+    have += n;
+    next += n;
+    /* a SOP is 6 bytes long, leave the tail for next round */
+    const size_t limit = next == end ? have : (have > 5 ? have - 5 : 0);
+    size_t i = 0;
+    while( i < limit )
+      {
+      const uint8_t *p = memchr( buffer + i, 0xff, limit - i );
+      if( !p ) { i = limit; break; }
+      i = (size_t)(p - buffer);
+      if( i + 6 <= have && p[1] == 0x91 && p[2] == 0 && p[3] == 4 )
+        {
+        const uint16_t Nsop = (uint16_t)(p[4] << 8 | p[5]);
+        if( Nsop != *nsop ) return false;
+        ++*nsop;
+        if( packetstart == UINT64_MAX )
+          {
+          if( bufstart + i != tp->dataoffset ) return false;
+          }
+        else if( !appendlength( bufstart + i - packetstart ) )
+          return false;
+        packetstart = bufstart + i;
+        i += 6;
+        }
+      else
+        ++i;
+      }
+    if( next == end ) break;
+    memmove( buffer, buffer + i, have - i );
+    bufstart += i;
+    have -= i;
+    }
+  if( packetstart == UINT64_MAX ) return false;
+  return appendlength( end - packetstart );
+}
+
+/*
+ * Decode the packet headers of the tile of `tp` and append the lengths of
+ * the packets starting within `tp`. The packets of the last tile are kept
+ * around, since its tile-parts come in a row most of the time.
+ */
+static bool decodelengths( FILE *in, const codestreamindex *index, const tilepartinfo *tp )
+{
+  static packetlist packets;
+  static uint32_t tile = UINT32_MAX;
+  if( tile != tp->Isot )
+    {
+    freepacketlist( &packets );
+    tile = UINT32_MAX;
+    if( !decodepacketheaders( in, index, tp->Isot, &packets ) ) return false;
+    tile = tp->Isot;
+    }
+  const uint64_t end = tp->dataoffset + tp->datalength;
+  for( size_t i = 0; i < packets.npackets; ++i )
+    {
+    const packetheaderinfo *pk = packets.packets + i;
+    if( pk->offset >= tp->dataoffset && pk->offset < end
+      && !appendlength( pk->length ) )
+      return false;
+    }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  if( argc < 3 )
+    {
+    fprintf( stderr, "usage: addmarkers input output\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  const char *outfilename = argv[2];
+
+  codestreamindex index;
+  if( !buildindex( filename, &index ) )
+    {
+    fprintf( stderr, "could not index: %s\n", filename );
+    return 1;
+    }
+  FILE *in = fopen( filename, "rb" );
+  if( !in ) return 1;
+
+  const uint32_t ntiles = getnumberoftiles( &index );
+  uint16_t *nsop = calloc( ntiles, sizeof(uint16_t) );
+  uint64_t *npackets = calloc( ntiles, sizeof(uint64_t) );
+  /* lengths of tile-part i are lengths[ first[i] ... first[i+1] ) when it has no PLT */
+  size_t *first = calloc( index.ntileparts + 1, sizeof(size_t) );
+  uint16_t *Ttlm = malloc( (index.ntileparts + 1) * sizeof(uint16_t) );
+  uint32_t *Ptlm = malloc( (index.ntileparts + 1) * sizeof(uint32_t) );
+  if( !nsop || !npackets || !first || !Ttlm || !Ptlm ) return 1;
+
+  uint64_t codestreamsize = 0;
+  for( size_t i = 0; i < index.ntileparts; ++i )
+    {
+    const tilepartinfo *tp = index.tileparts + i;
+    first[i] = nlengths;
+    if( tp->npackets )
+      {
+      /* already has PLT, only keep track of Nsop */
+      nsop[tp->Isot] = (uint16_t)(nsop[tp->Isot] + tp->npackets);
+      }
+    else if( !scansop( in, tp, nsop + tp->Isot ) )
+      {
+      nlengths = first[i];
+      if( !decodelengths( in, &index, tp ) )
+        {
+        fprintf( stderr, "tile-part at %llu: could not find the packet lengths\n",
+          (unsigned long long)tp->offset );
+        return 1;
+        }
+      }
+    const size_t n = tp->npackets ? tp->npackets : nlengths - first[i];
+    npackets[tp->Isot] += n;
+    const uint64_t header = tp->dataoffset - 2 - (tp->offset + 12);
+    const uint64_t plt = writeplt( NULL, lengths + first[i], nlengths - first[i] );
+    const uint64_t psot = 12 + header + 2 + tp->datalength + plt;
+    if( psot > UINT32_MAX || (nlengths > first[i] && !plt) )
+      {
+      fprintf( stderr, "tile-part at %llu is too long\n", (unsigned long long)tp->offset );
+      return 1;
+      }
+    Ttlm[i] = tp->Isot;
+    Ptlm[i] = (uint32_t)psot;
+    codestreamsize += psot;
+    }
+  first[index.ntileparts] = nlengths;
+
+  /* a POC or a tile-part COD/COC may change the number of packets */
+  if( !(index.flags & (INDEX_POC | INDEX_TILECOD)) )
+    for( uint32_t t = 0; t < ntiles; ++t )
+      if( npackets[t] != getnumberofpackets( &index, t ) )
+        {
+        fprintf( stderr, "unexpected number of packets in tile %u\n", t );
+        return 1;
+        }
+
+  uint64_t mainsize = 2;
+  if( !copysegments( in, index.socoffset + 2, index.mainheaderend, tlmonly, NULL, &mainsize ) )
+    {
+    fprintf( stderr, "invalid main header\n" );
+    return 1;
+    }
+  const uint64_t tlmsize = writetlm( NULL, Ttlm, Ptlm, index.ntileparts );
+  if( index.ntileparts && !tlmsize )
+    {
+    fprintf( stderr, "too many tile-parts for TLM\n" );
+    return 1;
+    }
+  codestreamsize += mainsize + tlmsize + 2;
+
+  FILE *out = fopen( outfilename, "wb" );
+  if( !out ) return 1;
+  bool ok = true;
+  if( index.isjp2 )
+    {
+    ok = copyrange( in, 0, index.jp2cbegin, out )
+      && writejp2cheader( out, codestreamsize );
+    }
+  write_marker( out, SOC, 0 );
+  mainsize = 2;
+  ok = ok && copysegments( in, index.socoffset + 2, index.mainheaderend, tlmonly, out, &mainsize );
+  ok = ok && (!index.ntileparts || writetlm( out, Ttlm, Ptlm, index.ntileparts ));
+  for( size_t i = 0; i < index.ntileparts && ok; ++i )
+    {
+    const tilepartinfo *tp = index.tileparts + i;
+    uint64_t header = 0;
+    write_marker( out, SOT, 8 );
+    write16( out, tp->Isot );
+    write32( out, Ptlm[i] );
+    write8( out, tp->TPsot );
+    write8( out, tp->TNsot );
+    ok = copysegments( in, tp->offset + 12, tp->dataoffset - 2, NULL, out, &header );
+    const size_t n = first[i + 1] - first[i];
+    ok = ok && (!n || writeplt( out, lengths + first[i], n ));
+    write_marker( out, SOD, 0 );
+    ok = ok && copyrange( in, tp->dataoffset, tp->datalength, out );
+    }
+  write_marker( out, EOC, 0 );
+
+  if( ok && index.isjp2 )
+    {
+    const uint64_t filesize = getfilesize( filename );
+    ok = copyrange( in, index.jp2cend, filesize - index.jp2cend, out );
+    }
+  if( fclose( out ) != 0 ) ok = false;
+  fclose( in );
+  if( !ok )
+    {
+    fprintf( stderr, "could not write: %s\n", outfilename );
+    return 1;
+    }
+
+  free( Ptlm );
+  free( Ttlm );
+  free( first );
+  free( npackets );
+  free( nsop );
+  free( lengths );
+  freeindex( &index );
+
+  return 0;
+}
@@ -41,6 +41,11 @@
 #include <math.h>
 
 #include <simpleparser.h>
+#include <simpleoutput.h>
+#include <simplejson.h>
+#include <simpletlm.h>
+#include <simpleindex.h> /* decodeplt */
+#include <simplelayers.h>
 
 FILE * fout;
 static int indentlevel = 0;
@@ -50,7 +55,7 @@ static void print_with_indent(int indent, const char * format, ...)
   va_list arg;
   va_start(arg, format);
   if( indent )
-  fprintf(fout,"%*s" "%s", indent, " ", "");
+    printindent( fout, (unsigned int)indent );
   vfprintf(fout,format, arg);
   va_end(arg);
 }
@@ -116,95 +121,79 @@ typedef struct {
   const char* longname;
 } dictentry2;
 
-static const dictentry2 dict2[] = {
-  { JP  , "jP  ", "JP2 Signature box" },
-  { FTYP, "ftyp", "File Type box" },
-  { JP2H, "jp2h", "JP2 Header box" },
-  { JP2C, "jp2c", "Codestream box" },
-  { XML , "xml ", "XML box" },
-  { CDEF, "cdef", "Channel Definition box" },
-  { CMAP, "cmap", "Component Mapping box" },
-  { PCLR, "pclr", "Palette box" },
-  { IHDR, "ihdr", "Image Header box" },
-  { COLR, "colr", "Colour Specification box" },
-  { RREQ, "rreq", "Reader Requirements Box" },
-  { RES , "res ", "Resolution box" },
-  { UUID, "uuid", "UUID box" },
-  { ASOC, "asoc", "Association box" },
-  { LBL , "lbl ", "Label box" },
-  { RESC, "resc", "Capture Resolution box" },
-  { UINF, "uinf", "UUID Info box" },
-  { ULST, "ulst", "UUID List box" },
-  { URL , "url ", "Data Entry URL box" },
-  { JPCH, "jpch", "Codestream Header box" },
-  { JPLH, "jplh", "Compositing Header box" },
-  { IPTR, "iptr", "Data Entry URL box" },
-  { CIDX, "cidx", "Data Entry URL box" },
-  { FIDX, "fidx", "Data Entry URL box" },
-  { RESD, "resd", "Default Display Resolution box" },
-
-  { 0, 0, 0 }
+static const dictentry2 dict2[BOXSLOTS] = {
+  [BOXSLOT(JP)]   = { JP  , "jP  ", "JP2 Signature box" },
+  [BOXSLOT(FTYP)] = { FTYP, "ftyp", "File Type box" },
+  [BOXSLOT(JP2H)] = { JP2H, "jp2h", "JP2 Header box" },
+  [BOXSLOT(JP2C)] = { JP2C, "jp2c", "Codestream box" },
+  [BOXSLOT(XML)]  = { XML , "xml ", "XML box" },
+  [BOXSLOT(CDEF)] = { CDEF, "cdef", "Channel Definition box" },
+  [BOXSLOT(CMAP)] = { CMAP, "cmap", "Component Mapping box" },
+  [BOXSLOT(PCLR)] = { PCLR, "pclr", "Palette box" },
+  [BOXSLOT(IHDR)] = { IHDR, "ihdr", "Image Header box" },
+  [BOXSLOT(COLR)] = { COLR, "colr", "Colour Specification box" },
+  [BOXSLOT(RREQ)] = { RREQ, "rreq", "Reader Requirements Box" },
+  [BOXSLOT(RES)]  = { RES , "res ", "Resolution box" },
+  [BOXSLOT(UUID)] = { UUID, "uuid", "UUID box" },
+  [BOXSLOT(ASOC)] = { ASOC, "asoc", "Association box" },
+  [BOXSLOT(LBL)]  = { LBL , "lbl ", "Label box" },
+  [BOXSLOT(RESC)] = { RESC, "resc", "Capture Resolution box" },
+  [BOXSLOT(UINF)] = { UINF, "uinf", "UUID Info box" },
+  [BOXSLOT(ULST)] = { ULST, "ulst", "UUID List box" },
+  [BOXSLOT(URL)]  = { URL , "url ", "Data Entry URL box" },
+  [BOXSLOT(JPCH)] = { JPCH, "jpch", "Codestream Header box" },
+  [BOXSLOT(JPLH)] = { JPLH, "jplh", "Compositing Header box" },
+  [BOXSLOT(IPTR)] = { IPTR, "iptr", "Data Entry URL box" },
+  [BOXSLOT(CIDX)] = { CIDX, "cidx", "Data Entry URL box" },
+  [BOXSLOT(FIDX)] = { FIDX, "fidx", "Data Entry URL box" },
+  [BOXSLOT(RESD)] = { RESD, "resd", "Default Display Resolution box" },
 };
 
 static const dictentry2 * getdictentry2frommarker( uint_fast32_t marker )
 {
-  static const size_t n = sizeof( dict2 ) / sizeof( dictentry2 ) - 1; /* remove sentinel */
-  const dictentry2 * beg = dict2;
-  const dictentry2 * end = dict2 + n;
-  const dictentry2 * p = beg;
-  for( ; p != end; ++p )
-    {
-    if( p->marker == marker ) return p;
-    }
+  static const dictentry2 unknown = { 0, 0, 0 };
+  const dictentry2 * p = dict2 + BOXSLOT( marker );
+  if( p->marker == marker && p->shortname ) return p;
   assert( 0 );
-  assert( end->marker == 0 );
-  return end;
+  return &unknown;
 }
 
-static const dictentry dict[] = {
-  { FF30, "0x30", "unknown segment-less" },
-  { SOC,  "SOC",  "Start of codestream" },
-  { SOT,  "SOT",  "Start of tile-part" },
-  { SOD,  "SOD",  "Start of data" },
-  { EOC,  "EOC",  "End of codestream" },
-  { SIZ,  "SIZ",  "Image and tile size" },
-  { COD,  "COD",  "Coding style default" },
-  { COC,  "COC",  "Coding style component" },
-  { RGN,  "RGN",  "Region-of-interest" },
-  { QCD,  "QCD",  "Quantization default" },
-  { QCC,  "QCC",  "Quantization component" },
-  { POC,  "POC",  "Progression order change" },
-  { TLM,  "TLM",  "Tile-part length" },
-  { PLM,  "PLM",  "Packed length, main header" },
-  { PLT,  "PLT",  "Packet length, tile-part header" },
-  { PPM,  "PPM",  "Packed packet headers, main header" },
-  { PPT,  "PPT",  "Packed packet headers, tile-part header" },
-  { SOP,  "SOP",  "Start of packet" },
-  { EPH,  "EPH",  "End of packet header" },
-  { CRG,  "CRG",  "Component registration" },
-  { COM,  "COM",  "Comment" },
-  { CAP,  "CAP",  "Capabilities" },
-  { NSI,  "NSI",  "Additional dimension image and tile size" },
-  { MCC,  "MCC",  "MCC" },
-  { MCT,  "MCT",  "MCT" },
-  { MCO,  "MCO",  "Multiple component transform ordering" },
-  { CBD,  "CBD",  "Component bit depth definition" },
-
-  { 0, 0, 0 }
+static const dictentry dict[MARKERSLOTS] = {
+  [MARKERSLOT(FF30)] = { FF30, "0x30", "unknown segment-less" },
+  [MARKERSLOT(SOC)]  = { SOC,  "SOC",  "Start of codestream" },
+  [MARKERSLOT(SOT)]  = { SOT,  "SOT",  "Start of tile-part" },
+  [MARKERSLOT(SOD)]  = { SOD,  "SOD",  "Start of data" },
+  [MARKERSLOT(EOC)]  = { EOC,  "EOC",  "End of codestream" },
+  [MARKERSLOT(SIZ)]  = { SIZ,  "SIZ",  "Image and tile size" },
+  [MARKERSLOT(COD)]  = { COD,  "COD",  "Coding style default" },
+  [MARKERSLOT(COC)]  = { COC,  "COC",  "Coding style component" },
+  [MARKERSLOT(RGN)]  = { RGN,  "RGN",  "Region-of-interest" },
+  [MARKERSLOT(QCD)]  = { QCD,  "QCD",  "Quantization default" },
+  [MARKERSLOT(QCC)]  = { QCC,  "QCC",  "Quantization component" },
+  [MARKERSLOT(POC)]  = { POC,  "POC",  "Progression order change" },
+  [MARKERSLOT(TLM)]  = { TLM,  "TLM",  "Tile-part length" },
+  [MARKERSLOT(PLM)]  = { PLM,  "PLM",  "Packed length, main header" },
+  [MARKERSLOT(PLT)]  = { PLT,  "PLT",  "Packet length, tile-part header" },
+  [MARKERSLOT(PPM)]  = { PPM,  "PPM",  "Packed packet headers, main header" },
+  [MARKERSLOT(PPT)]  = { PPT,  "PPT",  "Packed packet headers, tile-part header" },
+  [MARKERSLOT(SOP)]  = { SOP,  "SOP",  "Start of packet" },
+  [MARKERSLOT(EPH)]  = { EPH,  "EPH",  "End of packet header" },
+  [MARKERSLOT(CRG)]  = { CRG,  "CRG",  "Component registration" },
+  [MARKERSLOT(COM)]  = { COM,  "COM",  "Comment" },
+  [MARKERSLOT(CAP)]  = { CAP,  "CAP",  "Capabilities" },
+  [MARKERSLOT(NSI)]  = { NSI,  "NSI",  "Additional dimension image and tile size" },
+  [MARKERSLOT(MCC)]  = { MCC,  "MCC",  "MCC" },
+  [MARKERSLOT(MCT)]  = { MCT,  "MCT",  "MCT" },
+  [MARKERSLOT(MCO)]  = { MCO,  "MCO",  "Multiple component transform ordering" },
+  [MARKERSLOT(CBD)]  = { CBD,  "CBD",  "Component bit depth definition" },
 };
 
 static const dictentry * getdictentryfrommarker( uint_fast16_t marker )
 {
-  static const size_t n = sizeof( dict ) / sizeof( dictentry ) - 1; /* remove sentinel */
-  const dictentry * beg = dict;
-  const dictentry * end = dict + n;
-  const dictentry * p = beg;
-  for( ; p != end; ++p )
-    {
-    if( p->marker == marker ) return p;
-    }
-  assert( end->marker == 0 );
-  return end;
+  static const dictentry unknown = { 0, 0, 0 };
+  const dictentry * p = dict + MARKERSLOT( marker );
+  if( p->marker == marker && p->shortname ) return p;
+  return &unknown;
 }
 
 /* Table A.16 Progression order for the SGcod, SPcoc, and Ppoc parameters */
@@ -264,6 +253,11 @@ static const char *getDescriptionOfWaveletTransformationString(uint8_t waveletTr
 
 static uintmax_t data_size;
 static uintmax_t file_size;
+static tlmtable tlm;         /* all TLM segments of the main header */
+static size_t ntileparts;
+static bool printpacketlengths; /* --packet-lengths */
+static uint32_t pltpartial;     /* a packet length can continue in the next PLT */
+static size_t npackets;         /* packets of the current tile-part */
 
 static void printeoc( FILE *stream, size_t len )
 {
@@ -281,6 +275,8 @@ static void printeoc( FILE *stream, size_t len )
   uintmax_t overhead = file_size - data_size;
   const int ratio = 100 * overhead / file_size;
   print_with_indent(indentlevel, "Overhead: %zu bytes (%u%%)\n", overhead , ratio );
+  if( tlm.nsegments )
+    print_with_indent(indentlevel, "TLM: %zu tile-parts in %u segments\n", tlm.nentries, tlm.nsegments );
   fprintf(fout,"\n");
 }
 
@@ -545,8 +541,9 @@ static void printeph( FILE *stream, size_t len )
 
   if( c )
     {
-    fprintf(fout,"\n" );
-    fprintf(fout,"Data : %u bytes\n", c );
+    printstr( fout, "\nData : " );
+    printdec( fout, (unsigned int)c, 0 );
+    printstr( fout, " bytes\n" );
     }
   data_size += c;
   (void)fseeko(stream, -2, SEEK_CUR);
@@ -559,9 +556,9 @@ static void printsop( FILE *stream, size_t len )
   bool b;
   b = read16(stream, &Nsop); assert( b );
 
-  fprintf(fout,"\n" );
-  fprintf(fout,"  Sequence : %u\n", Nsop );
-  fprintf(fout,"\n" );
+  printstr( fout, "\n  Sequence : " );
+  printdec( fout, Nsop, 0 );
+  printstr( fout, "\n\n" );
   int c =0;
   while( fgetc( stream ) != 0xFF )
     {
@@ -569,7 +566,9 @@ static void printsop( FILE *stream, size_t len )
     }
 
     data_size += c;
-  fprintf(fout,"Data : %u bytes\n", c );
+  printstr( fout, "Data : " );
+  printdec( fout, (unsigned int)c, 0 );
+  printstr( fout, " bytes\n" );
   (void)fseeko(stream, -1, SEEK_CUR);
 }
 
@@ -598,6 +597,19 @@ static void printsot( FILE *stream, size_t len )
   b = read8(stream, &TPsot); assert( b );
   b = read8(stream, &TNsot); assert( b );
   fprintf(fout,"\n" );
+  if( tlm.nsegments )
+    {
+    /* all TLM are in the main header, the first SOT ends it */
+    b = mergetlm( &tlm ); assert( b );
+    if( ntileparts >= tlm.nentries )
+      fprintf(fout,"    TLM        : no entry for this tile-part\n" );
+    else if( tlm.entries[ntileparts].Isot != Isot || tlm.entries[ntileparts].Ptlm != Psot )
+      fprintf(fout,"    TLM        : mismatch (tile %u, length %u)\n",
+        tlm.entries[ntileparts].Isot, tlm.entries[ntileparts].Ptlm );
+    }
+  ++ntileparts;
+  pltpartial = 0;
+  npackets = 0;
   fprintf(fout,"    Tile       : %u\n", Isot );
   fprintf(fout,"    Length     : %u\n", Psot );
   fprintf(fout,"    Index      : %u\n", TPsot );
@@ -636,36 +648,35 @@ static void printcomment( FILE *stream, size_t len )
 // Table A-37 - Packet length, tile-part headers parameter values
 static void printplt( FILE *stream, size_t len )
 {
-  uint8_t Zplt;
-  bool b;
-  b = read8(stream, &Zplt); assert( b );
+  static uint8_t buffer[0xffff];
+  static uint32_t lengths[0xffff];
+  assert( len >= 1 && len <= sizeof(buffer) );
+  size_t r = fread( buffer, 1, len, stream );
+  assert( r == len );
+  const uint8_t Zplt = buffer[0];
   len -= 1;
   fprintf(fout,"\n" );
   fprintf(fout,"    Index Zplt       : %d\n", Zplt );
-  fprintf(fout,"    Marker size Lplt : %d bytes\n", len + 3 );
-  int number_packets = 0;
+  fprintf(fout,"    Marker size Lplt : %zu bytes\n", len + 3 );
+  const size_t n = decodeplt( buffer + 1, len, lengths, &pltpartial );
   size_t sum = 0;
-  while( len )
+  size_t i;
+  for( i = 0; i != n; ++i )
+    sum += lengths[i];
+  fprintf(fout,"sum: %zu,", sum );
+  fprintf(fout,"\n" );
+  if( printpacketlengths )
     {
-    size_t packet_length = 0; // technically cannot go beyond 32bits
-    int partial = 1;
-    while (partial)
+    for( i = 0; i != n; ++i )
       {
-      uint8_t Iplt;
-      b = read8(stream, &Iplt);
-      len--;
-      assert( b );
-      partial = Iplt >> 7;
-      const uint8_t packet_length_partial = Iplt & 127;
-      packet_length = (packet_length << 7) | packet_length_partial;
+      printstr( fout, "    Packet #" );
+      printdec( fout, npackets + i, -7 );
+      printstr( fout, ": " );
+      printdec( fout, lengths[i], 0 );
+      printstr( fout, "\n" );
       }
-    sum += packet_length;
-    //fprintf(fout,"%d,", v );
     }
-  fprintf(fout,"sum: %d,", sum );
-  fprintf(fout,"\n" );
-
-//  assert( 0 );
+  npackets += n;
 }
 
 // p1_03.j2k
@@ -703,68 +714,35 @@ static void printppm( FILE *stream, size_t len )
 
 static void printtlm( FILE *stream, size_t len )
 {
-  char buffer[512];
-  assert( len < 512 );
-  size_t r = fread( buffer, sizeof(char), len, stream);
-  assert( r == len );
+  uint8_t Ztlm;
+  bool b = readtlm( &tlm, stream, len, &Ztlm );
+  assert( b );
 
   fprintf(fout, "\n" );
-  const uint8_t *p = (const uint8_t*)buffer;
-  const uint8_t *end = p + len;
-  uint8_t Ztlm = *p++;
   print_with_indent(indentlevel, "Index         : %u\n", Ztlm );
-  uint8_t Stlm = *p++;
-  uint8_t ST = ( Stlm >> 4 ) & 0x3;
-  uint8_t SP = ( Stlm >> 6 ) & 0x1;
-
-	int Ptlm_size = (SP + 1) * 2;
-	int quotient = Ptlm_size + ST;
-	size_t header_size = len - 2;
-
-	int tot_num_tp = header_size / quotient;
-
-  int i;
-  for (i = 0; i < tot_num_tp; ++i)
+  const uint8_t ST = tlm.ST[Ztlm];
+  const tlmentry *e = tlm.entries + tlm.first[Ztlm];
+  size_t i;
+  for (i = 0; i < tlm.count[Ztlm]; ++i, ++e)
     {
+    printindent( fout, (unsigned int)indentlevel );
+    printstr( fout, "Tile index #" );
+    printdec( fout, i, ST == 2 ? -2 : -3 );
     if( ST == 0 )
-      {
-      print_with_indent(indentlevel, "Tile index #%-3d: in order\n", i );
-      }
-    else if( ST == 1 )
-      {
-      uint8_t v = *p;
-      print_with_indent(indentlevel, "Tile index #%-3d: %u\n", i, v );
-      }
-    else if( ST == 2 )
-      {
-      uint16_t v;
-      cread16((char*)p, &v);
-      print_with_indent(indentlevel, "Tile index #%-2d: %u\n", i, v );
-      }
+      printstr( fout, ": in order\n" );
     else
       {
-      assert( 0 );
-      }
-    p += ST;
-    if( Ptlm_size == 2 )
-      {
-      uint16_t v;
-      cread16((char*)p, &v);
-      print_with_indent(indentlevel, "Length #%-7d: %u\n",i, v );
+      printstr( fout, ": " );
+      printdec( fout, e->Isot, 0 );
+      printstr( fout, "\n" );
       }
-    if( Ptlm_size == 4 )
-      {
-      uint32_t v;
-      cread32((char*)p, &v);
-      print_with_indent(indentlevel, "Length #%-6d: %u\n",i, v );
-      }
-    else
-      {
-      assert( 0 );
-      }
-    p += Ptlm_size;
+    printindent( fout, (unsigned int)indentlevel );
+    printstr( fout, "Length #" );
+    printdec( fout, i, tlm.SP[Ztlm] ? -6 : -7 );
+    printstr( fout, ": " );
+    printdec( fout, e->Ptlm, 0 );
+    printstr( fout, "\n" );
     }
-  assert( p == end );
   fprintf(fout, "\n" );
 }
 
@@ -1918,9 +1896,13 @@ static bool print1( uint_fast16_t marker, size_t len, FILE *stream )
   const dictentry *d = getdictentryfrommarker( marker );
   assert( offset >= 0 );
   assert( d->shortname && marker );
-  print_with_indent( indentlevel, "%-8u: New marker: %s (%s)",
-    offset - rel_offset, d->shortname, d->longname );
-  fprintf(fout,"\n");
+  printindent( fout, indentlevel );
+  printdec( fout, (unsigned int)(offset - rel_offset), -8 );
+  printstr( fout, ": New marker: " );
+  printstr( fout, d->shortname );
+  printstr( fout, " (" );
+  printstr( fout, d->longname );
+  printstr( fout, ")\n" );
   indentlevel += 2;
   bool skip = false;
   switch( marker )
@@ -1987,8 +1969,50 @@ static bool print1( uint_fast16_t marker, size_t len, FILE *stream )
   return skip;
 }
 
+/* --layers: where each quality layer ends, per tile then for the file */
+static bool dumplayers( const char *filename, FILE *out )
+{
+  codestreamindex index;
+  if( !buildindex( filename, &index ) ) return false;
+  FILE *in = fopen( filename, "rb" );
+  layertable table;
+  const bool ok = in && buildlayertable( in, &index, &table );
+  if( ok )
+    {
+    for( uint32_t t = 0; t <= table.ntiles; ++t )
+      {
+      const layerend *ends = t < table.ntiles ? table.tiles + (size_t)t * table.nlayers : table.file;
+      if( t < table.ntiles )
+        fprintf( out, "Tile #%u\n", t );
+      else
+        fprintf( out, "Codestream\n" );
+      for( uint16_t l = 0; l < table.nlayers; ++l )
+        fprintf( out, "    Layer #%-5u : end %" PRIu64 ", %" PRIu64 " bytes%s\n", l,
+          ends[l].end, ends[l].bytes, ends[l].exact ? "" : " (interleaved)" );
+      }
+    freelayertable( &table );
+    }
+  if( in ) fclose( in );
+  freeindex( &index );
+  return ok;
+}
+
 int main(int argc, char *argv[])
 {
+  const bool json = takejsonoption( &argc, &argv );
+  bool layers = false;
+  if( argc > 1 && strcmp( argv[1], "--packet-lengths" ) == 0 )
+    {
+    printpacketlengths = true;
+    --argc;
+    ++argv;
+    }
+  else if( argc > 1 && strcmp( argv[1], "--layers" ) == 0 )
+    {
+    layers = true;
+    --argc;
+    ++argv;
+    }
   if( argc < 2 ) return 1;
   const char *filename = argv[1];
 
@@ -2001,9 +2025,22 @@ int main(int argc, char *argv[])
     {
     fout = stdout;
     }
+  setoutputbuffer( fout );
+
+  if( json || layers )
+    {
+    const bool ok = json ? dumpjson( filename, fout ) : dumplayers( filename, fout );
+    if( argc > 2 )
+      {
+      fclose( fout );
+      }
+    return ok ? 0 : 1;
+    }
 
   bool b;
   data_size = 0;
+  inittlm( &tlm );
+  ntileparts = 0;
   file_size = getfilesize( filename );
   if( isjp2file( filename ) )
     {
@@ -2040,6 +2077,7 @@ int main(int argc, char *argv[])
     b = parsej2k( filename, &print1 );
     }
 
+  freetlm( &tlm );
   if( argc > 2 )
     {
     fclose( fout );
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Replace the payload of a top-level JP2 box (xml, uuid, asoc...) in place.
+ *
+ * The box and the free boxes right after it are seen as one slot. When the
+ * new box fits in the slot it is overwritten and the remainder becomes a
+ * free box, so only the metadata bytes are written. A slot ending the file
+ * can always be reused (the file is then truncated or extended).
+ * Otherwise the file is rewritten once (codestream copied with copyrange)
+ * with the new box right before jp2c, followed by a free box of `--reserve`
+ * bytes so that the next edits can be done in place.
+ *
+ * For uuid, the first 16 bytes of `content` are the UUID of the box to
+ * replace. For any other type the first box of that type is replaced.
+ *
+ * Usage: editbox file.jp2 type content [--reserve bytes]
+ */
+#include <simpleparser.h>
+#include <simplewriter.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h> /* ftruncate */
+#include <sys/types.h> /* off_t */
+
+static uint8_t *readcontent( const char *filename, size_t *len )
+{
+  const uintmax_t size = getfilesize( filename );
+  FILE *in = fopen( filename, "rb" );
+  if( !in ) return NULL;
+  uint8_t *content = malloc( size + 1 );
+  if( content && fread( content, 1, size, in ) != size )
+    {
+    free( content );
+    content = NULL;
+    }
+  fclose( in );
+  *len = size;
+  return content;
+}
+
+static bool readuuid( FILE *stream, const boxinfo *box, uint8_t uuid[16] )
+{
+  /* uuid are small, never use XLBox */
+  return box->length >= 8 + 16
+    && fseeko( stream, (off_t)box->offset + 8, SEEK_SET ) == 0
+    && fread( uuid, 1, 16, stream ) == 16;
+}
+
+static bool writebox( FILE *out, uint32_t type, const uint8_t *content, size_t len )
+{
+  return write32( out, (uint32_t)(8 + len) )
+    && write32( out, type )
+    && fwrite( content, 1, len, out ) == len;
+}
+
+/* free box of `len` bytes (header included), content is left as is */
+static bool writefreeheader( FILE *out, uint64_t len )
+{
+  assert( len >= 8 && len <= UINT32_MAX );
+  return write32( out, (uint32_t)len ) && write32( out, FREE );
+}
+
+int main(int argc, char *argv[])
+{
+  if( argc < 4 || strlen( argv[2] ) != 4 )
+    {
+    fprintf( stderr, "usage: editbox file.jp2 type content [--reserve bytes]\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  const char *contentfilename = argv[3];
+  const uint32_t type = (uint32_t)((uint8_t)argv[2][0] << 24 | (uint8_t)argv[2][1] << 16
+    | (uint8_t)argv[2][2] << 8 | (uint8_t)argv[2][3]);
+  uint64_t reserve = 0;
+  if( argc > 5 && strcmp( argv[4], "--reserve" ) == 0 )
+    {
+    reserve = strtoull( argv[5], NULL, 10 );
+    if( reserve && reserve < 8 ) reserve = 8;
+    }
+  if( type == JP || type == FTYP || type == JP2C || type == FREE )
+    {
+    fprintf( stderr, "this box cannot be edited\n" );
+    return 1;
+    }
+
+  size_t len;
+  uint8_t *content = readcontent( contentfilename, &len );
+  if( !content || len > UINT32_MAX - 8 - (uint64_t)reserve || (type == UUID && len < 16) )
+    {
+    fprintf( stderr, "invalid content: %s\n", contentfilename );
+    return 1;
+    }
+  const uint64_t need = 8 + (uint64_t)len;
+
+  boxinfo *boxes;
+  size_t nboxes;
+  if( !isjp2file( filename ) || !listboxes( filename, &boxes, &nboxes ) )
+    {
+    fprintf( stderr, "could not parse: %s\n", filename );
+    return 1;
+    }
+  const uint64_t filesize = getfilesize( filename );
+  FILE *stream = fopen( filename, "r+b" );
+  if( !stream ) return 1;
+
+  /* locate the box, then grow the slot over the free boxes that follow */
+  size_t target = nboxes;
+  for( size_t i = 0; i < nboxes && target == nboxes; ++i )
+    {
+    if( boxes[i].type != type ) continue;
+    uint8_t uuid[16];
+    if( type != UUID || (readuuid( stream, boxes + i, uuid ) && memcmp( uuid, content, 16 ) == 0) )
+      target = i;
+    }
+  size_t last = target;
+  uint64_t slot = 0;
+  if( target != nboxes )
+    {
+    slot = boxes[target].length;
+    while( last + 1 < nboxes && boxes[last + 1].type == FREE )
+      slot += boxes[++last].length;
+    }
+  const bool atend = target != nboxes && boxes[target].offset + slot == filesize;
+
+  bool ok = true;
+  if( target != nboxes && (need == slot || need + 8 <= slot || atend) )
+    {
+    ok = fseeko( stream, (off_t)boxes[target].offset, SEEK_SET ) == 0
+      && writebox( stream, type, content, len );
+    uint64_t end = boxes[target].offset + need;
+    if( ok && atend )
+      {
+      if( reserve )
+        {
+        ok = writefreeheader( stream, reserve );
+        end += reserve;
+        }
+      ok = ok && fflush( stream ) == 0
+        && ftruncate( fileno( stream ), (off_t)end ) == 0;
+      }
+    else if( ok && need != slot )
+      ok = writefreeheader( stream, slot - need );
+    if( fclose( stream ) != 0 ) ok = false;
+    if( ok ) printf( "updated in place\n" );
+    }
+  else
+    {
+    fclose( stream );
+    /* rewrite, new box goes where the old one was or right before jp2c */
+    size_t insert = target;
+    for( size_t i = 0; i < nboxes && insert == nboxes; ++i )
+      if( boxes[i].type == JP2C ) insert = i;
+
+    char *tmpfilename = malloc( strlen( filename ) + 5 );
+    if( !tmpfilename ) return 1;
+    strcpy( tmpfilename, filename );
+    strcat( tmpfilename, ".tmp" );
+    FILE *in = fopen( filename, "rb" );
+    FILE *out = fopen( tmpfilename, "wb" );
+    if( !in || !out ) return 1;
+    for( size_t i = 0; i <= nboxes && ok; ++i )
+      {
+      if( i == insert )
+        {
+        ok = writebox( out, type, content, len );
+        if( ok && reserve )
+          {
+          /* free box content does not matter, but keep the file clean */
+          ok = writefreeheader( out, reserve );
+          for( uint64_t k = 8; k < reserve && ok; ++k )
+            ok = fputc( 0, out ) != EOF;
+          }
+        }
+      if( i == nboxes ) break;
+      if( target != nboxes && i >= target && i <= last ) continue;
+      ok = ok && copyrange( in, boxes[i].offset, boxes[i].length, out );
+      }
+    fclose( in );
+    if( fclose( out ) != 0 ) ok = false;
+    ok = ok && rename( tmpfilename, filename ) == 0;
+    if( !ok ) remove( tmpfilename );
+    free( tmpfilename );
+    if( ok ) printf( "file rewritten\n" );
+    }
+  if( !ok )
+    {
+    fprintf( stderr, "could not update: %s\n", filename );
+    return 1;
+    }
+
+  free( boxes );
+  free( content );
+
+  return 0;
+}
@@ -7,6 +7,9 @@
 #include <math.h>
 
 #include <simpleparser.h>
+#include <simplewriter.h>
+#include <simpleindex.h>
+#include <simplegeometry.h>
 
 static bool read8(FILE *input, uint8_t * ret)
 {
@@ -16,14 +19,6 @@ static bool read8(FILE *input, uint8_t * ret)
   *ret = u.v;
   return true;
 }
-static bool write8(FILE *output, const uint8_t ret)
-{
-  union { uint8_t v; char bytes[1]; } u;
-  u.v = ret;
-  size_t l = fwrite(u.bytes,sizeof(char),1,output);
-  if( l != 1 || feof(output) ) return false;
-  return true;
-}
 static bool read16(FILE *input, uint16_t * ret)
 {
   union { uint16_t v; char bytes[2]; } u;
@@ -32,14 +27,6 @@ static bool read16(FILE *input, uint16_t * ret)
   *ret = bswap_16(u.v);
   return true;
 }
-static bool write16(FILE *output, const uint16_t ret)
-{
-  union { uint16_t v; char bytes[2]; } u;
-  u.v = bswap_16(ret);
-  size_t l = fwrite(u.bytes,sizeof(char),2,output);
-  if( l != 2 || feof(output) ) return false;
-  return true;
-}
 static bool read32(FILE *input, uint32_t * ret)
 {
   union { uint32_t v; char bytes[4]; } u;
@@ -48,37 +35,19 @@ static bool read32(FILE *input, uint32_t * ret)
   *ret = bswap_32(u.v);
   return true;
 }
-static bool write32(FILE *output, const uint32_t ret)
-{
-  union { uint32_t v; char bytes[4]; } u;
-  u.v = bswap_32(ret);
-  size_t l = fwrite(u.bytes,sizeof(char),4,output);
-  if( l != 4 || feof(output) ) return false;
-  return true;
-}
 
 FILE *fout;
 
-static void write_marker( FILE *out, uint_fast16_t marker, size_t len )
-{
-  union { uint16_t v; char bytes[2]; } u;
-  u.v = bswap_16(marker);
-  size_t s = fwrite(u.bytes, 1, 2, out);
-  assert( s == 2 );
-  // length
-  const bool nolen = hasnolength( marker );
-  if(!nolen)
-    {
-    u.v = bswap_16((uint16_t)len+2);
-    s = fwrite(u.bytes, 1, 2, out);
-    assert( s == 2 );
-    }
-
-}
-
 static int extract_tile = 720;
 static int current_tile = -1;
 
+/* PPM: the packet headers of the extracted tile go to PPT segments */
+static bool hasppm;
+static codestreamindex csindex; /* only built when hasppm */
+static FILE *pphin;
+static size_t current_tilepart;
+static bool failed;
+
 static void fixsiz( FILE *out, uint_fast16_t marker, size_t len,  FILE *stream )
 {
   write_marker( out, marker, len );
@@ -110,28 +79,32 @@ static void fixsiz( FILE *out, uint_fast16_t marker, size_t len,  FILE *stream )
   b = read32(stream, &ytosiz); assert( b );
   b = read16(stream, &csiz); assert( b );
 
-  const uint32_t ntilesX = (xsiz + xtsiz - 1) / xtsiz;
-  const uint32_t ntilesY = (ysiz + ytsiz - 1) / ytsiz;
-  const uint32_t t1 = extract_tile % ntilesX;
-  const uint32_t t2 = extract_tile / ntilesX;
-  const tposx = t1 * xtsiz;
-  assert( tposx < xsiz );
-  const tposy = t2 * ytsiz;
-  assert( tposy < ysiz );
-  const uint32_t newxtsiz = xsiz > (tposx + xtsiz) ? xtsiz : (xsiz - tposx);
-  assert( newxtsiz <= xtsiz );
-  const uint32_t newytsiz = ysiz > (tposy + ytsiz) ? ytsiz : (ysiz - tposy );
-  assert( newytsiz <= ytsiz );
+  /* B-7, tile offsets and image offset included */
+  codestreamindex siz;
+  memset( &siz, 0, sizeof(siz) );
+  siz.Xsiz = xsiz;
+  siz.Ysiz = ysiz;
+  siz.XOsiz = xosiz;
+  siz.YOsiz = yosiz;
+  siz.XTsiz = xtsiz;
+  siz.YTsiz = ytsiz;
+  siz.XTOsiz = xtosiz;
+  siz.YTOsiz = ytosiz;
+  rectangle tile;
+  b = gettilerectangle( &siz, (uint32_t)extract_tile, &tile ); assert( b );
+  assert( tile.x1 <= UINT32_MAX && tile.y1 <= UINT32_MAX );
 
+  /* keep the reference grid: the image and the single tile are the
+   * original tile, so the precinct and code-block grids do not move */
   b = write16(out, rsiz); assert( b );
-  b = write32(out, newxtsiz); assert( b ); // Tile size
-  b = write32(out, newytsiz); assert( b ); // Tile size
-  b = write32(out, xosiz); assert( b );
-  b = write32(out, yosiz); assert( b );
-  b = write32(out, -1 /*xtsiz*/); assert( b );
-  b = write32(out, -1 /*ytsiz*/); assert( b );
-  b = write32(out, xtosiz); assert( b );
-  b = write32(out, ytosiz); assert( b );
+  b = write32(out, (uint32_t)tile.x1); assert( b );
+  b = write32(out, (uint32_t)tile.y1); assert( b );
+  b = write32(out, (uint32_t)tile.x0); assert( b );
+  b = write32(out, (uint32_t)tile.y0); assert( b );
+  b = write32(out, xtsiz); assert( b );
+  b = write32(out, ytsiz); assert( b );
+  b = write32(out, (uint32_t)tile.x0); assert( b );
+  b = write32(out, (uint32_t)tile.y0); assert( b );
   b = write16(out, csiz); assert( b );
 
   uint_fast16_t i = 0;
@@ -185,7 +158,8 @@ static void simple_copy( FILE *out, uint_fast16_t marker, size_t len,  FILE *in
     }
 }
 
-static void processsot( FILE *out, uint_fast16_t marker, size_t len, FILE *in, int * curtile )
+/* return false when the tile-part does not match the index */
+static bool processsot( FILE *out, uint_fast16_t marker, size_t len, FILE *in, int * curtile )
 {
   uint16_t Isot;
   uint32_t Psot;
@@ -199,14 +173,43 @@ static void processsot( FILE *out, uint_fast16_t marker, size_t len, FILE *in, i
   b = read8 (in, &TNsot); assert( b );
 
   *curtile = Isot;
+  const tilepartinfo *tp = NULL;
+  if( hasppm )
+    {
+    if( current_tilepart >= csindex.ntileparts ) return false;
+    tp = csindex.tileparts + current_tilepart++;
+    if( tp->Isot != Isot ) return false;
+    }
   if( *curtile == extract_tile )
     {
+    const uint64_t ppt = hasppm ? writeppt( pphin, csindex.pphranges + tp->firstpph, tp->npph, NULL ) : 0;
+    if( hasppm && !ppt ) return false;
+    assert( Psot + ppt <= UINT32_MAX );
     write_marker( out, marker, len );
     b = write16(out, 0/*Isot*/); assert( b );
-    b = write32(out, Psot); assert( b );
+    b = write32(out, Psot ? (uint32_t)(Psot + ppt) : 0); assert( b );
     b = write8 (out, TPsot); assert( b );
     b = write8 (out, TNsot); assert( b );
+    if( hasppm )
+      {
+      b = writeppt( pphin, csindex.pphranges + tp->firstpph, tp->npph, out ) == ppt; assert( b );
+      }
+    }
+  return true;
+}
+
+/* A.7.4 whether the main header holds a PPM segment */
+static bool findppm( FILE *in )
+{
+  uint16_t marker;
+  uint16_t len;
+  if( !read16( in, &marker ) || marker != SOC ) return false;
+  while( read16( in, &marker ) && marker != SOT )
+    {
+    if( marker == PPM ) return true;
+    if( !read16( in, &len ) || len < 2 || fseeko( in, len - 2, SEEK_CUR ) != 0 ) return false;
     }
+  return false;
 }
 
 static bool copy_tile( uint_fast16_t marker, size_t len, FILE *stream )
@@ -221,7 +224,19 @@ static bool copy_tile( uint_fast16_t marker, size_t len, FILE *stream )
     fixnsi( fout, marker, len, stream );
     break;
   case SOT:
-    processsot( fout, marker, len, stream, &current_tile );
+    if( failed )
+      {
+      skip = true;
+      }
+    else if( !processsot( fout, marker, len, stream, &current_tile ) )
+      {
+      /* nothing more is written */
+      failed = true;
+      extract_tile = -1;
+      }
+    break;
+  case PPM:
+    skip = true;
     break;
   case SOD:
     if( current_tile == extract_tile )
@@ -250,10 +265,26 @@ int main(int argc, char *argv[])
     extract_tile = atoi( argv[3] );
     }
 
+  pphin = fopen( filename, "rb" );
+  if( !pphin ) return 1;
+  hasppm = findppm( pphin );
+  if( hasppm && !buildindex( filename, &csindex ) )
+    {
+    fprintf( stderr, "could not index: %s\n", filename );
+    return 1;
+    }
+
   fout = fopen( outfilename, "wb");
   if( !fout ) return 1;
 
   bool b = parsej2k( filename, &copy_tile );
+  fclose( pphin );
+  if( hasppm ) freeindex( &csindex );
+  if( failed )
+    {
+    fprintf( stderr, "tile-parts do not match the index: %s\n", filename );
+    return 1;
+    }
   if( !b ) return 1;
 
   return 0;
@@ -30,6 +30,8 @@
 #include <byteswap.h>
 
 #include <simpleparser.h>
+#include <simpleoutput.h>
+#include <simplejson.h>
 
 FILE *fout;
 
@@ -45,68 +47,50 @@ typedef struct {
   const char* longname;
 } dictentry2;
 
-static const dictentry2 dict2[] = {
-  { JP  , "JP  ", "JPEG 2000 signature box" },
-  { FTYP, "FTYP", "File type box" },
-  { JP2H, "JP2H", "JP2 header box (super-box)" },
-  { JP2C, "JP2C", "Contiguous codestream box" },
-
-  { 0, 0, 0 }
+static const dictentry2 dict2[BOXSLOTS] = {
+  [BOXSLOT(JP)]   = { JP  , "JP  ", "JPEG 2000 signature box" },
+  [BOXSLOT(FTYP)] = { FTYP, "FTYP", "File type box" },
+  [BOXSLOT(JP2H)] = { JP2H, "JP2H", "JP2 header box (super-box)" },
+  [BOXSLOT(JP2C)] = { JP2C, "JP2C", "Contiguous codestream box" },
 };
 
 static const dictentry2 * getdictentry2frommarker( uint_fast32_t marker )
 {
-  static const size_t n = sizeof( dict2 ) / sizeof( dictentry2 ) - 1; /* remove sentinel */
-  /* optimisation: binary search possible ? */
-  const dictentry2 * beg = dict2;
-  const dictentry2 * end = dict2 + n;
-  const dictentry2 * p = beg;
-  for( ; p != end; ++p )
-    {
-    if( p->marker == marker ) return p;
-    }
-  assert( end->marker == 0 );
-  return end;
+  static const dictentry2 unknown = { 0, 0, 0 };
+  const dictentry2 * p = dict2 + BOXSLOT( marker );
+  if( p->marker == marker && p->shortname ) return p;
+  return &unknown;
 }
 
-static const dictentry dict[] = {
-  { SOC, "SOC", "Start of codestream" },
-  { SOT, "SOT", "Start of tile-part" },
-  { SOD, "SOD", "Start of data" },
-  { EOC, "EOI", "End of Image (JPEG 2000 EOC End of codestream)" },
-  { SIZ, "SIZ", "Image and tile size" },
-  { COD, "COD", "Coding style default" },
-  { COC, "COC", "Coding style component" },
-  { RGN, "RGN", "Rgeion-of-interest" },
-  { QCD, "QCD", "Quantization default" },
-  { QCC, "QCC", "Quantization component" },
-  { POC, "POC", "Progression order change" },
-  { TLM, "TLM", "Tile-part lengths" },
-  { PLM, "PLM", "Packet length, main header" },
-  { PLT, "PLT", "Packet length, tile-part header" },
-  { PPM, "PPM", "Packet packer headers, main header" },
-  { PPT, "PPT", "Packet packer headers, tile-part header" },
-  { SOP, "SOP", "Start of packet" },
-  { EPH, "EPH", "End of packet header" },
-  { CRG, "CRG", "Component registration" },
-  { COM, "COM", "Comment (JPEG 2000)" },
-
-  { 0, 0, 0 }
+static const dictentry dict[MARKERSLOTS] = {
+  [MARKERSLOT(SOC)] = { SOC, "SOC", "Start of codestream" },
+  [MARKERSLOT(SOT)] = { SOT, "SOT", "Start of tile-part" },
+  [MARKERSLOT(SOD)] = { SOD, "SOD", "Start of data" },
+  [MARKERSLOT(EOC)] = { EOC, "EOI", "End of Image (JPEG 2000 EOC End of codestream)" },
+  [MARKERSLOT(SIZ)] = { SIZ, "SIZ", "Image and tile size" },
+  [MARKERSLOT(COD)] = { COD, "COD", "Coding style default" },
+  [MARKERSLOT(COC)] = { COC, "COC", "Coding style component" },
+  [MARKERSLOT(RGN)] = { RGN, "RGN", "Rgeion-of-interest" },
+  [MARKERSLOT(QCD)] = { QCD, "QCD", "Quantization default" },
+  [MARKERSLOT(QCC)] = { QCC, "QCC", "Quantization component" },
+  [MARKERSLOT(POC)] = { POC, "POC", "Progression order change" },
+  [MARKERSLOT(TLM)] = { TLM, "TLM", "Tile-part lengths" },
+  [MARKERSLOT(PLM)] = { PLM, "PLM", "Packet length, main header" },
+  [MARKERSLOT(PLT)] = { PLT, "PLT", "Packet length, tile-part header" },
+  [MARKERSLOT(PPM)] = { PPM, "PPM", "Packet packer headers, main header" },
+  [MARKERSLOT(PPT)] = { PPT, "PPT", "Packet packer headers, tile-part header" },
+  [MARKERSLOT(SOP)] = { SOP, "SOP", "Start of packet" },
+  [MARKERSLOT(EPH)] = { EPH, "EPH", "End of packet header" },
+  [MARKERSLOT(CRG)] = { CRG, "CRG", "Component registration" },
+  [MARKERSLOT(COM)] = { COM, "COM", "Comment (JPEG 2000)" },
 };
 
 static const dictentry * getdictentryfrommarker( uint_fast16_t marker )
 {
-  static const size_t n = sizeof( dict ) / sizeof( dictentry ) - 1; /* remove sentinel */
-  /* optimisation: binary search possible ? */
-  const dictentry * beg = dict;
-  const dictentry * end = dict + n;
-  const dictentry * p = beg;
-  for( ; p != end; ++p )
-    {
-    if( p->marker == marker ) return p;
-    }
-  assert( end->marker == 0 );
-  return end;
+  static const dictentry unknown = { 0, 0, 0 };
+  const dictentry * p = dict + MARKERSLOT( marker );
+  if( p->marker == marker && p->shortname ) return p;
+  return &unknown;
 }
 
 /* Table A.16 Progression order for the SGcod, SPcoc, and Ppoc parameters */
@@ -256,12 +240,22 @@ static bool print( uint_fast16_t marker, size_t len, FILE *stream )
     }
   const dictentry *d = getdictentryfrommarker( marker );
   assert( offset >= 0 );
-  fprintf(fout, "Offset 0x%04jx Marker 0x%04x %s %s ", offset, (unsigned int)marker, d->shortname, d->longname );
+  printstr( fout, "Offset 0x" );
+  printhex( fout, (uintmax_t)offset, 4, false );
+  printstr( fout, " Marker 0x" );
+  printhex( fout, marker, 4, false );
+  printstr( fout, " " );
+  printstr( fout, d->shortname );
+  printstr( fout, " " );
+  printstr( fout, d->longname );
+  printstr( fout, " " );
   if( !hasnolength( marker ) )
     {
-    fprintf(fout, "length variable 0x%02zx ", len + 2 );
+    printstr( fout, "length variable 0x" );
+    printhex( fout, len + 2, 2, false );
+    printstr( fout, " " );
     }
-  fprintf(fout,"\n");
+  printstr( fout, "\n" );
   switch( marker )
     {
   case EOC:
@@ -276,6 +270,7 @@ static bool print( uint_fast16_t marker, size_t len, FILE *stream )
 
 int main(int argc, char *argv[])
 {
+  const bool json = takejsonoption( &argc, &argv );
   if( argc < 2 ) return 1;
   const char *filename = argv[1];
 
@@ -288,6 +283,17 @@ int main(int argc, char *argv[])
     {
     fout = stdout;
     }
+  setoutputbuffer( fout );
+
+  if( json )
+    {
+    const bool ok = dumpjson( filename, fout );
+    if( argc > 2 )
+      {
+      fclose( fout );
+      }
+    return ok ? 0 : 1;
+    }
 
   bool b;
   if( isjp2file( filename ) )
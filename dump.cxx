@@ -1,7 +1,7 @@
 #include <iostream>
 #include <fstream>
 
-static const char array [] = {
+static const unsigned char array [] = {
 /*00000*/ 0xFF, 0x4F, 0xFF, 0x51, 0x00, 0x29, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,0x00,0x00,0x00,0x09,
 /*00020*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,0x00,0x00,0x00,0x09,
 /*00040*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x07, 0x01,0x01,0xFF,0x5C,0x00,
@@ -14,7 +14,7 @@ static const char array [] = {
 int main()
 {
   std::ofstream of( "iso.j2k", std::ios::binary );
-  of.write( array, sizeof( array ) );
+  of.write( (const char*)array, sizeof( array ) );
   of.close();
   return 0;
 }
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Export the tile-part and packet-length tables of J2K/JP2 files in a
+ * columnar binary layout that can be memory-mapped as plain arrays.
+ *
+ * The output is a sequence of chunks, one tile-part table and one packet
+ * table per input file, so that a file can be appended to (-a). All
+ * integers are little-endian, every chunk and every column starts on a
+ * multiple of 8 bytes:
+ *
+ *   0  "J2KT"
+ *   4  version (u16) = 1
+ *   6  table (u16): 1 tile-parts, 2 packets
+ *   8  chunk length (u64), header included
+ *  16  number of rows (u64)
+ *  24  number of columns (u32)
+ *  28  length of the source file name (u32)
+ *  32  column descriptors, 32 bytes each:
+ *        name (16 bytes, NUL padded), width in bytes (u32), reserved (u32),
+ *        offset of the array from the start of the chunk (u64)
+ *      source file name
+ *      arrays of unsigned integers
+ *
+ * tile-parts: isot tpsot tnsot offset psot dataoffset datalength
+ *             firstpacket npackets
+ * packets:    tilepart (row in the tile-part table of the same file) isot
+ *             offset length
+ * Offsets are absolute file positions. Packet lengths come from PLT, so
+ * tile-parts without PLT have no packet rows. With -j the tile-part headers
+ * of each file are read by that many threads.
+ *
+ * Usage: exporttables [-a] [-j threads] output input...
+ */
+#include <simpleparser.h>
+#include <simpleindex.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#define CHUNKVERSION 1
+#define TILEPARTS 1
+#define PACKETS 2
+#define MAXCOLUMNS 9
+
+typedef struct
+{
+  const char *name;
+  uint32_t width;
+} column;
+
+static const column tilepartcolumns[] = {
+  { "isot", 2 }, { "tpsot", 1 }, { "tnsot", 1 }, { "offset", 8 }, { "psot", 4 },
+  { "dataoffset", 8 }, { "datalength", 8 }, { "firstpacket", 8 }, { "npackets", 4 }
+};
+
+static const column packetcolumns[] = {
+  { "tilepart", 4 }, { "isot", 2 }, { "offset", 8 }, { "length", 4 }
+};
+
+static uint64_t align8( uint64_t n )
+{
+  return (n + 7) & ~(uint64_t)7;
+}
+
+static void putle( uint8_t *p, uint64_t value, uint32_t width )
+{
+  uint32_t i;
+  for( i = 0; i < width; ++i )
+    p[i] = (uint8_t)(value >> (8 * i));
+}
+
+/* A chunk is laid out in memory then written at once: `values[c][r]` is the
+ * value of column c at row r */
+static bool writechunk( FILE *out, uint16_t table, const column *columns, uint32_t ncolumns,
+  const char *source, uint64_t nrows, uint64_t *const *values )
+{
+  uint64_t offsets[MAXCOLUMNS];
+  const uint32_t namelength = (uint32_t)strlen( source );
+  uint64_t size = align8( 32 + 32 * (uint64_t)ncolumns + namelength );
+  uint32_t c;
+  uint64_t r;
+  assert( ncolumns <= MAXCOLUMNS );
+  for( c = 0; c < ncolumns; ++c )
+    {
+    offsets[c] = size;
+    size = align8( size + nrows * columns[c].width );
+    }
+  if( size > SIZE_MAX ) return false;
+  uint8_t *chunk = calloc( 1, (size_t)size );
+  if( !chunk ) return false;
+
+  memcpy( chunk, "J2KT", 4 );
+  putle( chunk + 4, CHUNKVERSION, 2 );
+  putle( chunk + 6, table, 2 );
+  putle( chunk + 8, size, 8 );
+  putle( chunk + 16, nrows, 8 );
+  putle( chunk + 24, ncolumns, 4 );
+  putle( chunk + 28, namelength, 4 );
+  for( c = 0; c < ncolumns; ++c )
+    {
+    uint8_t *d = chunk + 32 + 32 * c;
+    strncpy( (char*)d, columns[c].name, 16 );
+    putle( d + 16, columns[c].width, 4 );
+    putle( d + 24, offsets[c], 8 );
+    }
+  memcpy( chunk + 32 + 32 * ncolumns, source, namelength );
+  for( c = 0; c < ncolumns; ++c )
+    for( r = 0; r < nrows; ++r )
+      putle( chunk + offsets[c] + r * columns[c].width, values[c][r], columns[c].width );
+
+  const bool ok = fwrite( chunk, 1, (size_t)size, out ) == size;
+  free( chunk );
+  return ok;
+}
+
+static unsigned int nthreads; /* -j: tile-part headers are read in parallel */
+
+static bool exportfile( FILE *out, const char *filename )
+{
+  codestreamindex index;
+  const bool b = nthreads > 1 ? buildindexparallel( filename, &index, nthreads )
+    : buildindex( filename, &index );
+  if( !b )
+    {
+    fprintf( stderr, "could not index: %s\n", filename );
+    return false;
+    }
+  const size_t ntp = index.ntileparts;
+  const size_t np = index.npacketlengths;
+  uint64_t *tp[MAXCOLUMNS];
+  uint64_t *pk[4];
+  uint32_t c;
+  bool ok = true;
+  for( c = 0; c < MAXCOLUMNS; ++c )
+    ok = (tp[c] = malloc( (ntp + 1) * sizeof(uint64_t) )) && ok;
+  for( c = 0; c < 4; ++c )
+    ok = (pk[c] = malloc( (np + 1) * sizeof(uint64_t) )) && ok;
+
+  size_t i, j;
+  for( i = 0; ok && i < ntp; ++i )
+    {
+    const tilepartinfo *t = index.tileparts + i;
+    tp[0][i] = t->Isot;
+    tp[1][i] = t->TPsot;
+    tp[2][i] = t->TNsot;
+    tp[3][i] = t->offset;
+    tp[4][i] = t->Psot;
+    tp[5][i] = t->dataoffset;
+    tp[6][i] = t->datalength;
+    tp[7][i] = t->firstpacket;
+    tp[8][i] = t->npackets;
+    /* packets follow each other in the tile-part data */
+    uint64_t offset = t->dataoffset;
+    for( j = t->firstpacket; j < t->firstpacket + t->npackets && j < np; ++j )
+      {
+      pk[0][j] = i;
+      pk[1][j] = t->Isot;
+      pk[2][j] = offset;
+      pk[3][j] = index.packetlengths[j];
+      offset += index.packetlengths[j];
+      }
+    }
+
+  ok = ok && writechunk( out, TILEPARTS, tilepartcolumns, MAXCOLUMNS, filename, ntp, tp );
+  ok = ok && writechunk( out, PACKETS, packetcolumns, 4, filename, np, pk );
+
+  for( c = 0; c < MAXCOLUMNS; ++c ) free( tp[c] );
+  for( c = 0; c < 4; ++c ) free( pk[c] );
+  freeindex( &index );
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *mode = "wb";
+  for( ;; )
+    {
+    if( argc > 1 && strcmp( argv[1], "-a" ) == 0 )
+      {
+      mode = "ab";
+      --argc;
+      ++argv;
+      }
+    else if( argc > 2 && strcmp( argv[1], "-j" ) == 0 )
+      {
+      nthreads = (unsigned int)atoi( argv[2] );
+      argc -= 2;
+      argv += 2;
+      }
+    else
+      break;
+    }
+  if( argc < 3 )
+    {
+    fprintf( stderr, "usage: exporttables [-a] [-j threads] output input...\n" );
+    return 1;
+    }
+  FILE *out = fopen( argv[1], mode );
+  if( !out )
+    {
+    fprintf( stderr, "could not open: %s\n", argv[1] );
+    return 1;
+    }
+  int ret = 0;
+  int i;
+  for( i = 2; i < argc; ++i )
+    if( !exportfile( out, argv[i] ) )
+      ret = 1;
+  if( fclose( out ) != 0 ) ret = 1;
+  return ret;
+}
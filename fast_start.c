@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Rewrite a JP2 file so that every box other than the Contiguous Codestream
+ * box(es) comes first (jp2h, xml, uuid... which some writers put after jp2c).
+ * Relative order of the boxes is otherwise kept, the codestream is copied
+ * with copyrange (copy_file_range on Linux).
+ * With --index a small uuid box listing the type, offset and length of every
+ * top-level box of the output is written right after the File Type box, so a
+ * client gets the whole layout from the first few hundred bytes.
+ *
+ * Usage: faststart input.jp2 output.jp2 [--index]
+ */
+#include <simpleparser.h>
+#include <simplewriter.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+/* uuid of the box index: 9f622588-7788-4aac-92d0-f5c933bf501a */
+static const uint8_t indexuuid[16] = {
+  0x9f, 0x62, 0x25, 0x88, 0x77, 0x88, 0x4a, 0xac,
+  0x92, 0xd0, 0xf5, 0xc9, 0x33, 0xbf, 0x50, 0x1a
+};
+
+static bool writeindexbox( FILE *out, const boxinfo *order, size_t n, const uint64_t *newoffsets )
+{
+  const uint64_t len = 8 + 16 + 4 + 20 * (uint64_t)n;
+  assert( len <= UINT32_MAX );
+  bool ok = write32( out, (uint32_t)len ) && write32( out, UUID )
+    && fwrite( indexuuid, 1, sizeof(indexuuid), out ) == sizeof(indexuuid)
+    && write32( out, (uint32_t)n );
+  for( size_t i = 0; i < n && ok; ++i )
+    {
+    ok = write32( out, order[i].type )
+      && write32( out, (uint32_t)(newoffsets[i] >> 32) )
+      && write32( out, (uint32_t)newoffsets[i] )
+      && write32( out, (uint32_t)(order[i].length >> 32) )
+      && write32( out, (uint32_t)order[i].length );
+    }
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  if( argc < 3 )
+    {
+    fprintf( stderr, "usage: faststart input.jp2 output.jp2 [--index]\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  const char *outfilename = argv[2];
+  const bool withindex = argc > 3 && strcmp( argv[3], "--index" ) == 0;
+
+  if( strcmp( filename, outfilename ) == 0 || !isjp2file( filename ) )
+    {
+    fprintf( stderr, "not a JP2 file, or output would overwrite input\n" );
+    return 1;
+    }
+  boxinfo *boxes;
+  size_t nboxes;
+  if( !listboxes( filename, &boxes, &nboxes ) || nboxes < 2 )
+    {
+    fprintf( stderr, "could not parse: %s\n", filename );
+    return 1;
+    }
+  if( boxes[0].type != JP || boxes[1].type != FTYP )
+    {
+    fprintf( stderr, "JP2 signature and File Type box must come first\n" );
+    return 1;
+    }
+
+  /* stable partition: everything but jp2c, then jp2c */
+  const size_t n = nboxes + (withindex ? 1 : 0);
+  boxinfo *order = malloc( n * sizeof(boxinfo) );
+  uint64_t *newoffsets = malloc( n * sizeof(uint64_t) );
+  if( !order || !newoffsets ) return 1;
+  size_t k = 0;
+  for( size_t i = 0; i < nboxes; ++i )
+    {
+    if( boxes[i].type == JP2C ) continue;
+    order[k++] = boxes[i];
+    if( i == 1 && withindex )
+      {
+      order[k].type = UUID;
+      order[k].offset = 0; /* not in the input */
+      order[k].length = 8 + 16 + 4 + 20 * (uint64_t)n;
+      ++k;
+      }
+    }
+  for( size_t i = 0; i < nboxes; ++i )
+    if( boxes[i].type == JP2C )
+      order[k++] = boxes[i];
+  assert( k == n );
+  uint64_t pos = 0;
+  for( size_t i = 0; i < n; ++i )
+    {
+    newoffsets[i] = pos;
+    pos += order[i].length;
+    }
+
+  FILE *in = fopen( filename, "rb" );
+  FILE *out = fopen( outfilename, "wb" );
+  if( !in || !out ) return 1;
+  bool ok = true;
+  for( size_t i = 0; i < n && ok; ++i )
+    {
+    if( withindex && i == 2 )
+      ok = writeindexbox( out, order, n, newoffsets );
+    else
+      ok = copyrange( in, order[i].offset, order[i].length, out );
+    }
+  if( fclose( out ) != 0 ) ok = false;
+  fclose( in );
+  if( !ok )
+    {
+    fprintf( stderr, "could not write: %s\n", outfilename );
+    return 1;
+    }
+
+  free( newoffsets );
+  free( order );
+  free( boxes );
+
+  return 0;
+}
@@ -1,3 +1,16 @@
+/*
+ * Batch classifier: tell whether JPEG 2000 files (J2K or JP2) are coded
+ * with the reversible 5-3 wavelet and no quantization.
+ *
+ * Only headers are read: a small window (PREFIXSIZE) is read first and
+ * another one is read only when the parser needs bytes outside of it (box
+ * headers, big marker segments, tile-part headers found by walking Psot).
+ * Files are processed by a pool of threads, results are written in input
+ * order as CSV (default) or NDJSON.
+ *
+ * Usage: getlossy [-j threads] [--ndjson] [file...]
+ * with no file (or "-") the list of files is read from stdin, one per line.
+ */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -5,9 +18,11 @@
 #include <assert.h>
 #include <string.h>
 #include <byteswap.h>
+#include <pthread.h>
 /* stat */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 /* Part 1  Table A.2 List of markers and marker segments */
@@ -125,159 +140,408 @@ static inline bool hasnolength( uint_fast16_t marker )
 }
 
 
-static inline bool read16(const char ** input, size_t * len, uint16_t * ret)
+#define PREFIXSIZE (64 * 1024)
+#define TILEHEADERSIZE (4 * 1024)
+
+/* window of the file currently in memory */
+typedef struct
 {
-  if( *len >= 2 )
-  {
-  union { uint16_t v; char bytes[2]; } u;
-  memcpy(u.bytes, *input, 2);
-  *ret = bswap_16(u.v);
-  *input += 2; *len -= 2;
-  return true;
-  }
-  return false;
-}
+  int fd;
+  uint64_t filesize;
+  char *buffer;
+  size_t buffersize;     /* allocated */
+  uint64_t bufferoffset; /* file offset of buffer[0] */
+  size_t bufferlen;      /* valid bytes */
+  uint64_t bytesread;
+} reader;
 
+typedef struct
+{
+  bool ok;
+  const char *error;
+  uint8_t transformations; /* bit t set when Transformation t was found */
+  uint8_t quantizations;   /* bit s set when quantization style s was found */
+  bool tileoverrides;      /* COD/COC/QCD/QCC in a tile-part header */
+  uint32_t ntileparts;
+  uint64_t bytesread;
+} result;
 
-static inline bool read32(const char ** input, size_t * len, uint32_t * ret)
+/*
+ * Return a pointer to bytes [offset, offset + len) of the file, reading a
+ * new window of at least `readahead` bytes when they are not in memory.
+ * NULL when past the end of file
+ */
+static const char *getrange( reader *r, uint64_t offset, size_t len, size_t readahead )
 {
-  if( *len >= 4 )
-  {
-  union { uint32_t v; char bytes[4]; } u;
-  memcpy(u.bytes, *input, 4);
-  *ret = bswap_32(u.v);
-  *input += 4; *len -= 4;
-  return true;
-  }
-  return false;
+  if( offset >= r->bufferoffset && offset + len <= r->bufferoffset + r->bufferlen )
+    return r->buffer + (offset - r->bufferoffset);
+  if( offset > r->filesize || len > r->filesize - offset ) return NULL;
+  size_t want = len > readahead ? len : readahead;
+  if( want > r->filesize - offset ) want = (size_t)(r->filesize - offset);
+  if( want > r->buffersize )
+    {
+    char *p = realloc( r->buffer, want );
+    if( !p ) return NULL;
+    r->buffer = p;
+    r->buffersize = want;
+    }
+  size_t done = 0;
+  while( done < want )
+    {
+    const ssize_t n = pread( r->fd, r->buffer + done, want - done, (off_t)(offset + done) );
+    if( n <= 0 ) return NULL;
+    done += (size_t)n;
+    }
+  r->bufferoffset = offset;
+  r->bufferlen = want;
+  r->bytesread += want;
+  return r->buffer;
 }
 
-static inline bool read64(const char ** input, size_t * len, uint64_t * ret)
+static uint16_t get16( const char *p )
 {
-  if( *len >= 8 )
-  {
-  union { uint64_t v; char bytes[8]; } u;
-  memcpy(u.bytes, *input, 8);
-  *ret = bswap_64(u.v);
-  *input += 8; *len -= 8;
-  return true;
-  }
-  return false;
+  uint16_t v;
+  memcpy( &v, p, 2 );
+  return bswap_16( v );
+}
+
+static uint32_t get32( const char *p )
+{
+  uint32_t v;
+  memcpy( &v, p, 4 );
+  return bswap_32( v );
 }
 
+static uint64_t get64( const char *p )
+{
+  uint64_t v;
+  memcpy( &v, p, 8 );
+  return bswap_64( v );
+}
 
-static bool parsej2k_imp( const char * const stream, const size_t file_size, bool * lossless )
+static void addtransformation( result *res, uint8_t t )
 {
-  uint16_t marker;
-  uintmax_t sotlen = 0;
-  size_t lenmarker;
-  const char * cur = stream;
-  size_t cur_size = file_size;
-  *lossless = false; // default init
-  while( read16(&cur, &cur_size, &marker) )
-    {
-    if ( !hasnolength( marker ) )
-      {
-      uint16_t l;
-      bool r = read16( &cur, &cur_size, &l );
-      if( !r || l < 2 )
+  res->transformations |= (uint8_t)(t < 7 ? 1u << t : 0x80);
+}
+
+static void addquantization( result *res, uint8_t sq )
 {
-        printf( "  break %lu %d %d\n", cur_size, r, l);
-        break;
+  const uint8_t style = sq & 0x1f; /* Table A.28, top 3 bits are guard bits */
+  res->quantizations |= (uint8_t)(style < 7 ? 1u << style : 0x80);
 }
-      lenmarker = (size_t)l - 2;
 
-      if( marker == COD )
-        {
-        const uint8_t Transformation = *(cur+9);
-        printf( "%d\n", Transformation );
-        if( Transformation == 0x0 ) { *lossless = false; return true; }
-        else if( Transformation == 0x1 ) *lossless = true;
-        else return false;
-        }
-      else if( marker == SOT )
+/* walk main header and every tile-part header of the codestream [start, end) */
+static bool parsej2k_imp( reader *r, const uint64_t start, const uint64_t end, result *res )
+{
+  uint64_t pos = start;
+  uint64_t sotpos = 0;
+  uint32_t psot = 0;
+  uint16_t csiz = 0;
+  bool inmain = true;
+  const char *p = getrange( r, pos, 2, PREFIXSIZE );
+  if( !p || get16( p ) != SOC )
+    {
+    res->error = "no SOC";
+    return false;
+    }
+  pos += 2;
+  while( pos + 2 <= end )
+    {
+    const size_t readahead = inmain ? PREFIXSIZE : TILEHEADERSIZE;
+    p = getrange( r, pos, 2, readahead );
+    if( !p ) break;
+    const uint16_t marker = get16( p );
+    if( marker == EOC ) return true;
+    if( marker == SOD )
+      {
+      if( inmain || !psot ) return true; /* Psot = 0: last tile-part */
+      /* SOT (12 bytes) and SOD at least, and the scan must move forward */
+      if( psot < 14 || sotpos + psot <= pos )
         {
+        res->error = "invalid Psot";
+        return false;
         }
-      printf( "  %d %ud\n", lenmarker, cur_size );
-      cur += lenmarker; cur_size -= lenmarker;
+      pos = sotpos + psot;
+      continue;
+      }
+    if( hasnolength( marker ) )
+      {
+      pos += 2;
+      continue;
+      }
+    p = getrange( r, pos, 4, readahead );
+    if( !p ) break;
+    const uint16_t l = get16( p + 2 );
+    if( l < 2 ) break;
+    const char *seg = getrange( r, pos + 4, l - 2u, readahead );
+    if( !seg ) break;
+    const size_t len = l - 2u;
+    const size_t ncomp = csiz < 257 ? 1 : 2; /* Ccoc, Cqcc size */
+    switch( marker )
+      {
+    case SIZ:
+      if( len >= 36 ) csiz = get16( seg + 34 );
+      break;
+    case SOT:
+      if( len < 8 ) goto truncated;
+      inmain = false;
+      sotpos = pos;
+      psot = get32( seg + 2 );
+      ++res->ntileparts;
+      break;
+    case COD:
+      /* Scod SGcod(4) then SPcod: NL xcb ycb style Transformation */
+      if( len < 10 ) goto truncated;
+      addtransformation( res, (uint8_t)seg[9] );
+      if( !inmain ) res->tileoverrides = true;
+      break;
+    case COC:
+      if( len < ncomp + 6 ) goto truncated;
+      addtransformation( res, (uint8_t)seg[ncomp + 5] );
+      if( !inmain ) res->tileoverrides = true;
+      break;
+    case QCD:
+      if( len < 1 ) goto truncated;
+      addquantization( res, (uint8_t)seg[0] );
+      if( !inmain ) res->tileoverrides = true;
+      break;
+    case QCC:
+      if( len < ncomp + 1 ) goto truncated;
+      addquantization( res, (uint8_t)seg[ncomp] );
+      if( !inmain ) res->tileoverrides = true;
+      break;
       }
-      else if( marker == SOD )
-        return true;
+    pos += 2 + (uint64_t)l;
     }
-
+  /* no EOC: accept a stream truncated on a tile-part boundary */
+  if( !inmain && pos >= end ) return true;
+truncated:
+  res->error = "truncated codestream";
   return false;
 }
 
-static bool parsejp2_imp( const char * const stream, const size_t file_size, bool * lossless )
+static bool parsejp2_imp( reader *r, result *res )
 {
-  uint32_t marker;
-  uint64_t len64; /* ref */
-  uint32_t len32; /* local 32bits op */
-  const char * cur = stream;
-  size_t cur_size = file_size;
-
-  while( read32(&cur, &cur_size, &len32) )
+  uint64_t pos = 0;
+  while( pos + 8 <= r->filesize )
     {
-    bool b = read32(&cur, &cur_size, &marker);
-    if( !b ) break;
-    len64 = len32;
-    if( len32 == 1 ) /* 64bits ? */
+    const char *p = getrange( r, pos, 16 <= r->filesize - pos ? 16 : 8, PREFIXSIZE );
+    if( !p ) break;
+    uint64_t len64 = get32( p );
+    const uint32_t marker = get32( p + 4 );
+    uint64_t headerlen = 8;
+    if( len64 == 1 ) /* 64bits ? */
       {
-      bool b = read64(&cur, &cur_size, &len64);
-      assert( b );
-      len64 -= 8;
+      if( r->filesize - pos < 16 ) break;
+      len64 = get64( p + 8 );
+      headerlen = 16;
       }
+    else if( len64 == 0 ) /* up to the end of file */
+      len64 = r->filesize - pos;
+    if( len64 < headerlen || len64 > r->filesize - pos ) break;
     if( marker == JP2C )
-      {
-      const size_t start = cur - stream;
-      if( !len64 )
-        {
-        len64 = (size_t)(file_size - start + 8);
-        }
-      assert( len64 >= 8 );
-      printf( "debug %d\n", len64 - 8 );
-      return parsej2k_imp( cur, len64 - 8 /*cur_size*/, lossless );
-      }
+      return parsej2k_imp( r, pos + headerlen, pos + len64, res );
+    pos += len64;
+    }
+  res->error = "no codestream";
+  return false;
+}
 
-      const size_t lenmarker = len64 - 8;
-#if 1
-      union { uint32_t v; char bytes[4]; } u;
-      u.v = marker;
-      char dest[5];
-      memcpy(dest, u.bytes, 4 );
-      dest[4] = 0;
-      printf( "%s %x %d\n", dest, marker, lenmarker );
-#endif
-      cur += lenmarker;
+static void classify( const char *filename, result *res )
+{
+  memset( res, 0, sizeof(*res) );
+  reader r;
+  memset( &r, 0, sizeof(r) );
+  struct stat buf;
+  r.fd = open( filename, O_RDONLY );
+  if( r.fd < 0 || fstat( r.fd, &buf ) != 0 )
+    {
+    res->error = "cannot open";
+    if( r.fd >= 0 ) close( r.fd );
+    return;
     }
+  r.filesize = (uint64_t)buf.st_size;
+  const char *p = getrange( &r, 0, 1, PREFIXSIZE );
+  if( !p )
+    res->error = "empty file";
+  else if( (unsigned char)*p == 0xFF )
+    res->ok = parsej2k_imp( &r, 0, r.filesize, res );
+  else
+    res->ok = parsejp2_imp( &r, res );
+  if( res->ok && !res->transformations )
+    {
+    res->ok = false;
+    res->error = "no COD";
+    }
+  res->bytesread = r.bytesread;
+  free( r.buffer );
+  close( r.fd );
+}
 
-  return false;
+/* thread pool: workers pick the next file until the list is exhausted */
+static char **files;
+static size_t nfiles;
+static result *results;
+static size_t nextfile;
+static pthread_mutex_t nextlock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *worker( void *arg )
+{
+  (void)arg;
+  for( ;; )
+    {
+    pthread_mutex_lock( &nextlock );
+    const size_t i = nextfile++;
+    pthread_mutex_unlock( &nextlock );
+    if( i >= nfiles ) break;
+    classify( files[i], results + i );
+    }
+  return NULL;
 }
 
+static bool islossless( const result *res )
+{
+  /* 5-3 reversible everywhere and no quantization */
+  return res->ok && res->transformations == 0x2 && res->quantizations == 0x1;
+}
 
-int main(int argc, char * argv[])
+static const char *gettransformationstring( uint8_t transformations )
 {
-  if( argc < 2 ) return 1;
-  const char * filename = argv[1];
-  struct stat buf;
-  if (stat(filename, &buf) != 0)
-	  return 1;
-  size_t flen = buf.st_size;
+  switch( transformations )
+    {
+  case 0x0: return "";
+  case 0x1: return "9-7";
+  case 0x2: return "5-3";
+    }
+  return (transformations & 0x3) == 0x3 ? "mixed" : "other";
+}
+
+static const char *getquantizationstring( uint8_t quantizations )
+{
+  switch( quantizations )
+    {
+  case 0x0: return "";
+  case 0x1: return "none";
+  case 0x2: return "derived";
+  case 0x4: return "expounded";
+    }
+  return "mixed";
+}
 
-  FILE * in = fopen( filename, "rb" );
+/* quote for CSV (RFC 4180) or JSON */
+static void printquoted( const char *s, bool json )
+{
+  putchar( '"' );
+  for( ; *s; ++s )
+    {
+    const unsigned char c = (unsigned char)*s;
+    if( !json && c == '"' ) fputs( "\"\"", stdout );
+    else if( json && (c == '"' || c == '\\') ) printf( "\\%c", c );
+    else if( json && c < 0x20 ) printf( "\\u%04x", c );
+    else putchar( c );
+    }
+  putchar( '"' );
+}
 
-  char * mem = malloc( flen );
-  fread(mem, 1, flen, in );
-  bool b = (unsigned char)*mem == 0xFF ? false : true;
-  bool lossless;
-  if( b ) 
-  b = parsejp2_imp( mem, flen, &lossless);
+static void printresult( const char *filename, const result *res, bool json )
+{
+  if( json )
+    {
+    fputs( "{\"file\":", stdout );
+    printquoted( filename, true );
+    if( !res->ok )
+      {
+      fputs( ",\"error\":", stdout );
+      printquoted( res->error, true );
+      }
+    else
+      printf( ",\"lossless\":%s,\"transformation\":\"%s\",\"quantization\":\"%s\","
+        "\"tileoverrides\":%s,\"tileparts\":%u",
+        islossless( res ) ? "true" : "false",
+        gettransformationstring( res->transformations ),
+        getquantizationstring( res->quantizations ),
+        res->tileoverrides ? "true" : "false", res->ntileparts );
+    printf( ",\"bytesread\":%llu}\n", (unsigned long long)res->bytesread );
+    }
   else
-  b = parsej2k_imp( mem, flen, &lossless);
-  if(!b) printf("failed to parse\n");
-  printf("lossless: %d\n", lossless);
-  free(mem);
+    {
+    printquoted( filename, false );
+    printf( ",%d,%s,%s,%d,%u,%llu,%s\n",
+      islossless( res ) ? 1 : 0,
+      gettransformationstring( res->transformations ),
+      getquantizationstring( res->quantizations ),
+      res->tileoverrides ? 1 : 0, res->ntileparts,
+      (unsigned long long)res->bytesread,
+      res->ok ? "" : res->error );
+    }
+}
+
+static bool addfile( const char *filename, size_t *maxfiles )
+{
+  if( nfiles == *maxfiles )
+    {
+    const size_t n = *maxfiles ? 2 * *maxfiles : 1024;
+    char **p = realloc( files, n * sizeof(char*) );
+    if( !p ) return false;
+    files = p;
+    *maxfiles = n;
+    }
+  files[nfiles] = strdup( filename );
+  return files[nfiles++] != NULL;
+}
 
-  fclose(in);
-  return 0;
+int main(int argc, char * argv[])
+{
+  long nthreads = sysconf( _SC_NPROCESSORS_ONLN );
+  bool json = false;
+  bool fromstdin = true;
+  size_t maxfiles = 0;
+  for( int i = 1; i < argc; ++i )
+    {
+    if( strcmp( argv[i], "-j" ) == 0 && i + 1 < argc )
+      nthreads = atol( argv[++i] );
+    else if( strcmp( argv[i], "--ndjson" ) == 0 )
+      json = true;
+    else if( strcmp( argv[i], "-" ) != 0 )
+      {
+      if( !addfile( argv[i], &maxfiles ) ) return 1;
+      fromstdin = false;
+      }
+    }
+  if( fromstdin )
+    {
+    char *line = NULL;
+    size_t n = 0;
+    ssize_t l;
+    while( (l = getline( &line, &n, stdin )) > 0 )
+      {
+      if( line[l - 1] == '\n' ) line[--l] = 0;
+      if( l && !addfile( line, &maxfiles ) ) return 1;
+      }
+    free( line );
+    }
+  if( nthreads < 1 ) nthreads = 1;
+  if( (size_t)nthreads > nfiles ) nthreads = nfiles ? (long)nfiles : 1;
+
+  results = calloc( nfiles + 1, sizeof(result) );
+  pthread_t *threads = calloc( (size_t)nthreads, sizeof(pthread_t) );
+  if( !results || !threads ) return 1;
+  for( long t = 0; t < nthreads; ++t )
+    if( pthread_create( threads + t, NULL, worker, NULL ) != 0 ) return 1;
+  for( long t = 0; t < nthreads; ++t )
+    pthread_join( threads[t], NULL );
+
+  if( !json )
+    printf( "file,lossless,transformation,quantization,tileoverrides,tileparts,bytesread,error\n" );
+  int ret = 0;
+  for( size_t i = 0; i < nfiles; ++i )
+    {
+    printresult( files[i], results + i, json );
+    if( !results[i].ok ) ret = 1;
+    free( files[i] );
+    }
+  free( threads );
+  free( results );
+  free( files );
+  return ret;
 }
@@ -40,10 +40,17 @@ applicable local, state, national or international regulations.
 
 #include <iostream>
 #include <fstream>
-#include <iomanip>
 #include <stdint.h>
 #include <cassert>
 #include <cstring>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 std::ostream *pout = NULL;
 
@@ -161,9 +168,19 @@ const uint16_t JPEG_MARKER_FF3F = 0xff3f;
 
 void writeZeroPaddedHexNumber(std::ostream &out, const unsigned long & a, const int & b)
 {
-  out << "0x";
-  out << std::hex << std::setw( b ) << std::setfill( '0' ) << a;
-  out << std::dec;
+  // formatted by hand, toggling std::hex/std::setw costs more than the output
+  char buffer[2+2*sizeof(unsigned long)];
+  char *end=buffer+sizeof(buffer);
+  char *p=end;
+  unsigned long value=a;
+  do {
+    *--p="0123456789abcdef"[value & 0xf];
+    value >>= 4;
+  } while (value);
+  while (end-p < b && p > buffer+2) *--p='0';
+  *--p='x';
+  *--p='0';
+  out.write(p,end-p);
 }
 
 uint16_t isFixedLengthJPEGSegment(uint16_t marker)
@@ -330,26 +347,96 @@ struct JPEGMarkerDictionaryEntry {
 };
 
 class JPEGMarkerDictionary {
+  // Direct table on the low byte of the marker (all have 0xff as high byte),
+  // the first entry of the table wins as it did with a linear search
+  const JPEGMarkerDictionaryEntry *index[256];
 public:
-  JPEGMarkerDictionary() {}
-
-  bool getEntry(uint16_t code,const char * &abbreviation,const char * &description) const
+  JPEGMarkerDictionary()
     {
-      JPEGMarkerDictionaryEntry *ptr=JPEGMarkerDictionaryTable;
-      while (ptr && ptr->abbreviation) {
-        if (code == ptr->markercode) {
-          abbreviation=ptr->abbreviation;
-          description =ptr->description;
-          return true;
+      memset(index,0,sizeof(index));
+      const JPEGMarkerDictionaryEntry *ptr;
+      for (ptr=JPEGMarkerDictionaryTable; ptr->abbreviation; ++ptr) {
+        if ((ptr->markercode & 0xff00) == 0xff00 && !index[ptr->markercode & 0xff]) {
+          index[ptr->markercode & 0xff]=ptr;
         }
-        ++ptr;
       }
-      return false;
+    }
+
+  bool getEntry(uint16_t code,const char * &abbreviation,const char * &description) const
+    {
+      if ((code & 0xff00) != 0xff00) return false;
+      const JPEGMarkerDictionaryEntry *ptr=index[code & 0xff];
+      if (!ptr) return false;
+      abbreviation=ptr->abbreviation;
+      description =ptr->description;
+      return true;
     }
 };
 
 
 
+// Bump allocator for the parameter objects of one file: everything is
+// released at once by reset() and the blocks are reused for the next file.
+class JPEGArena {
+  struct Block {
+    Block *next;
+    size_t size;
+  };
+  Block *first;
+  Block *current;
+  size_t used;
+  static const size_t BLOCKSIZE = 1 << 16;
+
+  static size_t align(size_t n) { return (n+15) & ~(size_t)15; }
+  static char *dataOf(Block *b) { return (char *)b+align(sizeof(Block)); }
+public:
+  JPEGArena() : first(0), current(0), used(0) {}
+
+  ~JPEGArena()
+    {
+      while (first) {
+        Block *next=first->next;
+        free(first);
+        first=next;
+      }
+    }
+
+  void *allocate(size_t n)
+    {
+      n=align(n ? n : 1);
+      if (current && used+n <= current->size) {
+        void *p=dataOf(current)+used;
+        used+=n;
+        return p;
+      }
+      // move on to the next block kept from a previous file, or chain a new one
+      Block *next=current ? current->next : first;
+      if (!next || next->size < n) {
+        size_t size=n > BLOCKSIZE ? n : BLOCKSIZE;
+        Block *b=(Block *)malloc(align(sizeof(Block))+size);
+        if (!b) throw std::bad_alloc();
+        b->size=size;
+        b->next=next;
+        if (current) current->next=b; else first=b;
+        next=b;
+      }
+      current=next;
+      used=n;
+      return dataOf(current);
+    }
+
+  template <class T> T *allocateArray(size_t n)
+    {
+      return static_cast<T *>(allocate(n*sizeof(T)));
+    }
+
+  void reset()
+    {
+      current=0;
+      used=0;
+    }
+};
+
 class JPEG_APP0_JFIF_Parameters {
   unsigned short version;
   unsigned short units;
@@ -396,14 +483,14 @@ class JPEG_SOS_Parameters {
   unsigned SuccessiveApproximationBitPositionHigh;
   unsigned SuccessiveApproximationBitPositionLowOrPointTransform;
 public:
-  JPEG_SOS_Parameters(const unsigned char *buffer,size_t length)
+  JPEG_SOS_Parameters(const unsigned char *buffer,size_t length,JPEGArena &arena)
     {
       nComponentsPerScan=buffer[0];
       assert(length == 1+nComponentsPerScan*2+3);
-      ScanComponentSelector       =new unsigned[nComponentsPerScan];
-      DCEntropyCodingTableSelector=new unsigned[nComponentsPerScan];
-      ACEntropyCodingTableSelector=new unsigned[nComponentsPerScan];
-      MappingTableSelector        =new unsigned[nComponentsPerScan];  // LS
+      ScanComponentSelector       =arena.allocateArray<unsigned>(nComponentsPerScan);
+      DCEntropyCodingTableSelector=arena.allocateArray<unsigned>(nComponentsPerScan);
+      ACEntropyCodingTableSelector=arena.allocateArray<unsigned>(nComponentsPerScan);
+      MappingTableSelector        =arena.allocateArray<unsigned>(nComponentsPerScan);  // LS
       unsigned short i;
       for (i=0; i<nComponentsPerScan; ++i) {
         ScanComponentSelector[i]       =buffer[1+i*2];
@@ -419,13 +506,12 @@ public:
       dump(*pout);
     }
 
-  ~JPEG_SOS_Parameters()
-    {
-      if (nComponentsPerScan && ScanComponentSelector)        delete[] ScanComponentSelector;
-      if (nComponentsPerScan && DCEntropyCodingTableSelector) delete[] DCEntropyCodingTableSelector;
-      if (nComponentsPerScan && ACEntropyCodingTableSelector) delete[] ACEntropyCodingTableSelector;
-      if (nComponentsPerScan && MappingTableSelector)   delete[] MappingTableSelector;  // LS
-    }
+  unsigned getNumberOfComponents() const { return nComponentsPerScan; }
+  unsigned getComponentSelector(unsigned i) const { return ScanComponentSelector[i]; }
+  unsigned getStartOfSpectralSelection() const { return StartOfSpectralOrPredictorSelection; }
+  unsigned getEndOfSpectralSelection() const { return EndOfSpectralSelection; }
+  unsigned getSuccessiveApproximationHigh() const { return SuccessiveApproximationBitPositionHigh; }
+  unsigned getSuccessiveApproximationLow() const { return SuccessiveApproximationBitPositionLowOrPointTransform; }
 
   void dump(std::ostream &out) const
     {
@@ -457,17 +543,17 @@ class JPEG_SOF_Parameters {
   unsigned *VerticalSamplingFactor;
   unsigned *QuantizationTableDestinationSelector;
 public:
-  JPEG_SOF_Parameters(const unsigned char *buffer,size_t length)
+  JPEG_SOF_Parameters(const unsigned char *buffer,size_t length,JPEGArena &arena)
     {
       SamplePrecision    = buffer[0];
       nLines             =(buffer[1]<<8)+buffer[2];
       nSamplesPerLine    =(buffer[3]<<8)+buffer[4];
       nComponentsInFrame = buffer[5];
       assert(length == 6+nComponentsInFrame*3);
-      ComponentIdentifier                 = new unsigned[nComponentsInFrame];
-      HorizontalSamplingFactor            = new unsigned[nComponentsInFrame];
-      VerticalSamplingFactor              = new unsigned[nComponentsInFrame];
-      QuantizationTableDestinationSelector= new unsigned[nComponentsInFrame];
+      ComponentIdentifier                 = arena.allocateArray<unsigned>(nComponentsInFrame);
+      HorizontalSamplingFactor            = arena.allocateArray<unsigned>(nComponentsInFrame);
+      VerticalSamplingFactor              = arena.allocateArray<unsigned>(nComponentsInFrame);
+      QuantizationTableDestinationSelector= arena.allocateArray<unsigned>(nComponentsInFrame);
       unsigned short i;
       for (i=0; i<nComponentsInFrame; ++i) {
         ComponentIdentifier[i]                  = buffer[6+i*3];
@@ -479,13 +565,12 @@ public:
       dump(*pout);
     }
 
-  ~JPEG_SOF_Parameters()
-    {
-      if (nComponentsInFrame && ComponentIdentifier)                  delete[] ComponentIdentifier;
-      if (nComponentsInFrame && HorizontalSamplingFactor)             delete[] HorizontalSamplingFactor;
-      if (nComponentsInFrame && VerticalSamplingFactor)               delete[] VerticalSamplingFactor;
-      if (nComponentsInFrame && QuantizationTableDestinationSelector) delete[] QuantizationTableDestinationSelector;
-    }
+  unsigned getNumberOfLines() const { return nLines; }
+  unsigned getNumberOfSamplesPerLine() const { return nSamplesPerLine; }
+  unsigned getNumberOfComponents() const { return nComponentsInFrame; }
+  unsigned getComponentIdentifier(unsigned i) const { return ComponentIdentifier[i]; }
+  unsigned getHorizontalSamplingFactor(unsigned i) const { return HorizontalSamplingFactor[i]; }
+  unsigned getVerticalSamplingFactor(unsigned i) const { return VerticalSamplingFactor[i]; }
 
   void dump(std::ostream &out) const
     {
@@ -513,12 +598,12 @@ class JPEG_DHT_Parameters {
   unsigned  **nHuffmanCodesOfLengthI;
   unsigned ***ValueOfHuffmanCodeIJ;
 public:
-  JPEG_DHT_Parameters(const unsigned char *buffer,size_t length)
+  JPEG_DHT_Parameters(const unsigned char *buffer,size_t length,JPEGArena &arena)
     {
-      TableClass             = new unsigned   [4];
-      HuffmanTableIdentifier = new unsigned   [4];
-      nHuffmanCodesOfLengthI = new unsigned  *[4];
-      ValueOfHuffmanCodeIJ   = new unsigned **[4];
+      TableClass             = arena.allocateArray<unsigned>(4);
+      HuffmanTableIdentifier = arena.allocateArray<unsigned>(4);
+      nHuffmanCodesOfLengthI = arena.allocateArray<unsigned *>(4);
+      ValueOfHuffmanCodeIJ   = arena.allocateArray<unsigned **>(4);
 
       assert(TableClass);
       assert(HuffmanTableIdentifier);
@@ -530,7 +615,7 @@ public:
         assert(nTables<4);
         TableClass[nTables]             = buffer[0] >> 4;
         HuffmanTableIdentifier[nTables] = buffer[0] & 0x0f;
-        nHuffmanCodesOfLengthI[nTables] = new unsigned[16];
+        nHuffmanCodesOfLengthI[nTables] = arena.allocateArray<unsigned>(16);
         assert(nHuffmanCodesOfLengthI[nTables]);
         ++buffer; --length;
         unsigned i;
@@ -538,10 +623,10 @@ public:
           assert(length > 0);
           nHuffmanCodesOfLengthI[nTables][i] = *buffer++; --length;
         }
-        ValueOfHuffmanCodeIJ[nTables] = new unsigned *[16];
+        ValueOfHuffmanCodeIJ[nTables] = arena.allocateArray<unsigned *>(16);
         assert(nHuffmanCodesOfLengthI[nTables]);
         for (i=0; i<16; ++i) {
-          ValueOfHuffmanCodeIJ[nTables][i] = new unsigned[nHuffmanCodesOfLengthI[nTables][i]];
+          ValueOfHuffmanCodeIJ[nTables][i] = arena.allocateArray<unsigned>(nHuffmanCodesOfLengthI[nTables][i]);
           assert(ValueOfHuffmanCodeIJ[nTables][i]);
           unsigned j;
           for (j=0; j<nHuffmanCodesOfLengthI[nTables][i]; ++j) {
@@ -556,32 +641,6 @@ public:
       dump(*pout);
     }
 
-  ~JPEG_DHT_Parameters()
-    {
-      if (TableClass)             delete[] TableClass;
-      if (HuffmanTableIdentifier) delete[] HuffmanTableIdentifier;
-
-      if (nHuffmanCodesOfLengthI) {
-        unsigned t;
-        for (t=0; t<nTables; ++t) {
-          if (nHuffmanCodesOfLengthI[t]) delete[] nHuffmanCodesOfLengthI[t];
-        }
-        delete[] nHuffmanCodesOfLengthI;
-      }
-
-      if (ValueOfHuffmanCodeIJ) {
-        unsigned t;
-        for (t=0; t<nTables; ++t) {
-          unsigned i;
-          for (i=0; i<16; ++i) {
-            if (ValueOfHuffmanCodeIJ[t][i]) delete[] ValueOfHuffmanCodeIJ[t][i];
-          }
-          if (ValueOfHuffmanCodeIJ[t]) delete[] ValueOfHuffmanCodeIJ[t];
-        }
-        delete[] ValueOfHuffmanCodeIJ;
-      }
-    }
-
   void dump(std::ostream &out) const
     {
       out << std::endl << "\tJPEG_DHT_Parameters:" << std::endl;
@@ -608,11 +667,11 @@ class JPEG_DQT_Parameters {
   unsigned   *QuantizationTableIdentifier;
   unsigned  **QuantizationTableElement;
 public:
-  JPEG_DQT_Parameters(const unsigned char *buffer,size_t length)
+  JPEG_DQT_Parameters(const unsigned char *buffer,size_t length,JPEGArena &arena)
     {
-      QuantizationTableElementPrecision = new unsigned   [4];
-      QuantizationTableIdentifier       = new unsigned   [4];
-      QuantizationTableElement          = new unsigned  *[4];
+      QuantizationTableElementPrecision = arena.allocateArray<unsigned>(4);
+      QuantizationTableIdentifier       = arena.allocateArray<unsigned>(4);
+      QuantizationTableElement          = arena.allocateArray<unsigned *>(4);
 
       assert(QuantizationTableElementPrecision);
       assert(QuantizationTableIdentifier);
@@ -623,7 +682,7 @@ public:
         assert(nTables<4);
         QuantizationTableElementPrecision[nTables] = buffer[0] >> 4;
         QuantizationTableIdentifier[nTables]       = buffer[0] & 0x0f;
-        QuantizationTableElement[nTables]          = new unsigned[64];
+        QuantizationTableElement[nTables]          = arena.allocateArray<unsigned>(64);
         assert(QuantizationTableElement[nTables]);
         ++buffer; --length;
 
@@ -646,20 +705,6 @@ public:
       dump(*pout);
     }
 
-  ~JPEG_DQT_Parameters()
-    {
-      if (QuantizationTableElementPrecision) delete[] QuantizationTableElementPrecision;
-      if (QuantizationTableIdentifier)       delete[] QuantizationTableIdentifier;
-
-      if (QuantizationTableElement) {
-        unsigned t;
-        for (t=0; t<nTables; ++t) {
-          if (QuantizationTableElement[t]) delete[] QuantizationTableElement[t];
-        }
-        delete[] QuantizationTableElement;
-      }
-    }
-
   void dump(std::ostream &out) const
     {
       out << std::endl << "\tJPEG_DQT_Parameters:" << std::endl;
@@ -712,10 +757,6 @@ public:
       dump(*pout);
     }
 
-  ~JPEG_LSE_Parameters()
-    {
-    }
-
   void dump(std::ostream &out) const
     {
       out << std::endl << "\tJPEG_LSE_Parameters - ID " << std::ios::dec << (unsigned)id << " ";
@@ -877,10 +918,6 @@ public:
       dump(*pout);
     }
 
-  ~JPEG_COD_Parameters()
-    {
-    }
-
   void dump(std::ostream &out) const
     {
       out << std::endl << "\tJPEG_COD_Parameters:" << std::endl;
@@ -914,61 +951,388 @@ public:
     }
 };
 
-uint16_t read8(std::istream &istr)
+// Block oriented input: the whole file is mmap'ed when possible, otherwise it
+// is read by blocks. Entropy-coded data is skipped with memchr (vectorized in
+// glibc) instead of one istream call per byte.
+class JPEGInput {
+  const unsigned char *data;   // current block
+  size_t pos;
+  size_t len;
+  bool ok;
+
+  void *map;
+  size_t mapsize;
+
+  std::ifstream file;
+  unsigned char *block;
+  static const size_t BLOCKSIZE = 1 << 16;
+
+  bool fill()
+    {
+      if (map || !file) return false;
+      file.read((char *)block,BLOCKSIZE);
+      len=file.gcount();
+      pos=0;
+      return len != 0;
+    }
+public:
+  JPEGInput(const char *filename) : data(0), pos(0), len(0), ok(true), map(0), mapsize(0), block(0)
+    {
+      int fd=open(filename,O_RDONLY);
+      struct stat st;
+      if (fd >= 0 && fstat(fd,&st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p=mmap(0,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (p != MAP_FAILED) {
+          madvise(p,(size_t)st.st_size,MADV_SEQUENTIAL);
+          map=p;
+          mapsize=(size_t)st.st_size;
+          data=(const unsigned char *)p;
+          len=mapsize;
+        }
+      }
+      if (fd >= 0) close(fd);
+      if (!map) {
+        file.open(filename,std::ios::binary);
+        block=new unsigned char[BLOCKSIZE];
+        data=block;
+        ok=file.is_open();
+      }
+    }
+
+  ~JPEGInput()
+    {
+      if (map) munmap(map,mapsize);
+      delete[] block;
+    }
+
+  bool good() const { return ok; }
+
+  uint16_t read8()
+    {
+      if (pos == len && !fill()) {
+        ok=false;
+        return 0;
+      }
+      return (uint16_t)data[pos++];
+    }
+
+  uint16_t read16()  // big-endian
+    {
+      uint16_t u=read8();
+      u <<= 8;
+      u |= read8();
+      return u;
+    }
+
+  bool read(unsigned char *buffer,size_t n)
+    {
+      while (n) {
+        if (pos == len && !fill()) {
+          ok=false;
+          return false;
+        }
+        size_t k=len-pos < n ? len-pos : n;
+        memcpy(buffer,data+pos,k);
+        buffer+=k; pos+=k; n-=k;
+      }
+      return true;
+    }
+
+  // skip bytes up to (not including) the next 0xff, return how many were skipped
+  size_t skipToMarkerPrefix()
+    {
+      size_t skipped=0;
+      while (pos != len || fill()) {
+        const void *p=memchr(data+pos,0xff,len-pos);
+        if (p) {
+          size_t k=(const unsigned char *)p-(data+pos);
+          pos+=k;
+          return skipped+k;
+        }
+        skipped+=len-pos;
+        pos=len;
+      }
+      return skipped;
+    }
+};
+
+static void writeLittleEndian(std::ostream &out,uint64_t value,unsigned nbytes)
 {
-  unsigned char b;
-  istr.read((char *)&b,1);
-  return (uint16_t)b;
+  unsigned char bytes[8];
+  unsigned i;
+  for (i=0; i<nbytes; ++i) {
+    bytes[i]=(unsigned char)(value >> (8*i));
+  }
+  out.write((const char *)bytes,nbytes);
 }
 
-uint16_t read16(std::istream &istr)  // big-endian
+// Restart intervals of one scan. Each interval is located by the offset of
+// its first entropy-coded byte (just after SOS or RSTn) and by the MCU it
+// starts with, so that a decoder can hand independent intervals to threads.
+struct JPEGScanInfo {
+  const JPEG_SOS_Parameters *scan;
+  unsigned long sos;               // offset of the SOS marker
+  unsigned long begin;             // first byte of entropy-coded data
+  unsigned long end;               // offset of the marker terminating the scan
+  unsigned long restartinterval;   // in MCUs, 0 when DRI is absent
+  unsigned long mcusperline;
+  unsigned long mcurows;           // 0 when the number of lines comes from DNL
+  size_t firstrestart;             // into JPEGDumper::restarts
+  size_t nrestarts;
+};
+
+// Large buffer in front of the output file: the std::endl ending each line
+// only reaches sync(), data is written out when the buffer is full or when
+// flush() is called.
+class JPEGOutputBuffer : public std::streambuf {
+  int fd;
+  char *buffer;
+  static const size_t BUFFERSIZE = 1 << 20;
+protected:
+  int overflow(int c)
+    {
+      if (!flush()) return EOF;
+      if (c != EOF) {
+        *pptr()=(char)c;
+        pbump(1);
+      }
+      return c == EOF ? 0 : c;
+    }
+
+  int sync() { return 0; }
+public:
+  JPEGOutputBuffer(int f) : fd(f), buffer(new char[BUFFERSIZE])
+    {
+      setp(buffer,buffer+BUFFERSIZE);
+    }
+
+  ~JPEGOutputBuffer()
+    {
+      flush();
+      delete[] buffer;
+    }
+
+  bool flush()
+    {
+      const char *p=pbase();
+      while (p < pptr()) {
+        ssize_t n=write(fd,p,pptr()-p);
+        if (n <= 0) return false;
+        p+=n;
+      }
+      setp(buffer,buffer+BUFFERSIZE);
+      return true;
+    }
+};
+
+// Dump files one after the other: parameter objects live in an arena that
+// is reset for each file and marker segments are read in a single buffer,
+// so memory does not grow when used from a long running process.
+class JPEGDumper {
+  JPEGArena arena;
+  unsigned char *segment;  // large enough for any marker segment
+
+  const JPEG_SOF_Parameters *frame;
+  unsigned long numberoflines;     // from SOF, or DNL when SOF has zero
+  bool lossless;
+  bool jpegls;
+  unsigned long restartinterval;
+  bool inscan;
+  std::vector<JPEGScanInfo> scans;
+  std::vector<unsigned long> restarts;  // offset of each RSTn marker
+
+  template <class T> void *place() { return arena.allocate(sizeof(T)); }
+
+  void computeMCUGrid(JPEGScanInfo &info) const;
+  void openScan(const JPEG_SOS_Parameters *scan,unsigned long sos,unsigned long begin);
+  void closeScan(unsigned long end);
+  void setNumberOfLines(unsigned long numberoflines);
+public:
+  JPEGDumper() : segment(new unsigned char[0xffff]) {}
+  ~JPEGDumper() { delete[] segment; }
+
+  int dump(const char *filename,std::ostream &out);
+
+  bool writeRestartIndex(const char *filename) const;
+  bool writeScanIndex(const char *filename) const;
+};
+
+static unsigned long divideRoundingUp(unsigned long a,unsigned long b)
 {
-  uint16_t u;
-  unsigned char b[2];
-  istr.read((char *)b,2);
-  u =  (uint16_t)b[0];
-  u <<= 8;
-  u |= (uint16_t)b[1];
-  return u;
+  return (a+b-1)/b;
 }
 
-int main(int argc, char *argv[])
+// MCU grid of a scan (A.2): an interleaved scan has one MCU per Hmax x Vmax
+// data units, a non-interleaved one has one data unit per MCU. Data units are
+// 8x8 blocks for DCT processes, single samples for lossless ones. JPEG-LS
+// restart intervals count lines, which is expressed as one MCU per line.
+void JPEGDumper::computeMCUGrid(JPEGScanInfo &info) const
+{
+  info.mcusperline=0;
+  info.mcurows=0;
+  if (!frame) return;
+  const unsigned long X=frame->getNumberOfSamplesPerLine();
+  const unsigned long Y=numberoflines;
+  if (jpegls) {
+    info.mcusperline=1;
+    info.mcurows=Y;
+    return;
+  }
+  const unsigned long unit=lossless ? 1 : 8;
+  unsigned long Hmax=1, Vmax=1;
+  unsigned i;
+  for (i=0; i<frame->getNumberOfComponents(); ++i) {
+    if (frame->getHorizontalSamplingFactor(i) > Hmax) Hmax=frame->getHorizontalSamplingFactor(i);
+    if (frame->getVerticalSamplingFactor(i) > Vmax) Vmax=frame->getVerticalSamplingFactor(i);
+  }
+  if (info.scan->getNumberOfComponents() > 1) {
+    info.mcusperline=divideRoundingUp(X,unit*Hmax);
+    info.mcurows    =divideRoundingUp(Y,unit*Vmax);
+  }
+  else {
+    unsigned long H=1, V=1;
+    for (i=0; i<frame->getNumberOfComponents(); ++i) {
+      if (frame->getComponentIdentifier(i) == info.scan->getComponentSelector(0)) {
+        H=frame->getHorizontalSamplingFactor(i);
+        V=frame->getVerticalSamplingFactor(i);
+      }
+    }
+    info.mcusperline=divideRoundingUp(divideRoundingUp(X*H,Hmax),unit);
+    info.mcurows    =divideRoundingUp(divideRoundingUp(Y*V,Vmax),unit);
+  }
+}
+
+void JPEGDumper::openScan(const JPEG_SOS_Parameters *scan,unsigned long sos,unsigned long begin)
 {
-  if( argc < 2 ) return 1;
-  std::ifstream cin( argv[1], std::ios::binary );
+  JPEGScanInfo info;
+  info.scan=scan;
+  info.sos=sos;
+  info.begin=begin;
+  info.end=0;
+  info.restartinterval=restartinterval;
+  info.firstrestart=restarts.size();
+  info.nrestarts=0;
+  computeMCUGrid(info);
+  scans.push_back(info);
+  inscan=true;
+}
 
-  std::ofstream fileout;
-  if( argc > 2 )
-    {
-    const char *outfilename = argv[2];
-    fileout.open( outfilename );
-    pout = &fileout;
+void JPEGDumper::closeScan(unsigned long end)
+{
+  JPEGScanInfo &info=scans.back();
+  info.end=end;
+  info.nrestarts=restarts.size()-info.firstrestart;
+  inscan=false;
+}
+
+// A DNL segment after the first scan gives the number of lines the SOF left
+// as zero; complete the scans recorded so far.
+void JPEGDumper::setNumberOfLines(unsigned long lines)
+{
+  if (numberoflines != 0) return;
+  numberoflines=lines;
+  std::vector<JPEGScanInfo>::iterator it;
+  for (it=scans.begin(); it != scans.end(); ++it) {
+    computeMCUGrid(*it);
+  }
+}
+
+// Binary restart index, all integers little-endian:
+//   "JRST" version(u32)=1 nscans(u32)
+//   per scan: begin(u64) end(u64) restartinterval(u32) mcusperline(u32)
+//             mcurows(u32) nintervals(u32)
+//             nintervals x { offset(u64) mcurow(u32) mcucolumn(u32) }
+// The first interval starts at begin, the following ones just after each
+// RSTn marker; an interval ends 2 bytes before the next one or at end.
+bool JPEGDumper::writeRestartIndex(const char *filename) const
+{
+  std::ofstream out(filename,std::ios::binary);
+  if (!out) return false;
+  out.write("JRST",4);
+  writeLittleEndian(out,1,4);
+  writeLittleEndian(out,scans.size(),4);
+  std::vector<JPEGScanInfo>::const_iterator it;
+  for (it=scans.begin(); it != scans.end(); ++it) {
+    writeLittleEndian(out,it->begin,8);
+    writeLittleEndian(out,it->end,8);
+    writeLittleEndian(out,it->restartinterval,4);
+    writeLittleEndian(out,it->mcusperline,4);
+    writeLittleEndian(out,it->mcurows,4);
+    writeLittleEndian(out,1+it->nrestarts,4);
+    size_t k;
+    for (k=0; k<=it->nrestarts; ++k) {
+      const unsigned long mcu=k*it->restartinterval;
+      const unsigned long row=it->mcusperline ? mcu/it->mcusperline : 0;
+      const unsigned long column=it->mcusperline ? mcu%it->mcusperline : 0;
+      writeLittleEndian(out,k ? restarts[it->firstrestart+k-1]+2 : it->begin,8);
+      writeLittleEndian(out,row,4);
+      writeLittleEndian(out,column,4);
     }
-  else
-    {
-    pout = &std::cout;
+  }
+  return out.good();
+}
+
+// Scan index, one line per scan. For a progressive image the first N scans
+// are decodable from the bytes before the 'end' of scan N followed by an EOI
+// (tables for scan N+1 only come after that point): 'budget' is the size of
+// that truncated file.
+bool JPEGDumper::writeScanIndex(const char *filename) const
+{
+  std::ofstream out(filename);
+  if (!out) return false;
+  out << "# scan sos begin end budget components Ss Se Ah Al" << std::endl;
+  size_t n;
+  for (n=0; n<scans.size(); ++n) {
+    const JPEGScanInfo &info=scans[n];
+    out << n << " " << info.sos << " " << info.begin << " " << info.end << " " << info.end+2 << " ";
+    unsigned i;
+    for (i=0; i<info.scan->getNumberOfComponents(); ++i) {
+      out << (i ? "," : "") << info.scan->getComponentSelector(i);
     }
-  std::ostream &fout = *pout;
+    out << " " << info.scan->getStartOfSpectralSelection()
+        << " " << info.scan->getEndOfSpectralSelection()
+        << " " << info.scan->getSuccessiveApproximationHigh()
+        << " " << info.scan->getSuccessiveApproximationLow()
+        << std::endl;
+  }
+  return out.good();
+}
 
-  JPEGMarkerDictionary dict;
+int JPEGDumper::dump(const char *filename,std::ostream &out)
+{
+  JPEGInput cin( filename );
+  arena.reset();
+  pout = &out;
+
+  frame=0;
+  numberoflines=0;
+  lossless=false;
+  jpegls=false;
+  restartinterval=0;
+  inscan=false;
+  scans.clear();
+  restarts.clear();
+
+  static const JPEGMarkerDictionary dict;
 
   bool doing_jpegls=false;
   bool doing_jpeg2k_tilepart=false;
 
   unsigned long offset=0;
-  uint16_t markerprefix=read8(cin);
+  uint16_t markerprefix=cin.read8();
   while (1) {
-    if (!cin) {
+    if (!cin.good()) {
       *pout << "End of file" << std::endl;
+      if (inscan) closeScan(offset);
       break;
     }
-    if (markerprefix != 0xff) {    // byte of entropy-coded segment
-      ++offset;
-      markerprefix=read8(cin);
+    if (markerprefix != 0xff) {    // bytes of entropy-coded segment
+      offset+=1+cin.skipToMarkerPrefix();
+      markerprefix=cin.read8();
       continue;
     }
-    uint16_t marker=read8(cin);
-    if (!cin) {
+    uint16_t marker=cin.read8();
+    if (!cin.good()) {
       *pout << "End of file immediately after marker flag 0xff ... presumably was padding" << std::endl;
       break;
     }
@@ -1003,7 +1367,7 @@ int main(int argc, char *argv[])
       *pout << " "
         << "Encoded 0xff in entropy-coded segment followed by stuffed zero byte"
         << std::endl;
-      markerprefix=read8(cin);
+      markerprefix=cin.read8();
       offset+=2;
       continue;
     }
@@ -1017,7 +1381,7 @@ int main(int argc, char *argv[])
       *pout << " "
         << "Encoded 0xff in entropy-coded segment followed by stuffed zero bit (JPEG-LS)"
         << std::endl;
-      markerprefix=read8(cin);
+      markerprefix=cin.read8();
       offset+=2;    // the dump doesn't need to look at the remaining 7 entropy coded segment bits
       continue;
     }
@@ -1026,6 +1390,15 @@ int main(int argc, char *argv[])
 
     marker|=0xff00;      // convention is to express them with the leading ff
 
+    if (inscan) {
+      if (marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7) {
+        restarts.push_back(offset);
+      }
+      else {
+        closeScan(offset);
+      }
+    }
+
     if (marker == JPEG_MARKER_SOF55) doing_jpegls=true;
     else if (marker == JPEG_MARKER_SOD) doing_jpeg2k_tilepart=true;
 
@@ -1042,8 +1415,8 @@ int main(int argc, char *argv[])
       *pout << abbrev << " " << desc << " ";
     }
     if (isVariableLengthJPEGSegment(marker)) {
-      uint16_t length=read16(cin);
-      if (cin) {
+      uint16_t length=cin.read16();
+      if (cin.good()) {
         offset+=2;
         *pout << "length variable ";
         writeZeroPaddedHexNumber(*pout,length,2);
@@ -1057,16 +1430,15 @@ int main(int argc, char *argv[])
       // NB. the length includes itself (but not the marker)
 
       if (length > 2) {
-        unsigned char *buffer=new unsigned char[length-2];
-        cin.read((char *)buffer,length-2);
-        if (!cin || cin.gcount() != length-2) {
+        unsigned char *buffer=segment;
+        if (!cin.read(buffer,length-2)) {
           *pout << "Error - couldn't read variable length parameter sequence" << std::endl;
           return 1;
         }
         else {
           switch (marker) {
           case JPEG_MARKER_SOS:
-            (void)new JPEG_SOS_Parameters(buffer,length-2);
+            openScan(new (place<JPEG_SOS_Parameters>()) JPEG_SOS_Parameters(buffer,length-2,arena),offset-4,offset+length-2);
             break;
           case JPEG_MARKER_SOF0:
           case JPEG_MARKER_SOF1:
@@ -1082,16 +1454,20 @@ int main(int argc, char *argv[])
           case JPEG_MARKER_SOFE:
           case JPEG_MARKER_SOFF:
           case JPEG_MARKER_SOF55:
-            (void)new JPEG_SOF_Parameters(buffer,length-2);
+            frame=new (place<JPEG_SOF_Parameters>()) JPEG_SOF_Parameters(buffer,length-2,arena);
+            lossless=marker == JPEG_MARKER_SOF3 || marker == JPEG_MARKER_SOF7
+              || marker == JPEG_MARKER_SOFB || marker == JPEG_MARKER_SOFF;
+            jpegls=marker == JPEG_MARKER_SOF55;
+            numberoflines=frame->getNumberOfLines();
             break;
           case JPEG_MARKER_DHT:
-            (void)new JPEG_DHT_Parameters(buffer,length-2);
+            (void)new (place<JPEG_DHT_Parameters>()) JPEG_DHT_Parameters(buffer,length-2,arena);
             break;
           case JPEG_MARKER_DQT:
-            (void)new JPEG_DQT_Parameters(buffer,length-2);
+            (void)new (place<JPEG_DQT_Parameters>()) JPEG_DQT_Parameters(buffer,length-2,arena);
             break;
           case JPEG_MARKER_LSE:            // LS
-            (void)new JPEG_LSE_Parameters(buffer,length-2);
+            (void)new (place<JPEG_LSE_Parameters>()) JPEG_LSE_Parameters(buffer,length-2);
             break;
           case JPEG_MARKER_DRI:
             unsigned long restartinterval;
@@ -1112,6 +1488,7 @@ int main(int argc, char *argv[])
             else {
               assert(0);
             }
+            this->restartinterval=restartinterval;
             *pout << std::endl << "\tJPEG_DRI_Parameters - Define Restart Interval = ";
             writeZeroPaddedHexNumber(*pout,restartinterval,4);
             *pout << std::endl;
@@ -1135,16 +1512,17 @@ int main(int argc, char *argv[])
             else {
               assert(0);
             }
+            setNumberOfLines(numberoflines);
             *pout << std::endl << "\tJPEG_DNL_Parameters - Define Number of Lines = ";
             writeZeroPaddedHexNumber(*pout,numberoflines,4);
             *pout << std::endl;
             break;
           case JPEG_MARKER_COD:
-            (void)new JPEG_COD_Parameters(buffer,length-2);
+            (void)new (place<JPEG_COD_Parameters>()) JPEG_COD_Parameters(buffer,length-2);
             break;
           case JPEG_MARKER_APP0:
             if (length >= 16 && strncmp((char*)(buffer),"JFIF",4) == 0) {
-              (void)new JPEG_APP0_JFIF_Parameters(buffer,length-2);
+              (void)new (place<JPEG_APP0_JFIF_Parameters>()) JPEG_APP0_JFIF_Parameters(buffer,length-2);
               break;
             }
           }
@@ -1162,8 +1540,7 @@ int main(int argc, char *argv[])
         break;
       case 3: {
         unsigned char value;
-        cin.read((char *)&value,1);
-        if (cin) {
+        if (cin.read(&value,1)) {
           offset+=1;
           *pout << "length fixed 3 value ";
           writeZeroPaddedHexNumber(*pout,(uint16_t)value,2);
@@ -1176,8 +1553,8 @@ int main(int argc, char *argv[])
       }
         break;
       case 4: {
-        uint16_t value=read16(cin);
-        if (cin) {
+        uint16_t value=cin.read16();
+        if (cin.good()) {
           offset+=2;
           *pout << "length fixed 3 value ";
           writeZeroPaddedHexNumber(*pout,value,2);
@@ -1195,9 +1572,65 @@ int main(int argc, char *argv[])
       }
     }
     *pout << std::endl;
-    markerprefix=read8(cin);
+    markerprefix=cin.read8();
   }
 
   return 0;
 }
 
+// jpegdump input [output] [--rst-index file] [--scan-index file]
+int main(int argc, char *argv[])
+{
+  const char *filename = NULL;
+  const char *outfilename = NULL;
+  const char *rstindexfilename = NULL;
+  const char *scanindexfilename = NULL;
+  int i;
+  for( i = 1; i < argc; ++i )
+    {
+    if( strcmp( argv[i], "--rst-index" ) == 0 && i + 1 < argc )
+      rstindexfilename = argv[++i];
+    else if( strcmp( argv[i], "--scan-index" ) == 0 && i + 1 < argc )
+      scanindexfilename = argv[++i];
+    else if( !filename )
+      filename = argv[i];
+    else if( !outfilename )
+      outfilename = argv[i];
+    else
+      return 1;
+    }
+  if( !filename ) return 1;
+
+  int fd = 1;
+  if( outfilename )
+    {
+    fd = open( outfilename, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if( fd < 0 )
+      {
+      std::cerr << "could not open " << outfilename << std::endl;
+      return 1;
+      }
+    }
+  JPEGOutputBuffer outbuf( fd );
+  std::ostream out( &outbuf );
+  pout = &out;
+
+  JPEGDumper dumper;
+  int ret = dumper.dump( filename, out );
+  if( !outbuf.flush() )
+    {
+    std::cerr << "could not write output" << std::endl;
+    return 1;
+    }
+  if( rstindexfilename && !dumper.writeRestartIndex( rstindexfilename ) )
+    {
+    std::cerr << "could not write " << rstindexfilename << std::endl;
+    return 1;
+    }
+  if( scanindexfilename && !dumper.writeScanIndex( scanindexfilename ) )
+    {
+    std::cerr << "could not write " << scanindexfilename << std::endl;
+    return 1;
+    }
+  return ret;
+}
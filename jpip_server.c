@@ -0,0 +1,829 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A JPIP-like server (ISO/IEC 15444-9) for one J2K/JP2 file, listening on
+ * the loopback interface. Each GET request is answered with a JPP-stream
+ * (image/jpp-stream) holding the data-bins of the view window: the main
+ * header, the headers of the tiles crossing the window and the precinct
+ * data-bins of the requested resolution, components and layers. Requests
+ * are stateless: there is no session nor cache model, each response holds
+ * complete data-bins.
+ *
+ * The view window comes from the query string:
+ *   fsiz=fx,fy[,round-down|round-up|closest]  frame size, selects the resolution
+ *   roff=ox,oy                                window offset in the frame
+ *   rsiz=sx,sy                                window size in the frame
+ *   layers=l                                  number of quality layers, at least 1
+ *   comps=c0-c1,c2                            components
+ * Without fsiz the full resolution is served.
+ *
+ * The codestream is indexed once at start. The tile headers and the packet
+ * tables of the tiles are kept in an LRU cache of `tiles` entries (64 by
+ * default). Codestreams with PPM or PPT are refused, their precinct
+ * data-bins would need the packet headers put back in place.
+ *
+ * Usage: jpipserver [-p port] [-c tiles] input
+ */
+#include <simpleindex.h>
+#include <simplegeometry.h>
+#include <simpleregion.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Table A.1 - Data-bin class identifiers */
+enum {
+  PRECINCT_BIN    = 0,
+  TILE_HEADER_BIN = 2,
+  MAIN_HEADER_BIN = 6
+};
+
+/* Table D.2 - EOR reason codes */
+#define EOR_WINDOW_DONE 2
+
+typedef struct
+{
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} buffer;
+
+static bool reserve( buffer *b, size_t len )
+{
+  if( b->len + len <= b->cap ) return true;
+  size_t n = b->cap ? b->cap : 4096;
+  while( n < b->len + len ) n *= 2;
+  uint8_t *d = realloc( b->data, n );
+  if( !d ) return false;
+  b->data = d;
+  b->cap = n;
+  return true;
+}
+
+static bool put( buffer *b, const void *data, size_t len )
+{
+  if( !reserve( b, len ) ) return false;
+  memcpy( b->data + b->len, data, len );
+  b->len += len;
+  return true;
+}
+
+static bool putf( buffer *b, const char *format, ... )
+{
+  char s[512];
+  va_list ap;
+  va_start( ap, format );
+  const int n = vsnprintf( s, sizeof(s), format, ap );
+  va_end( ap );
+  return n >= 0 && (size_t)n < sizeof(s) && put( b, s, (size_t)n );
+}
+
+static void freebuffer( buffer *b )
+{
+  free( b->data );
+  memset( b, 0, sizeof(*b) );
+}
+
+static codestreamindex csindex;
+static FILE *in;
+
+static bool putfile( buffer *b, uint64_t offset, uint64_t length )
+{
+  if( !reserve( b, length ) ) return false;
+  if( fseeko( in, (off_t)offset, SEEK_SET ) != 0 ) return false;
+  if( fread( b->data + b->len, 1, length, in ) != length ) return false;
+  b->len += length;
+  return true;
+}
+
+/* A.2.1 VBAS: 7 bits per byte, most significant first, bit 7 set on all
+ * bytes but the last */
+static bool putvbas( buffer *b, uint64_t v )
+{
+  uint8_t bytes[10];
+  size_t n = sizeof(bytes);
+  bytes[--n] = v & 0x7f;
+  while( v >>= 7 )
+    bytes[--n] = 0x80 | (v & 0x7f);
+  return put( b, bytes + n, sizeof(bytes) - n );
+}
+
+/*
+ * A.2.1 message header. The Bin-ID always announces a Class VBAS (and no
+ * CSn), its first byte carries 4 bits of the in-class identifier next to
+ * the is-last flag.
+ */
+static bool putmessage( buffer *b, uint8_t class, uint64_t id, bool last,
+  uint64_t offset, uint64_t length )
+{
+  uint8_t bytes[12];
+  size_t n = sizeof(bytes);
+  uint8_t more = 0;
+  while( id >= 16 )
+    {
+    bytes[--n] = more | (id & 0x7f);
+    more = 0x80;
+    id >>= 7;
+    }
+  bytes[--n] = (uint8_t)(more | 0x40 | (last ? 0x10 : 0) | id);
+  return put( b, bytes + n, sizeof(bytes) - n )
+    && putvbas( b, class ) && putvbas( b, offset ) && putvbas( b, length );
+}
+
+/* tile-parts grouped by tile, in codestream order */
+static size_t *firsttilepart;
+static size_t *tileparts;
+
+typedef struct
+{
+  uint32_t tile;
+  buffer header; /* tile-part headers without SOT and SOD */
+  tilegeometry geometry;
+  tilepacketlist packets;
+  int32_t newer;
+  int32_t older;
+} tileentry;
+
+static tileentry *cache;
+static int32_t ncache;
+static int32_t maxcache;
+static int32_t newest = -1;
+static int32_t oldest = -1;
+static int32_t *cached; /* entry of each tile, -1 when not loaded */
+
+static void freetileentry( tileentry *e )
+{
+  freebuffer( &e->header );
+  freetilegeometry( &e->geometry );
+  freetilepacketlist( &e->packets );
+}
+
+static void unlinkentry( int32_t i )
+{
+  tileentry *e = cache + i;
+  if( e->newer >= 0 ) cache[e->newer].older = e->older;
+  else newest = e->older;
+  if( e->older >= 0 ) cache[e->older].newer = e->newer;
+  else oldest = e->newer;
+}
+
+static void pushentry( int32_t i )
+{
+  tileentry *e = cache + i;
+  e->newer = -1;
+  e->older = newest;
+  if( newest >= 0 ) cache[newest].newer = i;
+  newest = i;
+  if( oldest < 0 ) oldest = i;
+}
+
+/* the returned entry stays valid until the next call */
+static const tileentry *gettileentry( uint32_t tile )
+{
+  int32_t i = cached[tile];
+  if( i >= 0 )
+    {
+    unlinkentry( i );
+    pushentry( i );
+    return cache + i;
+    }
+
+  tileentry e;
+  memset( &e, 0, sizeof(e) );
+  e.tile = tile;
+  const size_t *parts = tileparts + firsttilepart[tile];
+  const size_t nparts = firsttilepart[tile + 1] - firsttilepart[tile];
+  bool ok = buildtilegeometry( &csindex, tile, &e.geometry )
+    && gettilepartpackets( in, &csindex, tile, parts, nparts, &e.packets );
+  for( size_t k = 0; ok && k < nparts; ++k )
+    {
+    const tilepartinfo *tp = csindex.tileparts + parts[k];
+    /* 12 bytes of SOT before, 2 bytes of SOD after */
+    ok = putfile( &e.header, tp->offset + 12, tp->dataoffset - 2 - (tp->offset + 12) );
+    }
+  if( !ok )
+    {
+    freetileentry( &e );
+    return NULL;
+    }
+
+  if( ncache < maxcache )
+    i = ncache++;
+  else
+    {
+    i = oldest;
+    unlinkentry( i );
+    cached[ cache[i].tile ] = -1;
+    freetileentry( cache + i );
+    }
+  cache[i] = e;
+  pushentry( i );
+  cached[tile] = i;
+  return cache + i;
+}
+
+typedef struct
+{
+  uint64_t fx, fy;
+  int round; /* 0: round-down, 1: round-up, 2: closest */
+  uint64_t ox, oy;
+  uint64_t sx, sy;
+  bool hasfsiz;
+  bool hasrsiz;
+  uint16_t layers;
+  bool *components;
+} viewwindow;
+
+static void decodepercent( char *s )
+{
+  char *d = s;
+  for( ; *s; ++s )
+    {
+    if( *s == '%' && isxdigit( (unsigned char)s[1] ) && isxdigit( (unsigned char)s[2] ) )
+      {
+      const char h[3] = { s[1], s[2], 0 };
+      *d++ = (char)strtol( h, NULL, 16 );
+      s += 2;
+      }
+    else
+      *d++ = *s;
+    }
+  *d = 0;
+}
+
+static bool parsenumber( const char **s, uint64_t *v )
+{
+  char *end;
+  if( !isdigit( (unsigned char)**s ) ) return false;
+  errno = 0;
+  *v = strtoull( *s, &end, 10 );
+  *s = end;
+  return errno == 0;
+}
+
+static bool parsepair( const char **s, uint64_t *x, uint64_t *y )
+{
+  if( !parsenumber( s, x ) || **s != ',' ) return false;
+  ++*s;
+  return parsenumber( s, y );
+}
+
+/* C.4.5 comps=0-2,4 */
+static bool parsecomponents( const char *s, bool *components )
+{
+  do
+    {
+    uint64_t c0, c1;
+    if( !parsenumber( &s, &c0 ) ) return false;
+    c1 = c0;
+    if( *s == '-' )
+      {
+      ++s;
+      if( !parsenumber( &s, &c1 ) ) c1 = csindex.Csiz - 1u;
+      }
+    if( c1 < c0 ) return false;
+    for( uint64_t c = c0; c <= c1 && c < csindex.Csiz; ++c )
+      components[c] = true;
+    }
+  while( *s++ == ',' );
+  return s[-1] == 0;
+}
+
+static bool parsequery( char *query, viewwindow *w )
+{
+  for( char *field = strtok( query, "&" ); field; field = strtok( NULL, "&" ) )
+    {
+    char *value = strchr( field, '=' );
+    if( !value ) continue;
+    *value++ = 0;
+    decodepercent( value );
+    const char *s = value;
+    if( strcmp( field, "fsiz" ) == 0 )
+      {
+      if( !parsepair( &s, &w->fx, &w->fy ) ) return false;
+      if( strcmp( s, ",round-up" ) == 0 ) w->round = 1;
+      else if( strcmp( s, ",closest" ) == 0 ) w->round = 2;
+      else if( *s && strcmp( s, ",round-down" ) != 0 ) return false;
+      w->hasfsiz = true;
+      }
+    else if( strcmp( field, "roff" ) == 0 )
+      {
+      if( !parsepair( &s, &w->ox, &w->oy ) || *s ) return false;
+      }
+    else if( strcmp( field, "rsiz" ) == 0 )
+      {
+      if( !parsepair( &s, &w->sx, &w->sy ) || *s ) return false;
+      w->hasrsiz = true;
+      }
+    else if( strcmp( field, "layers" ) == 0 )
+      {
+      uint64_t l;
+      if( !parsenumber( &s, &l ) || *s ) return false;
+      /* 0 would read as all layers in the region request */
+      if( l < 1 ) l = 1;
+      w->layers = l < csindex.NumberOfLayers ? (uint16_t)l : csindex.NumberOfLayers;
+      }
+    else if( strcmp( field, "comps" ) == 0 )
+      {
+      if( !parsecomponents( s, w->components ) ) return false;
+      }
+    /* target, type, len... are ignored */
+    }
+  return true;
+}
+
+static uint64_t ceildivpow2( uint64_t a, unsigned int e )
+{
+  return (a + ((uint64_t)1 << e) - 1) >> e;
+}
+
+/* C.4.2 the number of discarded levels giving the frame size */
+static uint8_t getreduce( const viewwindow *w )
+{
+  uint8_t maxreduce = 32;
+  for( uint16_t c = 0; c < csindex.Csiz; ++c )
+    {
+    const uint8_t NL = csindex.components[c].cs.NumberOfDecompositionLevels;
+    if( NL < maxreduce ) maxreduce = NL;
+    }
+  if( !w->hasfsiz ) return 0;
+  uint8_t best = w->round == 0 ? maxreduce : 0;
+  uint64_t bestdistance = UINT64_MAX;
+  for( uint8_t d = 0; d <= maxreduce; ++d )
+    {
+    const uint64_t W = ceildivpow2( csindex.Xsiz, d ) - ceildivpow2( csindex.XOsiz, d );
+    const uint64_t H = ceildivpow2( csindex.Ysiz, d ) - ceildivpow2( csindex.YOsiz, d );
+    if( w->round == 0 && W <= w->fx && H <= w->fy ) return d;
+    if( w->round == 1 && W >= w->fx && H >= w->fy ) best = d;
+    if( w->round == 2 )
+      {
+      const uint64_t a = W * H, b = w->fx * w->fy;
+      const uint64_t distance = a > b ? a - b : b - a;
+      if( distance < bestdistance )
+        {
+        best = d;
+        bestdistance = distance;
+        }
+      }
+    }
+  return best;
+}
+
+typedef struct
+{
+  uint64_t key; /* precinct of the tile, then layer */
+  const tilepacket *packet;
+} precinctpacket;
+
+static int comparepackets( const void *a, const void *b )
+{
+  const precinctpacket *x = a;
+  const precinctpacket *y = b;
+  if( x->key != y->key ) return x->key < y->key ? -1 : 1;
+  return 0;
+}
+
+/* the precinct data-bins of one tile, A.3.2.1 for their identifiers */
+static bool puttile( buffer *body, uint32_t tile, const regionrequest *request )
+{
+  const tileentry *e = gettileentry( tile );
+  if( !e ) return false;
+  if( !putmessage( body, TILE_HEADER_BIN, tile, true, 0, e->header.len )
+    || !put( body, e->header.data, e->header.len ) ) return false;
+
+  const tilegeometry *g = &e->geometry;
+  precinctpacket *selected = malloc( (e->packets.npackets + 1) * sizeof(precinctpacket) );
+  if( !selected ) return false;
+  size_t n = 0;
+  for( size_t k = 0; k < e->packets.npackets; ++k )
+    {
+    const tilepacket *p = e->packets.packets + k;
+    if( !isregionpacket( g, request, &p->id ) ) continue;
+    const resolutiongeometry *rg = getresolutiongeometry( g, p->id.comp, p->id.res );
+    selected[n].key = ((uint64_t)(rg->firstprecinct + p->id.precinct) << 16) | p->id.layer;
+    selected[n].packet = p;
+    ++n;
+    }
+  qsort( selected, n, sizeof(precinctpacket), comparepackets );
+
+  const uint64_t ntiles = getnumberoftiles( &csindex );
+  bool ok = true;
+  for( size_t i = 0, j; ok && i < n; i = j )
+    {
+    uint64_t length = 0;
+    for( j = i; j < n && (selected[j].key >> 16) == (selected[i].key >> 16); ++j )
+      length += selected[j].packet->length;
+    const packetid *id = &selected[i].packet->id;
+    const resolutiongeometry *rg = getresolutiongeometry( g, id->comp, id->res );
+    const uint64_t s = rg->firstprecinct - getresolutiongeometry( g, id->comp, 0 )->firstprecinct
+      + id->precinct;
+    const uint64_t I = tile + (id->comp + s * csindex.Csiz) * ntiles;
+    ok = putmessage( body, PRECINCT_BIN, I, j - i == csindex.NumberOfLayers, 0, length );
+    for( size_t k = i; ok && k < j; ++k )
+      ok = putfile( body, selected[k].packet->offset, selected[k].packet->length );
+    }
+  free( selected );
+  return ok;
+}
+
+/* return the HTTP status, `headers` get the JPIP response fields */
+static int respond( char *query, buffer *headers, buffer *body )
+{
+  viewwindow w;
+  memset( &w, 0, sizeof(w) );
+  w.layers = csindex.NumberOfLayers;
+  w.components = calloc( csindex.Csiz, sizeof(bool) );
+  if( !w.components ) return 500;
+  if( !parsequery( query, &w ) )
+    {
+    free( w.components );
+    return 400;
+    }
+  bool anycomponent = false;
+  for( uint16_t c = 0; c < csindex.Csiz; ++c )
+    anycomponent = anycomponent || w.components[c];
+
+  /* frame and window on the resolution grid, then on the reference grid */
+  const uint8_t d = getreduce( &w );
+  const uint64_t fx0 = ceildivpow2( csindex.XOsiz, d ), fx1 = ceildivpow2( csindex.Xsiz, d );
+  const uint64_t fy0 = ceildivpow2( csindex.YOsiz, d ), fy1 = ceildivpow2( csindex.Ysiz, d );
+  const uint64_t W = fx1 - fx0, H = fy1 - fy0;
+  const uint64_t ox = w.ox < W ? w.ox : W, oy = w.oy < H ? w.oy : H;
+  const uint64_t sx = w.hasrsiz && w.sx < W - ox ? w.sx : W - ox;
+  const uint64_t sy = w.hasrsiz && w.sy < H - oy ? w.sy : H - oy;
+
+  regionrequest request;
+  memset( &request, 0, sizeof(request) );
+  request.region.x0 = (fx0 + ox) << d;
+  request.region.y0 = (fy0 + oy) << d;
+  request.region.x1 = (fx0 + ox + sx) << d;
+  request.region.y1 = (fy0 + oy + sy) << d;
+  if( request.region.x1 > csindex.Xsiz ) request.region.x1 = csindex.Xsiz;
+  if( request.region.y1 > csindex.Ysiz ) request.region.y1 = csindex.Ysiz;
+  request.reduce = d;
+  request.layers = w.layers;
+  request.components = anycomponent ? w.components : NULL;
+
+  bool ok = putf( headers, "JPIP-fsiz: %" PRIu64 ",%" PRIu64 "\r\n", W, H )
+    && putf( headers, "JPIP-roff: %" PRIu64 ",%" PRIu64 "\r\n", ox, oy )
+    && putf( headers, "JPIP-rsiz: %" PRIu64 ",%" PRIu64 "\r\n", sx, sy )
+    && putf( headers, "JPIP-layers: %u\r\n", (unsigned int)w.layers );
+
+  const uint64_t start = csindex.socoffset;
+  ok = ok && putmessage( body, MAIN_HEADER_BIN, 0, true, 0, csindex.mainheaderend - start )
+    && putfile( body, start, csindex.mainheaderend - start );
+
+  /* B-7, tiles crossing the window */
+  if( ok && request.region.x0 < request.region.x1 && request.region.y0 < request.region.y1 )
+    {
+    const uint64_t ntx = (csindex.Xsiz - csindex.XTOsiz + csindex.XTsiz - 1) / csindex.XTsiz;
+    const uint64_t p0 = (request.region.x0 - csindex.XTOsiz) / csindex.XTsiz;
+    const uint64_t p1 = (request.region.x1 - 1 - csindex.XTOsiz) / csindex.XTsiz;
+    const uint64_t q0 = (request.region.y0 - csindex.YTOsiz) / csindex.YTsiz;
+    const uint64_t q1 = (request.region.y1 - 1 - csindex.YTOsiz) / csindex.YTsiz;
+    for( uint64_t q = q0; ok && q <= q1; ++q )
+      for( uint64_t p = p0; ok && p <= p1; ++p )
+        ok = puttile( body, (uint32_t)(q * ntx + p), &request );
+    }
+  const uint8_t eor[3] = { 0, EOR_WINDOW_DONE, 0 };
+  ok = ok && put( body, eor, sizeof(eor) );
+
+  free( w.components );
+  return ok ? 200 : 500;
+}
+
+typedef struct
+{
+  int fd;
+  char request[8192];
+  size_t length;
+  buffer response;
+  size_t sent;
+  bool closing;
+  bool draining; /* write side shut, reading until the client closes */
+  bool writing; /* registered for EPOLLOUT */
+} connection;
+
+static const char *getreason( int status )
+{
+  switch( status )
+    {
+  case 200: return "OK";
+  case 400: return "Bad Request";
+  case 405: return "Method Not Allowed";
+  case 431: return "Request Header Fields Too Large";
+  default:  return "Internal Server Error";
+    }
+}
+
+static bool puterror( connection *c, int status )
+{
+  const char *reason = getreason( status );
+  return putf( &c->response, "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\n"
+    "Content-Length: %zu\r\n%s\r\n%s\n", status, reason, strlen( reason ) + 1,
+    c->closing ? "Connection: close\r\n" : "", reason );
+}
+
+/* `request` is the NUL terminated request line and header fields */
+static bool handlerequest( connection *c, char *request )
+{
+  char *line = strstr( request, "\r\n" );
+  if( line ) *line = 0;
+  char *target = strchr( request, ' ' );
+  char *version = target ? strchr( target + 1, ' ' ) : NULL;
+  if( !version || strncmp( version + 1, "HTTP/1.", 7 ) != 0 )
+    {
+    c->closing = true;
+    return puterror( c, 400 );
+    }
+  *target++ = 0;
+  *version++ = 0;
+  c->closing = strcmp( version, "HTTP/1.0" ) == 0;
+  for( char *field = line ? line + 2 : NULL; field && *field; )
+    {
+    char *next = strstr( field, "\r\n" );
+    if( next ) *next = 0;
+    if( strncasecmp( field, "Connection:", 11 ) == 0 )
+      {
+      const char *value = field + 11;
+      while( *value == ' ' ) ++value;
+      if( strncasecmp( value, "close", 5 ) == 0 ) c->closing = true;
+      else if( strncasecmp( value, "keep-alive", 10 ) == 0 ) c->closing = false;
+      }
+    field = next ? next + 2 : NULL;
+    }
+  if( strcmp( request, "GET" ) != 0 )
+    return puterror( c, 405 );
+
+  char *query = strchr( target, '?' );
+  buffer headers, body;
+  memset( &headers, 0, sizeof(headers) );
+  memset( &body, 0, sizeof(body) );
+  const int status = respond( query ? query + 1 : target + strlen( target ), &headers, &body );
+  bool ok;
+  if( status == 200 )
+    ok = putf( &c->response, "HTTP/1.1 200 OK\r\nContent-Type: image/jpp-stream\r\n"
+      "Cache-Control: no-cache\r\nContent-Length: %zu\r\n%s", body.len,
+      c->closing ? "Connection: close\r\n" : "" )
+      && put( &c->response, headers.data, headers.len )
+      && put( &c->response, "\r\n", 2 )
+      && put( &c->response, body.data, body.len );
+  else
+    ok = puterror( c, status );
+  freebuffer( &headers );
+  freebuffer( &body );
+  return ok;
+}
+
+static void closeconnection( int ep, connection *c )
+{
+  epoll_ctl( ep, EPOLL_CTL_DEL, c->fd, NULL );
+  close( c->fd );
+  freebuffer( &c->response );
+  free( c );
+}
+
+/* return false once the connection is to be closed */
+static bool serve( int ep, connection *c, uint32_t events )
+{
+  if( c->draining )
+    {
+    for( ;; )
+      {
+      const ssize_t n = recv( c->fd, c->request, sizeof(c->request), 0 );
+      if( n == 0 ) return false;
+      if( n < 0 && errno != EINTR )
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+    }
+  if( events & EPOLLIN )
+    {
+    for( ;; )
+      {
+      if( c->length == sizeof(c->request) - 1 ) break;
+      const ssize_t n = recv( c->fd, c->request + c->length, sizeof(c->request) - 1 - c->length, 0 );
+      if( n > 0 ) c->length += (size_t)n;
+      else if( n == 0 ) return false;
+      else if( errno == EAGAIN || errno == EWOULDBLOCK ) break;
+      else if( errno != EINTR ) return false;
+      }
+    }
+  else if( events & (EPOLLERR | EPOLLHUP) )
+    return false;
+
+  /* one response at a time, pipelined requests wait in `request` */
+  for( ;; )
+    {
+    if( c->sent == c->response.len )
+      {
+      if( c->closing )
+        {
+        /* closing with unread request bytes would reset the connection and
+         * the client could lose the response: half-close and drain */
+        if( shutdown( c->fd, SHUT_WR ) != 0 ) return false;
+        c->draining = true;
+        break;
+        }
+      c->request[c->length] = 0;
+      char *end = strstr( c->request, "\r\n\r\n" );
+      c->response.len = c->sent = 0;
+      if( end )
+        {
+        *end = 0;
+        if( !handlerequest( c, c->request ) ) return false;
+        const size_t used = (size_t)(end + 4 - c->request);
+        memmove( c->request, end + 4, c->length - used );
+        c->length -= used;
+        }
+      else if( c->length == sizeof(c->request) - 1 )
+        {
+        c->closing = true;
+        if( !puterror( c, 431 ) ) return false;
+        }
+      else
+        break;
+      }
+    while( c->sent < c->response.len )
+      {
+      const ssize_t n = send( c->fd, c->response.data + c->sent, c->response.len - c->sent, MSG_NOSIGNAL );
+      if( n >= 0 ) c->sent += (size_t)n;
+      else if( errno == EAGAIN || errno == EWOULDBLOCK ) break;
+      else if( errno != EINTR ) return false;
+      }
+    if( c->sent < c->response.len ) break;
+    }
+
+  const bool pending = c->sent < c->response.len;
+  if( pending != c->writing )
+    {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (pending ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    if( epoll_ctl( ep, EPOLL_CTL_MOD, c->fd, &ev ) != 0 ) return false;
+    c->writing = pending;
+    }
+  return true;
+}
+
+static bool setnonblocking( int fd )
+{
+  const int flags = fcntl( fd, F_GETFL, 0 );
+  return flags >= 0 && fcntl( fd, F_SETFL, flags | O_NONBLOCK ) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long port = 8080;
+  long tiles = 64;
+  while( argc > 2 && argv[1][0] == '-' )
+    {
+    if( strcmp( argv[1], "-p" ) == 0 )
+      port = strtoul( argv[2], NULL, 10 );
+    else if( strcmp( argv[1], "-c" ) == 0 )
+      tiles = strtol( argv[2], NULL, 10 );
+    else
+      break;
+    argc -= 2;
+    argv += 2;
+    }
+  if( argc < 2 || port > 65535 || tiles < 1 || tiles > INT32_MAX )
+    {
+    fprintf( stderr, "usage: jpipserver [-p port] [-c tiles] input\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  if( !buildindex( filename, &csindex ) )
+    {
+    fprintf( stderr, "could not index: %s\n", filename );
+    return 1;
+    }
+  if( csindex.flags & (INDEX_PPM | INDEX_PPT) )
+    {
+    fprintf( stderr, "packed packet headers are not supported: %s\n", filename );
+    return 1;
+    }
+  in = fopen( filename, "rb" );
+  if( !in ) return 1;
+
+  const uint32_t ntiles = getnumberoftiles( &csindex );
+  maxcache = (int32_t)(tiles < (long)ntiles ? tiles : (long)ntiles);
+  cache = calloc( (size_t)maxcache, sizeof(tileentry) );
+  cached = malloc( (size_t)ntiles * sizeof(int32_t) );
+  if( !cache || !cached || !grouptileparts( &csindex, &firsttilepart, &tileparts ) ) return 1;
+  for( uint32_t t = 0; t < ntiles; ++t )
+    cached[t] = -1;
+
+  const int listener = socket( AF_INET, SOCK_STREAM, 0 );
+  const int yes = 1;
+  struct sockaddr_in addr;
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons( (uint16_t)port );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+  if( listener < 0
+    || setsockopt( listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes) ) != 0
+    || bind( listener, (struct sockaddr*)&addr, sizeof(addr) ) != 0
+    || listen( listener, SOMAXCONN ) != 0
+    || !setnonblocking( listener ) )
+    {
+    perror( "could not listen" );
+    return 1;
+    }
+  const int ep = epoll_create1( 0 );
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL; /* the listener */
+  if( ep < 0 || epoll_ctl( ep, EPOLL_CTL_ADD, listener, &ev ) != 0 )
+    {
+    perror( "epoll" );
+    return 1;
+    }
+  signal( SIGPIPE, SIG_IGN );
+  printf( "serving %s on http://127.0.0.1:%lu/\n", filename, port );
+  fflush( stdout );
+
+  struct epoll_event events[64];
+  for( ;; )
+    {
+    const int n = epoll_wait( ep, events, 64, -1 );
+    if( n < 0 )
+      {
+      if( errno == EINTR ) continue;
+      perror( "epoll_wait" );
+      break;
+      }
+    for( int i = 0; i < n; ++i )
+      {
+      connection *c = events[i].data.ptr;
+      if( c )
+        {
+        if( !serve( ep, c, events[i].events ) ) closeconnection( ep, c );
+        continue;
+        }
+      int fd;
+      while( (fd = accept( listener, NULL, NULL )) >= 0 )
+        {
+        c = calloc( 1, sizeof(connection) );
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if( !c || !setnonblocking( fd ) || epoll_ctl( ep, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+          {
+          free( c );
+          close( fd );
+          continue;
+          }
+        c->fd = fd;
+        }
+      }
+    }
+
+  close( ep );
+  close( listener );
+  for( int32_t i = 0; i < ncache; ++i )
+    freetileentry( cache + i );
+  free( cache );
+  free( cached );
+  free( firsttilepart );
+  free( tileparts );
+  fclose( in );
+  freeindex( &csindex );
+
+  return 1;
+}
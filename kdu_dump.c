@@ -32,8 +32,12 @@
 #include <inttypes.h>
 #include <byteswap.h>
 #include <string.h>
+#include <math.h>
 
 #include <simpleparser.h>
+#include <simpleoutput.h>
+#include <simplejson.h>
+#include <simplegeometry.h>
 
 FILE * fout;
 
@@ -156,175 +160,14 @@ static void printrgn( FILE *stream, size_t len )
   b = read8(stream, &sprgn); assert( b );
 }
 
-static void printpoc( FILE *stream, size_t len )
-{
-  char buffer[512];
-  size_t r = fread( buffer, sizeof(char), len, stream);
-
-  const uint8_t *p = (const uint8_t*)buffer;
-  const uint8_t *end = p + len;
-  int i = 0;
-  int number_progression_order_change = 0;
-  assert( len < 512 );
-  assert( r == len );
-  if( csiz < 257 )
-    {
-    number_progression_order_change = ( len )/ 7;
-    }
-  else
-    {
-    number_progression_order_change = ( len )/ 9;
-    }
-  for( ; i < number_progression_order_change; ++i )
-    {
-    uint8_t rspoc = *p++;
-    uint16_t cspoc;
-    uint16_t lyepoc;
-    uint16_t cepoc;
-    uint8_t repoc;
-    (void)rspoc;
-    if( csiz < 257 )
-      {
-      cspoc = *p++;
-      }
-    else
-      {
-      cread16((char*)p, &cspoc);
-      p += 2;
-      }
-    cread16((char*)p, &lyepoc);
-    p += 2;
-    repoc = *p++;
-    if( csiz < 257 )
-      {
-      cepoc = *p++;
-      }
-    else
-      {
-      cread16((char*)p, &cepoc);
-      p += 2;
-      }
-    p++;
-    }
-
-  assert( p == end );
-}
-
-static void printqcc( FILE *stream, size_t len )
-{
-  bool b;
-  uint16_t cqcc;
-  size_t i;
-  const char *s = "reserved";
-  uint8_t quant;
-  uint8_t nbits;
-  uint8_t sqcc;
-
-  if( csiz < 257 )
-    {
-    uint8_t cqcc8;
-    b = read8(stream, &cqcc8); assert( b );
-    --len;
-    cqcc = cqcc8;
-    }
-  else
-    {
-    b = read16(stream, &cqcc); assert( b );
-    --len;
-    --len;
-    }
-
-  b = read8(stream, &sqcc); assert( b );
-  --len;
-  quant = (sqcc & 0x1f);
-  nbits = (sqcc >> 5);
-  switch( quant )
-    {
-  case 0x0:
-    s = "none";
-    break;
-  case 0x1:
-    s = "scalar derived";
-    break;
-  case 0x2:
-    s = "scalar expounded";
-    break;
-    }
-
-  if( quant == 0x0 )
-    {
-    size_t n = len;
-    for( i = 0; i != n; ++i )
-      {
-      uint8_t val;
-      bool b = read8(stream, &val);
-      assert( b );
-      }
-    }
-  else
-    {
-    size_t n = len / 2;
-    for( i = 0; i != n; ++i )
-      {
-      uint16_t val;
-      b = read16(stream, &val); assert( b );
-      }
-    }
-
-}
-
 uint8_t quant  ;
 uint8_t nbits ;
-size_t abs_ranges;
-uint8_t *exps = NULL;
-static void printqcd( FILE *stream, size_t len )
+static void printqcd( const uint8_t *p, size_t len )
 {
-  bool b;
-  uint8_t sqcd;
-  size_t i;
-  const char *s = "reserved";
-
-  b = read8(stream, &sqcd); assert( b );
-  --len;
-  quant = (sqcd & 0x1f);
-  nbits = (sqcd >> 5);
-  switch( quant )
-    {
-  case 0x0:
-    s = "none";
-    break;
-  case 0x1:
-    s = "scalar derived";
-    break;
-  case 0x2:
-    s = "scalar expounded";
-    break;
-    }
-
-  if( quant == 0x0 )
-    {
-    size_t n = len;
-    abs_ranges = n;
-    exps = malloc( len * sizeof(char) );
-    for( i = 0; i != n; ++i )
-      {
-      uint8_t val;
-      bool b = read8(stream, &val);
-      const uint8_t exp = val >> 3;
-      assert( b );
-      exps[i] = exp;
-      }
-    }
-  else
-    {
-    size_t n = len / 2;
-    assert( len == n * 2 );
-    for( i = 0; i != n; ++i )
-      {
-      uint16_t val;
-      b = read16(stream, &val); assert( b );
-      }
-    }
+  assert( len >= 1 );
+  quant = (p[0] & 0x1f);
+  nbits = (p[0] >> 5);
+  assert( quant == 0x0 || (len - 1) % 2 == 0 );
 }
 
 static void printeph( FILE *stream, size_t len )
@@ -359,8 +202,12 @@ static void printsop( FILE *stream, size_t len )
   fseeko(stream, -1, SEEK_CUR);
 }
 
+static bool intileheader;
+static uint16_t currenttile;
+
 static void printsod( FILE *stream, size_t len )
 {
+  intileheader = false;
   fseeko(stream, (off_t)len, SEEK_CUR);
 }
 
@@ -377,6 +224,8 @@ static void printsot( FILE *stream, size_t len )
   b = read8(stream, &TPsot); assert( b );
   b = read8(stream, &TNsot); assert( b );
   ++ntiles;
+  intileheader = true;
+  currenttile = Isot;
   (void)len;
 }
 
@@ -407,14 +256,6 @@ static void printtlm( FILE *stream, size_t len )
 }
 
 
-static void printcoc( FILE *stream, size_t len )
-{
-  char buffer[512];
-  size_t r = fread( buffer, sizeof(char), len, stream);
-  assert( len < 512 );
-  assert( r == len );
-}
-
   uint8_t MultipleComponentTransformation;
   uint16_t NumberOfLayers  ;
   bool SOPMarkerSegments   ;
@@ -438,26 +279,15 @@ typedef enum
   SEGMARK = 0x20
 } modes;
 
-uint8_t *precintsize = NULL;
-
-static void printcod( FILE *stream, size_t len )
+static void printcod( const uint8_t *p, size_t len )
 {
-  union { uint16_t v; char bytes[2]; } u16;
-  char buffer[512];
-  size_t r = fread( buffer, sizeof(char), len, stream);
-
-/*  union { uint32_t v; char bytes[4]; } u32; */
-
 /* Table A.12 - Coding style default parameter values */
-  const uint8_t *p = (const uint8_t*)buffer;
   const uint8_t *end = p + len;
+  assert( len >= 10 );
   uint8_t Scod = *p++;
   uint8_t ProgressionOrder = *p++;
-  assert( len < 512 );
-  assert( r == len );
-  u16.bytes[0] = (char)*p++;
-  u16.bytes[1] = (char)*p++;
-  NumberOfLayers = bswap_16( u16.v );
+  NumberOfLayers = (uint16_t)((p[0] << 8) | p[1]);
+  p += 2;
   MultipleComponentTransformation = *p++;
   NumberOfDecompositionLevels = *p++;
 {
@@ -477,19 +307,12 @@ static void printcod( FILE *stream, size_t len )
   SOPMarkerSegments    = (Scod & 0x02) != 0;
   EPHMarkerSegments   = (Scod & 0x04) != 0;
 
+  /* Table A.21 - Precinct width and height, printed from the pool */
   if( VariablePrecinctSize )
-    {
-    uint_fast8_t i;
-    precintsize = malloc( (NumberOfDecompositionLevels + 1) * sizeof(char) );
-    for( i = 0; i <= NumberOfDecompositionLevels; ++i )
-      {
-      uint8_t val = *p++;
-      /* Table A.21 - Precinct width and height for the SPcod and SPcoc parameters */
-      precintsize[i] = val;
-      }
-    }
+    p += NumberOfDecompositionLevels + 1;
 
   assert( p == end );
+  (void)end;
 }
 
 /* I.5.1 JPEG 2000 Signature box */
@@ -819,26 +642,16 @@ static uint32_t xtsiz;
 static uint32_t ytsiz;
 static uint32_t xtosiz;
 static uint32_t ytosiz;
-static uint8_t *start = NULL;
 
-static void printsiz( FILE *stream, size_t len )
+static void printsiz( const uint8_t *buffer, size_t len )
 {
   uint16_t rsiz;
-  uint8_t ssiz;
-  uint8_t xrsiz;
-  uint8_t yrsiz;
   bool b = true;
   const char *s = "Reserved";
 
-  const char *p, *end;
-  char buffer[1024];
-  size_t r;
-  assert( len < 1024 );
-  r = fread( buffer, sizeof(char), len, stream);
-  assert( r == len );
-
-  p = buffer;
-  end = p + len;
+  const char *p = (const char*)buffer;
+  const char *end = p + len;
+  assert( len >= 38 );
 
   cread16(p, &rsiz); assert( b );
   p+=2;
@@ -875,19 +688,274 @@ static void printsiz( FILE *stream, size_t len )
     }
   sprofile = s;
 
-  start = malloc( (end - p) * sizeof(char) );
-  memcpy( start, p, end - p );
+  /* Ssiz, XRsiz, YRsiz of each component are printed from the pool */
+  p += 3 * csiz;
+  assert( p == end );
+  (void)end;
+}
+
+/*
+ * Coding style, quantization and progression segments that override the
+ * main header: COD/COC/QCD/QCC/POC of tile-part headers, and COC/QCC/POC of
+ * the main header itself. Only the segments found are kept (raw payload in
+ * one pool), memory follows the number of overrides, not tiles x components.
+ * The main header SIZ, COD and QCD go in the same pool, they hold the
+ * defaults.
+ */
+#define MAINHEADER    0xffff /* tile of a main header override */
+#define ALLCOMPONENTS 0xffff /* component of a COD/QCD/POC override */
+
+typedef struct
 {
-  uint_fast16_t i = 0;
-  for( i = 0; i < csiz; ++i )
+  uint16_t tile;
+  uint16_t component;
+  uint16_t marker;
+  uint16_t length;
+  size_t   payload; /* in overridepool */
+} override;
+
+static override *overrides = NULL;
+static size_t noverrides = 0;
+static size_t maxoverrides = 0;
+static uint8_t *overridepool = NULL;
+static size_t poolsize = 0;
+static size_t maxpoolsize = 0;
+
+static bool addoverride( uint_fast16_t marker, size_t len, FILE *stream )
+{
+  override *o;
+  const uint8_t *p;
+  if( noverrides == maxoverrides )
+    {
+    const size_t n = maxoverrides ? 2 * maxoverrides : 64;
+    override *q = realloc( overrides, n * sizeof(override) );
+    if( !q ) return false;
+    overrides = q;
+    maxoverrides = n;
+    }
+  if( poolsize + len > maxpoolsize )
     {
-    ssiz = *p++; /* int8_t ? */
-    xrsiz = *p++;
-    yrsiz = *p++; 
+    size_t n = maxpoolsize ? 2 * maxpoolsize : 4096;
+    while( n < poolsize + len ) n *= 2;
+    uint8_t *q = realloc( overridepool, n );
+    if( !q ) return false;
+    overridepool = q;
+    maxpoolsize = n;
     }
+  if( fread( overridepool + poolsize, 1, len, stream ) != len ) return false;
+  o = overrides + noverrides++;
+  o->tile = intileheader ? currenttile : MAINHEADER;
+  o->marker = (uint16_t)marker;
+  o->length = (uint16_t)len;
+  o->payload = poolsize;
+  o->component = ALLCOMPONENTS;
+  p = overridepool + poolsize;
+  if( (marker == COC || marker == QCC) && len >= 2 )
+    o->component = csiz < 257 ? p[0] : (uint16_t)((p[0] << 8) | p[1]);
+  poolsize += len;
+  return true;
 }
 
-  assert( p == end );
+/* main header overrides first, then by tile, file order within a tile */
+static int compareoverrides( const void *a, const void *b )
+{
+  const override *oa = a;
+  const override *ob = b;
+  const uint16_t ta = (uint16_t)(oa->tile + 1);
+  const uint16_t tb = (uint16_t)(ob->tile + 1);
+  if( ta != tb ) return ta < tb ? -1 : 1;
+  return oa->payload < ob->payload ? -1 : oa->payload > ob->payload;
+}
+
+/* payload of the main header SIZ, COD or QCD, NULL when missing */
+static const uint8_t *getmainsegment( uint16_t marker, size_t *len )
+{
+  for( size_t i = 0; i < noverrides; ++i )
+    if( overrides[i].tile == MAINHEADER && overrides[i].marker == marker )
+      {
+      *len = overrides[i].length;
+      return overridepool + overrides[i].payload;
+      }
+  *len = 0;
+  return NULL;
+}
+
+static void printmodes( const char *suffix, uint8_t style )
+{
+  fprintf(fout, "Cmodes%s=", suffix );
+  if( style )
+    {
+    int mask = 1;
+    while( style )
+      {
+      switch( style & mask )
+        {
+      case BYPASS:
+        fprintf(fout, "BYPASS" );
+        break;
+      case RESET:
+        fprintf(fout, "RESET" );
+        break;
+      case RESTART:
+        fprintf(fout, "RESTART" );
+        break;
+      case CAUSAL:
+        fprintf(fout, "CAUSAL" );
+        break;
+      case ERTERM:
+        fprintf(fout, "ERTERM" );
+        break;
+      case SEGMARK:
+        fprintf(fout, "SEGMARK" );
+        break;
+        }
+      if( style & ~mask )
+        if( style & mask )
+          fprintf(fout, "," );
+      style &= (uint8_t)~mask;
+      mask <<= 1;
+      }
+    }
+  else
+    {
+    fprintf(fout, "0" );
+    }
+  fprintf(fout, "\n" );
+}
+
+/* SPcod / SPcoc */
+static void printcodingstyleoverride( const char *suffix, const uint8_t *p, size_t len, bool precincts )
+{
+  uint_fast8_t i;
+  if( len < 5 ) return;
+  const uint8_t levels = p[0];
+  fprintf(fout, "Clevels%s=%u\n", suffix, levels );
+  fprintf(fout, "Creversible%s=%s\n", suffix, p[4] ? "yes" : "no" );
+  fprintf(fout, "Ckernels%s=%s\n", suffix, getDescriptionOfWaveletTransformationString( p[4] ) );
+  fprintf(fout, "Cuse_precincts%s=%s\n", suffix, precincts ? "yes" : "no" );
+  if( precincts && len >= 5u + levels + 1 )
+    {
+    /* from the highest resolution level down */
+    fprintf(fout, "Cprecincts%s=", suffix );
+    for( i = 0; i <= levels; ++i )
+      {
+      const uint8_t val = p[5 + levels - i];
+      if( i ) fprintf(fout, "," );
+      fprintf(fout, "{%u,%u}", 1u << (val >> 4), 1u << (val & 0x0f) );
+      }
+    fprintf(fout, "\n" );
+    }
+  fprintf(fout, "Cblk%s={%u,%u}\n", suffix, 1u << ((p[2] & 0xf) + 2), 1u << ((p[1] & 0xf) + 2) );
+  printmodes( suffix, p[3] );
+}
+
+/* Sqcd / Sqcc and step sizes */
+static void printquantizationoverride( const char *suffix, const uint8_t *p, size_t len )
+{
+  size_t i;
+  if( len < 1 ) return;
+  const uint8_t style = p[0] & 0x1f;
+  fprintf(fout, "Qguard%s=%u\n", suffix, p[0] >> 5 );
+  if( style == 0x0 )
+    {
+    fprintf(fout, "Qabs_ranges%s=", suffix );
+    for( i = 1; i < len; ++i )
+      {
+      if( i > 1 ) fprintf(fout, "," );
+      fprintf(fout, "%u", p[i] >> 3 );
+      }
+    fprintf(fout, "\n" );
+    }
+  else
+    {
+    if( style == 0x1 )
+      fprintf(fout, "Qderived%s=yes\n", suffix );
+    /* E.1.1.1: step relative to the nominal range, 2^-exponent (1 + mantissa / 2^11) */
+    fprintf(fout, "Qabs_steps%s=", suffix );
+    for( i = 1; i + 1 < len; i += 2 )
+      {
+      const uint16_t val = (uint16_t)((p[i] << 8) | p[i+1]);
+      if( i > 1 ) fprintf(fout, "," );
+      fprintf(fout, "%g", ldexp( 1. + (val & 0x7ff) / 2048., -(int)(val >> 11) ) );
+      }
+    fprintf(fout, "\n" );
+    }
+}
+
+static void printpocoverride( const char *suffix, const uint8_t *p, size_t len )
+{
+  const size_t n = csiz < 257 ? 7 : 9;
+  size_t i;
+  fprintf(fout, "Porder%s=", suffix );
+  for( i = 0; i + n <= len; i += n )
+    {
+    const uint8_t *q = p + i;
+    uint_fast16_t cspoc, cepoc, lyepoc;
+    uint8_t repoc, ppoc;
+    if( csiz < 257 )
+      {
+      cspoc = q[1];
+      lyepoc = (uint_fast16_t)((q[2] << 8) | q[3]);
+      repoc = q[4];
+      cepoc = q[5];
+      ppoc = q[6];
+      }
+    else
+      {
+      cspoc = (uint_fast16_t)((q[1] << 8) | q[2]);
+      lyepoc = (uint_fast16_t)((q[3] << 8) | q[4]);
+      repoc = q[5];
+      cepoc = (uint_fast16_t)((q[6] << 8) | q[7]);
+      ppoc = q[8];
+      }
+    if( i ) fprintf(fout, "," );
+    fprintf(fout, "{%u,%u,%u,%u,%u,%s}", q[0], (unsigned int)cspoc, (unsigned int)lyepoc,
+      repoc, (unsigned int)cepoc, getDescriptionOfProgressionOrderString( ppoc ) );
+    }
+  fprintf(fout, "\n" );
+}
+
+/* attributes are qualified the kakadu way: name:T<tile>C<component> */
+static void printoverride( const override *o )
+{
+  char suffix[32];
+  const uint8_t *p = overridepool + o->payload;
+  size_t len = o->length;
+  const size_t ncomp = csiz < 257 ? 1 : 2;
+  if( o->tile == MAINHEADER )
+    sprintf( suffix, ":C%u", o->component );
+  else if( o->component == ALLCOMPONENTS )
+    sprintf( suffix, ":T%u", o->tile );
+  else
+    sprintf( suffix, ":T%uC%u", o->tile, o->component );
+  switch( o->marker )
+    {
+  case COD:
+    if( o->tile == MAINHEADER || len < 10 ) break;
+    fprintf(fout, "Cycc%s=%s\n", suffix, p[4] ? "yes" : "no" );
+    fprintf(fout, "Cmct%s=%u\n", suffix, p[4] );
+    fprintf(fout, "Clayers%s=%u\n", suffix, (p[2] << 8) | p[3] );
+    fprintf(fout, "Cuse_sop%s=%s\n", suffix, p[0] & 0x02 ? "yes" : "no" );
+    fprintf(fout, "Cuse_eph%s=%s\n", suffix, p[0] & 0x04 ? "yes" : "no" );
+    fprintf(fout, "Corder%s=%s\n", suffix, getDescriptionOfProgressionOrderString( p[1] ) );
+    printcodingstyleoverride( suffix, p + 5, len - 5, p[0] & 0x01 );
+    break;
+  case COC:
+    if( len < ncomp + 1 ) break;
+    printcodingstyleoverride( suffix, p + ncomp + 1, len - ncomp - 1, p[ncomp] & 0x01 );
+    break;
+  case QCD:
+    if( o->tile == MAINHEADER ) break;
+    printquantizationoverride( suffix, p, len );
+    break;
+  case QCC:
+    if( len < ncomp ) break;
+    printquantizationoverride( suffix, p + ncomp, len - ncomp );
+    break;
+  case POC:
+    printpocoverride( o->tile == MAINHEADER ? "" : suffix, p, len );
+    break;
+    }
 }
 
 static bool print1( uint_fast16_t marker, size_t len, FILE *stream )
@@ -909,6 +977,20 @@ static bool print1( uint_fast16_t marker, size_t len, FILE *stream )
     ++init;
     }
   assert( offset >= 0 );
+  if( marker == COC || marker == QCC || marker == POC
+    || marker == SIZ || marker == COD || marker == QCD )
+    {
+    bool b = addoverride( marker, len, stream );
+    assert( b );
+    if( !intileheader )
+      {
+      const uint8_t *p = overridepool + overrides[noverrides - 1].payload;
+      if( marker == SIZ ) printsiz( p, len );
+      else if( marker == COD ) printcod( p, len );
+      else if( marker == QCD ) printqcd( p, len );
+      }
+    return false;
+    }
   switch( marker )
     {
   case EOC:
@@ -917,18 +999,6 @@ static bool print1( uint_fast16_t marker, size_t len, FILE *stream )
   case RGN:
     printrgn( stream, len );
     return false;
-  case POC:
-    printpoc( stream, len );
-    return false;
-  case QCC:
-    printqcc( stream, len );
-    return false;
-  case QCD:
-    printqcd( stream, len );
-    return false;
-  case SIZ:
-    printsiz( stream, len );
-    return false;
   case EPH:
     printeph( stream, len );
     return false;
@@ -947,12 +1017,6 @@ static bool print1( uint_fast16_t marker, size_t len, FILE *stream )
   case TLM:
     printtlm( stream, len );
     return false;
-  case COC:
-    printcoc( stream, len );
-    return false;
-  case COD:
-    printcod( stream, len );
-    return false;
     }
   return true;
 }
@@ -962,6 +1026,7 @@ int main(int argc, char *argv[])
   bool b;
   uint_fast16_t i;
   const char *filename;
+  const bool json = takejsonoption( &argc, &argv );
   if( argc < 2 ) return 1;
   filename = argv[1];
 
@@ -974,6 +1039,17 @@ int main(int argc, char *argv[])
     {
     fout = stdout;
     }
+  setoutputbuffer( fout );
+
+  if( json )
+    {
+    const bool ok = dumpjson( filename, fout );
+    if( argc > 2 )
+      {
+      fclose( fout );
+      }
+    return ok ? 0 : 1;
+    }
 
   ntiles = 0;
   if( isjp2file( filename ) )
@@ -985,6 +1061,12 @@ int main(int argc, char *argv[])
     b = parsej2k( filename, &print1 );
     }
 
+  size_t sizlen, codlen, qcdlen;
+  const uint8_t *siz = getmainsegment( SIZ, &sizlen );
+  const uint8_t *cod = getmainsegment( COD, &codlen );
+  const uint8_t *qcd = getmainsegment( QCD, &qcdlen );
+  const uint8_t *components = siz ? siz + 36 : NULL; /* Ssiz, XRsiz, YRsiz */
+
   fprintf(fout, "Sprofile=%s\n", sprofile);
   fprintf(fout, "Scap=no\n" );
   fprintf(fout, "Sextensions=0\n" );
@@ -996,7 +1078,7 @@ int main(int argc, char *argv[])
   fprintf(fout, "Ssigned=" );
   for( i = 0; i < csiz; ++i )
     {
-    uint8_t ssiz  = start[ i * 3 + 0 ];
+    uint8_t ssiz  = components[ i * 3 + 0 ];
     const bool sign = ssiz >> 7;
     if( i ) fprintf(fout, "," );
     fprintf(fout, "%s", sign ? "yes" : "no" );
@@ -1006,7 +1088,7 @@ int main(int argc, char *argv[])
   for( i = 0; i < csiz; ++i )
     {
   uint8_t ssiz;
-    ssiz  = start[ i * 3 + 0 ];
+    ssiz  = components[ i * 3 + 0 ];
     if( i ) fprintf(fout, "," );
     fprintf(fout, "%u", (ssiz & 0x7f) + 1 );
     }
@@ -1017,22 +1099,26 @@ int main(int argc, char *argv[])
   uint8_t xrsiz;
   uint8_t yrsiz;
 
-    xrsiz = start[ i * 3 + 1 ];
-    yrsiz = start[ i * 3 + 2 ]; 
+    xrsiz = components[ i * 3 + 1 ];
+    yrsiz = components[ i * 3 + 2 ]; 
     if( i ) fprintf(fout, "," );
     fprintf(fout, "{%u,%u}", yrsiz, xrsiz );
     }
   fprintf(fout, "\n" );
   fprintf(fout, "Sdims=" );
+  const rectangle image = { xosiz, yosiz, xsiz, ysiz };
   for( i = 0; i < csiz; ++i )
     {
   uint8_t xrsiz;
   uint8_t yrsiz;
+  rectangle comp;
 
-    xrsiz = start[ i * 3 + 1 ];
-    yrsiz = start[ i * 3 + 2 ]; 
+    xrsiz = components[ i * 3 + 1 ];
+    yrsiz = components[ i * 3 + 2 ]; 
     if( i ) fprintf(fout, "," );
-    fprintf(fout, "{%u,%u}", (int)((double)(ysiz - yosiz) / yrsiz + 0.5), (int)((double)(xsiz - xosiz ) / xrsiz + 0.5));
+    /* B-12 */
+    getcomponentrectangle( &image, xrsiz, yrsiz, &comp );
+    fprintf(fout, "{%" PRIu64 ",%" PRIu64 "}", comp.y1 - comp.y0, comp.x1 - comp.x0 );
     }
   fprintf(fout, "\n" );
   if( csiz == 3 )
@@ -1054,13 +1140,13 @@ int main(int argc, char *argv[])
   fprintf(fout, "Catk=0\n" );
   fprintf(fout, "Cuse_precincts=%s\n", VariablePrecinctSize ? "yes" : "no" );
 
-  if( precintsize )
+  if( cod && VariablePrecinctSize )
     {
     uint_fast8_t i;
     fprintf(fout, "Cprecincts=%s", VariablePrecinctSize ? "yes" : "no" );
     for( i = 0; i <= NumberOfDecompositionLevels; ++i )
       {
-      const uint8_t val = precintsize[NumberOfDecompositionLevels - i];
+      const uint8_t val = cod[10 + NumberOfDecompositionLevels - i];
       const uint8_t width = val & 0x0f;
       const uint8_t height = val >> 4;
       if( i ) fprintf(fout, "," );
@@ -1071,66 +1157,33 @@ int main(int argc, char *argv[])
 
   fprintf(fout, "Cblk={%u,%u}\n", 1 << ycb, 1 << xcb );
 
-  fprintf(fout, "Cmodes=" );
-  if(CodeBlockStyle)
-    {
-    int mask = 1;
-    while(CodeBlockStyle)
-      {
-      switch(CodeBlockStyle & mask)
-        {
-      case BYPASS:
-        fprintf(fout, "BYPASS" );
-        break;
-      case RESET:
-        fprintf(fout, "RESET" );
-        break;
-      case RESTART:
-        fprintf(fout, "RESTART" );
-        break;
-      case CAUSAL:
-        fprintf(fout, "CAUSAL" );
-        break;
-      case ERTERM:
-        fprintf(fout, "ERTERM" );
-        break;
-      case SEGMARK:
-        fprintf(fout, "SEGMARK" );
-        break;
-        }
-      if( CodeBlockStyle & ~mask )
-        if(CodeBlockStyle & mask)
-          fprintf(fout, "," );
-      CodeBlockStyle &= ~mask;
-      mask <<= 1;
-      }
-    }
-  else
-    {
-    fprintf(fout, "0" );
-    }
-  fprintf(fout, "\n" );
+  printmodes( "", CodeBlockStyle );
   fprintf(fout, "Qguard=%u\n", nbits );
   if( quant == 0x0 )
     {
-    size_t n = abs_ranges;
+    const size_t n = qcd ? qcdlen - 1 : 0;
     fprintf(fout, "Qabs_ranges=" );
     for( i = 0; i != n; ++i )
       {
       if( i ) fprintf(fout, "," );
-      fprintf(fout, "%u", exps[i] );
+      fprintf(fout, "%u", qcd[1 + i] >> 3 );
       }
     }
   fprintf(fout, "\n");
+  qsort( overrides, noverrides, sizeof(override), compareoverrides );
+  size_t o = 0;
+  for( ; o < noverrides && overrides[o].tile == MAINHEADER; ++o )
+    printoverride( overrides + o );
   for( i = 0; i < ntiles; ++i )
     {
     fprintf(fout, "\n");
     fprintf(fout, ">> New attributes for tile %u:\n", (unsigned int)i);
+    for( ; o < noverrides && overrides[o].tile == i; ++o )
+      printoverride( overrides + o );
     }
 
-  free(start);
-  free(exps);
-  free(precintsize);
+  free(overrides);
+  free(overridepool);
 
   if( argc > 2 )
     {
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Rewrite a codestream with packed packet headers in the main header (PPM)
+ * so that each tile-part carries its own packet headers in PPT segments.
+ * A tile-part can then be extracted, or decoded, from its own bytes without
+ * the main header PPM (which holds the headers of every tile-part).
+ *
+ * Packet headers and packets are moved, never decoded. TLM is regenerated
+ * when the input has one, Psot are recomputed (a Psot of 0 is made explicit).
+ *
+ * Usage: moveppm input.j2k output.j2k (or input.jp2 output.jp2)
+ */
+#include <simpleparser.h>
+#include <simplewriter.h>
+#include <simpleindex.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h> /* off_t */
+
+static const uint_fast16_t ppmtlm[] = { PPM, TLM, 0 };
+
+int main(int argc, char *argv[])
+{
+  if( argc < 3 )
+    {
+    fprintf( stderr, "usage: moveppm input output\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  const char *outfilename = argv[2];
+
+  codestreamindex index;
+  if( !buildindex( filename, &index ) )
+    {
+    fprintf( stderr, "could not index: %s\n", filename );
+    return 1;
+    }
+  if( !(index.flags & INDEX_PPM) )
+    {
+    fprintf( stderr, "no PPM in: %s\n", filename );
+    return 1;
+    }
+
+  FILE *in = fopen( filename, "rb" );
+  if( !in ) return 1;
+
+  /* new tile-part lengths: SOT .. end of data, plus the PPT segments */
+  uint16_t *Ttlm = malloc( (index.ntileparts + 1) * sizeof(uint16_t) );
+  uint32_t *Ptlm = malloc( (index.ntileparts + 1) * sizeof(uint32_t) );
+  if( !Ttlm || !Ptlm ) return 1;
+  uint64_t mainsize = 2;
+  if( !copysegments( in, index.socoffset + 2, index.mainheaderend, ppmtlm, NULL, &mainsize ) )
+    {
+    fprintf( stderr, "invalid main header\n" );
+    return 1;
+    }
+  uint64_t codestreamsize = mainsize + 2;
+  for( size_t i = 0; i < index.ntileparts; ++i )
+    {
+    const tilepartinfo *tp = index.tileparts + i;
+    const uint64_t ppt = writeppt( in, index.pphranges + tp->firstpph, tp->npph, NULL );
+    const uint64_t psot = tp->dataoffset + tp->datalength - tp->offset + ppt;
+    if( !ppt || psot > UINT32_MAX )
+      {
+      fprintf( stderr, "tile-part %zu is too large\n", i );
+      return 1;
+      }
+    Ttlm[i] = tp->Isot;
+    Ptlm[i] = (uint32_t)psot;
+    codestreamsize += psot;
+    }
+  const bool tlm = index.flags & INDEX_TLM;
+  if( tlm )
+    codestreamsize += writetlm( NULL, Ttlm, Ptlm, index.ntileparts );
+
+  FILE *out = fopen( outfilename, "wb" );
+  if( !out ) return 1;
+  bool ok = true;
+  if( index.isjp2 )
+    {
+    /* I.5.4 Contiguous Codestream box, everything else is kept as is */
+    ok = copyrange( in, 0, index.jp2cbegin, out )
+      && writejp2cheader( out, codestreamsize );
+    }
+  write_marker( out, SOC, 0 );
+  ok = ok && copysegments( in, index.socoffset + 2, index.mainheaderend, ppmtlm, out, &mainsize );
+  if( tlm )
+    writetlm( out, Ttlm, Ptlm, index.ntileparts );
+
+  for( size_t i = 0; i < index.ntileparts && ok; ++i )
+    {
+    const tilepartinfo *tp = index.tileparts + i;
+    uint64_t dummy = 0;
+    write_marker( out, SOT, 8 );
+    write16( out, tp->Isot );
+    write32( out, Ptlm[i] );
+    write8( out, tp->TPsot );
+    write8( out, tp->TNsot );
+    ok = copysegments( in, tp->offset + 12, tp->dataoffset - 2, NULL, out, &dummy )
+      && writeppt( in, index.pphranges + tp->firstpph, tp->npph, out );
+    write_marker( out, SOD, 0 );
+    ok = ok && copyrange( in, tp->dataoffset, tp->datalength, out );
+    }
+  write_marker( out, EOC, 0 );
+
+  if( ok && index.isjp2 )
+    {
+    const uint64_t filesize = getfilesize( filename );
+    ok = copyrange( in, index.jp2cend, filesize - index.jp2cend, out );
+    }
+  if( fclose( out ) != 0 ) ok = false;
+  fclose( in );
+  if( !ok )
+    {
+    fprintf( stderr, "could not write: %s\n", outfilename );
+    return 1;
+    }
+
+  free( Ptlm );
+  free( Ttlm );
+  freeindex( &index );
+
+  return 0;
+}
@@ -11,6 +11,8 @@
 #include <stdarg.h> /* va_list */
 
 #include <simpleparser.h>
+#include <simpleoutput.h>
+#include <simplejson.h>
 
 FILE * fout;
 /*
@@ -41,24 +43,22 @@ typedef struct {
   const char* longname;
 } dictentry2;
 
-static const dictentry2 dict2[] = {
-  { JP  , "jP"  , "Signature" },
-  { FTYP, "ftyp", "File_Type" },
-  { JP2H, "jp2h", "JP2_Header" },
-  { JP2C, "jp2c", "Contiguous_Codestream" },
-  { JP2 , "jp2" , "" },
-  { XML , "xml", "XML" },
-  { IHDR, "ihdr", "Image_Header" },
-  { COLR, "colr", "Colour_Specification" },
-  { CDEF, "cdef", "Channel_Definition" },
-  { CMAP, "cmap", "Component_Mapping" },
-  { PCLR, "pclr", "Palette" },
-  { RES , "res", "Resolution" },
-//  { IPTR, "iptr", "Unknown" }, /* FIXME */
-  { MDAT , "mdat", "Media Data" },
-  { MOOV , "moov", "Movie" },
-
-  { 0, 0, 0 }
+static const dictentry2 dict2[BOXSLOTS] = {
+  [BOXSLOT(JP)]   = { JP  , "jP"  , "Signature" },
+  [BOXSLOT(FTYP)] = { FTYP, "ftyp", "File_Type" },
+  [BOXSLOT(JP2H)] = { JP2H, "jp2h", "JP2_Header" },
+  [BOXSLOT(JP2C)] = { JP2C, "jp2c", "Contiguous_Codestream" },
+  [BOXSLOT(JP2)]  = { JP2 , "jp2" , "" },
+  [BOXSLOT(XML)]  = { XML , "xml", "XML" },
+  [BOXSLOT(IHDR)] = { IHDR, "ihdr", "Image_Header" },
+  [BOXSLOT(COLR)] = { COLR, "colr", "Colour_Specification" },
+  [BOXSLOT(CDEF)] = { CDEF, "cdef", "Channel_Definition" },
+  [BOXSLOT(CMAP)] = { CMAP, "cmap", "Component_Mapping" },
+  [BOXSLOT(PCLR)] = { PCLR, "pclr", "Palette" },
+  [BOXSLOT(RES)]  = { RES , "res", "Resolution" },
+//  [BOXSLOT(IPTR)] = { IPTR, "iptr", "Unknown" }, /* FIXME */
+  [BOXSLOT(MDAT)] = { MDAT , "mdat", "Media Data" },
+  [BOXSLOT(MOOV)] = { MOOV , "moov", "Movie" },
 };
 
 static void print0a()
@@ -69,57 +69,41 @@ static void print0a()
 
 static const dictentry2 * getdictentry2frommarker( uint_fast32_t marker )
 {
-  static const size_t n = sizeof( dict2 ) / sizeof( dictentry2 ) - 1; /* remove sentinel */
-  /* optimisation: binary search possible ? */
-  const dictentry2 * beg = dict2;
-  const dictentry2 * end = dict2 + n;
-  const dictentry2 * p = beg;
-  for( ; p != end; ++p )
-    {
-    if( p->marker == marker ) return p;
-    }
-  assert( end->marker == 0 );
-  return end;
+  static const dictentry2 unknown = { 0, 0, 0 };
+  const dictentry2 * p = dict2 + BOXSLOT( marker );
+  if( p->marker == marker && p->shortname ) return p;
+  return &unknown;
 }
 
-static const dictentry dict[] = {
-  { SOC, "Codestream", "Start_of_Codestream" },
-  { SOT, "SOT", "Start_of_Tile_Part" },
-  { SOD, "SOD", "Start_of_Data" },
-  { EOC, "EOC", "End of codestream" },
-  { SIZ, "SIZ", "Size" },
-  { COD, "COD", "Coding_Style_Default" },
-  { COC, "COC", "Coding_Style_Component" },
-  { RGN, "RGN", "Rgeion-of-interest" },
-  { QCD, "QCD", "Quantization_Default" },
-  { QCC, "QCC", "Quantization_Component" },
-  { POC, "POC", "Progression order change" },
-  { TLM, "TLM", "Tile_Lengths" },
-  { PLM, "PLM", "Packet length, main header" },
-  { PLT, "PLT", "Packet_Length_Tile" },
-  { PPM, "PPM", "Packet packer headers, main header" },
-  { PPT, "PPT", "Packet packer headers, tile-part header" },
-  { SOP, "SOP", "Start of packet" },
-  { EPH, "EPH", "End of packet header" },
-  { CRG, "CRG", "Component registration" },
-  { COM, "COM", "Comment" },
-
-  { 0, 0, 0 }
+static const dictentry dict[MARKERSLOTS] = {
+  [MARKERSLOT(SOC)] = { SOC, "Codestream", "Start_of_Codestream" },
+  [MARKERSLOT(SOT)] = { SOT, "SOT", "Start_of_Tile_Part" },
+  [MARKERSLOT(SOD)] = { SOD, "SOD", "Start_of_Data" },
+  [MARKERSLOT(EOC)] = { EOC, "EOC", "End of codestream" },
+  [MARKERSLOT(SIZ)] = { SIZ, "SIZ", "Size" },
+  [MARKERSLOT(COD)] = { COD, "COD", "Coding_Style_Default" },
+  [MARKERSLOT(COC)] = { COC, "COC", "Coding_Style_Component" },
+  [MARKERSLOT(RGN)] = { RGN, "RGN", "Rgeion-of-interest" },
+  [MARKERSLOT(QCD)] = { QCD, "QCD", "Quantization_Default" },
+  [MARKERSLOT(QCC)] = { QCC, "QCC", "Quantization_Component" },
+  [MARKERSLOT(POC)] = { POC, "POC", "Progression order change" },
+  [MARKERSLOT(TLM)] = { TLM, "TLM", "Tile_Lengths" },
+  [MARKERSLOT(PLM)] = { PLM, "PLM", "Packet length, main header" },
+  [MARKERSLOT(PLT)] = { PLT, "PLT", "Packet_Length_Tile" },
+  [MARKERSLOT(PPM)] = { PPM, "PPM", "Packet packer headers, main header" },
+  [MARKERSLOT(PPT)] = { PPT, "PPT", "Packet packer headers, tile-part header" },
+  [MARKERSLOT(SOP)] = { SOP, "SOP", "Start of packet" },
+  [MARKERSLOT(EPH)] = { EPH, "EPH", "End of packet header" },
+  [MARKERSLOT(CRG)] = { CRG, "CRG", "Component registration" },
+  [MARKERSLOT(COM)] = { COM, "COM", "Comment" },
 };
 
 static const dictentry * getdictentryfrommarker( uint_fast16_t marker )
 {
-  static const size_t n = sizeof( dict ) / sizeof( dictentry ) - 1; /* remove sentinel */
-  /* optimisation: binary search possible ? */
-  const dictentry * beg = dict;
-  const dictentry * end = dict + n;
-  const dictentry * p = beg;
-  for( ; p != end; ++p )
-    {
-    if( p->marker == marker ) return p;
-    }
-  assert( end->marker == 0 );
-  return end;
+  static const dictentry unknown = { 0, 0, 0 };
+  const dictentry * p = dict + MARKERSLOT( marker );
+  if( p->marker == marker && p->shortname ) return p;
+  return &unknown;
 }
 
 static bool read8(FILE *input, uint8_t * ret)
@@ -748,13 +732,20 @@ static void printsot( FILE *stream, size_t len )
   b = read32(stream, &Psot); assert( b );
   b = read8(stream, &TPsot); assert( b );
   b = read8(stream, &TNsot); assert( b );
-  fprintf(fout,"\t\t\t\tTile_Index = %u\n", Isot );
-  fprintf(fout,"\t\t\t\tTile_Part_Length = %u <bytes>\n", Psot );
-  fprintf(fout,"\t\t\t\tTile_Part_Index = %u\n", TPsot );
+  printstr( fout, "\t\t\t\tTile_Index = " );
+  printdec( fout, Isot, 0 );
+  printstr( fout, "\n\t\t\t\tTile_Part_Length = " );
+  printdec( fout, Psot, 0 );
+  printstr( fout, " <bytes>\n\t\t\t\tTile_Part_Index = " );
+  printdec( fout, TPsot, 0 );
   if( TNsot || printtiles )
-    fprintf(fout,"\t\t\t\tTotal_Tile_Parts = %u\n", TNsot );
+    {
+    printstr( fout, "\n\t\t\t\tTotal_Tile_Parts = " );
+    printdec( fout, TNsot, 0 );
+    printstr( fout, "\n" );
+    }
   else
-    fprintf(fout,"\t\t\t\tTotal_Tile_Parts  unknown\n" );
+    printstr( fout, "\n\t\t\t\tTotal_Tile_Parts  unknown\n" );
 }
 
 static void printsize( FILE *stream, size_t len )
@@ -934,9 +925,13 @@ static bool print1( uint_fast16_t marker, size_t len, FILE *stream )
     buffer[4] = 0;
     printstring( "\t\t\tGROUP = ", buffer );
     }
-	fprintf(fout,"\t\t\t\tMarker = 16#%X#\n", (uint16_t)marker );
-	fprintf(fout,"\t\t\t\t^Position = %td <byte offset>\n", offset );
-	fprintf(fout,"\t\t\t\tLength = %zd <bytes>\n", len );
+  printstr( fout, "\t\t\t\tMarker = 16#" );
+  printhex( fout, (uint16_t)marker, 0, true );
+  printstr( fout, "#\n\t\t\t\t^Position = " );
+  printdec( fout, (uintmax_t)offset, 0 );
+  printstr( fout, " <byte offset>\n\t\t\t\tLength = " );
+  printdec( fout, len, 0 );
+  printstr( fout, " <bytes>\n" );
   bool skip = false;
   switch( marker )
     {
@@ -971,6 +966,7 @@ static bool print1( uint_fast16_t marker, size_t len, FILE *stream )
 
 int main(int argc, char *argv[])
 {
+  const bool json = takejsonoption( &argc, &argv );
   if( argc < 2 ) return 1;
   const char *filename = argv[1];
 
@@ -983,6 +979,17 @@ int main(int argc, char *argv[])
     {
     fout = stdout;
     }
+  setoutputbuffer( fout );
+
+  if( json )
+    {
+    const bool ok = dumpjson( filename, fout );
+    if( argc > 2 )
+      {
+      fclose( fout );
+      }
+    return ok ? 0 : 1;
+    }
 
   if( argc == 4 )
     {
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Print the byte ranges of a J2K/JP2 file needed to decode a region of the
+ * image, one "offset length" pair per line, sorted and coalesced. A server
+ * can fetch just those bytes, the other packets being left out (or replaced
+ * by empty packets) when the codestream is put back together.
+ *
+ * The region is given on the reference grid: x0 y0 x1 y1, x1 and y1
+ * excluded.
+ *   -r reduce     discard the `reduce` highest resolution levels
+ *   -l layers     keep the first `layers` quality layers
+ *   -c c0,c1,...  keep these components only
+ *
+ * Usage: regionranges [-r reduce] [-l layers] [-c components] input x0 y0 x1 y1
+ */
+#include <simpleindex.h>
+#include <simpleregion.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+int main(int argc, char *argv[])
+{
+  regionrequest request;
+  const char *components = NULL;
+  memset( &request, 0, sizeof(request) );
+  while( argc > 2 && argv[1][0] == '-' )
+    {
+    if( strcmp( argv[1], "-r" ) == 0 )
+      request.reduce = (uint8_t)atoi( argv[2] );
+    else if( strcmp( argv[1], "-l" ) == 0 )
+      request.layers = (uint16_t)atoi( argv[2] );
+    else if( strcmp( argv[1], "-c" ) == 0 )
+      components = argv[2];
+    else
+      break;
+    argc -= 2;
+    argv += 2;
+    }
+  if( argc < 6 )
+    {
+    fprintf( stderr, "usage: regionranges [-r reduce] [-l layers] [-c components] input x0 y0 x1 y1\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  request.region.x0 = strtoull( argv[2], NULL, 10 );
+  request.region.y0 = strtoull( argv[3], NULL, 10 );
+  request.region.x1 = strtoull( argv[4], NULL, 10 );
+  request.region.y1 = strtoull( argv[5], NULL, 10 );
+
+  codestreamindex index;
+  if( !buildindex( filename, &index ) )
+    {
+    fprintf( stderr, "could not index: %s\n", filename );
+    return 1;
+    }
+  bool *selected = NULL;
+  if( components )
+    {
+    selected = calloc( index.Csiz, sizeof(bool) );
+    if( !selected ) return 1;
+    const char *s = components;
+    for( ;; )
+      {
+      char *end;
+      const unsigned long c = strtoul( s, &end, 10 );
+      if( end == s || c >= index.Csiz )
+        {
+        fprintf( stderr, "invalid component list: %s\n", components );
+        return 1;
+        }
+      selected[c] = true;
+      if( *end != ',' ) break;
+      s = end + 1;
+      }
+    request.components = selected;
+    }
+
+  FILE *in = fopen( filename, "rb" );
+  if( !in ) return 1;
+  byterangelist ranges;
+  memset( &ranges, 0, sizeof(ranges) );
+  if( !planregion( in, &index, &request, &ranges ) )
+    {
+    fprintf( stderr, "could not find the packets of: %s\n", filename );
+    return 1;
+    }
+  for( size_t i = 0; i < ranges.nranges; ++i )
+    printf( "%" PRIu64 " %" PRIu64 "\n", ranges.ranges[i].offset, ranges.ranges[i].length );
+
+  fclose( in );
+  freebyterangelist( &ranges );
+  free( selected );
+  freeindex( &index );
+
+  return 0;
+}
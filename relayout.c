@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Rewrite a codestream so that tiles are split into one tile-part per
+ * resolution level, and tile-parts are ordered resolution-major across tiles:
+ * first the resolution 0 tile-part of every tile, then resolution 1, ...
+ * A low resolution view of the whole image is then a prefix of the file.
+ *
+ * Packets are moved, never decoded: packet boundaries are taken from PLT. The
+ * relative order of the packets of a given precinct (its layers) is kept,
+ * which means LRCP input is turned into RLCP, while RLCP and RPCL are already
+ * resolution-major. TLM and PLT are regenerated, SOP Nsop are renumbered.
+ *
+ * Usage: relayout input.j2k output.j2k (or input.jp2 output.jp2)
+ */
+#include <simpleparser.h>
+#include <simplewriter.h>
+#include <simpleindex.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <byteswap.h>
+#include <sys/types.h> /* off_t */
+
+typedef struct
+{
+  uint64_t offset; /* absolute position in the input */
+  uint32_t length;
+  uint8_t  res;
+} packetinfo;
+
+/* one output tile-part, Isot and Psot are kept aside for writetlm */
+typedef struct
+{
+  uint8_t res;
+  uint8_t TPsot;
+} outtilepart;
+
+static const uint_fast16_t pltonly[] = { PLT, 0 };
+
+static uint8_t getnumberofresolutions( const codestreamindex *index )
+{
+  uint8_t nres = 0;
+  for( uint16_t c = 0; c < index->Csiz; ++c )
+    {
+    const uint8_t n = index->components[c].cs.NumberOfDecompositionLevels + 1;
+    if( n > nres ) nres = n;
+    }
+  return nres;
+}
+
+static bool checkindex( const codestreamindex *index )
+{
+  if( index->flags & (INDEX_PPM | INDEX_PPT) )
+    {
+    fprintf( stderr, "PPM/PPT are not supported\n" );
+    return false;
+    }
+  if( index->flags & (INDEX_POC | INDEX_TILECOD) )
+    {
+    fprintf( stderr, "POC and tile-part COD/COC are not supported\n" );
+    return false;
+    }
+  if( !(index->flags & INDEX_PLT) )
+    {
+    fprintf( stderr, "no PLT, packet boundaries are unknown\n" );
+    return false;
+    }
+  /* Table A.16 */
+  if( index->ProgressionOrder > 2 )
+    {
+    fprintf( stderr, "only LRCP, RLCP and RPCL are supported\n" );
+    return false;
+    }
+  return true;
+}
+
+/* B.12 Progression order: give its resolution level to each packet of tile */
+static bool assignresolutions( const codestreamindex *index, uint32_t tile, packetinfo *packets, size_t npackets )
+{
+  const uint8_t nres = getnumberofresolutions( index );
+  const uint16_t L = index->NumberOfLayers;
+  uint64_t *nprec = calloc( (size_t)index->Csiz * nres, sizeof(uint64_t) );
+  if( !nprec ) return false;
+  for( uint16_t c = 0; c < index->Csiz; ++c )
+    for( uint8_t r = 0; r < nres; ++r )
+      nprec[c * nres + r] = getnumberofprecincts( index, tile, c, r );
+
+  size_t i = 0;
+  bool ok = true;
+  if( index->ProgressionOrder == 0 ) /* LRCP */
+    {
+    for( uint16_t l = 0; l < L && ok; ++l )
+      for( uint8_t r = 0; r < nres && ok; ++r )
+        for( uint16_t c = 0; c < index->Csiz && ok; ++c )
+          for( uint64_t k = 0; k < nprec[c * nres + r]; ++k )
+            {
+            if( i == npackets ) { ok = false; break; }
+            packets[i++].res = r;
+            }
+    }
+  else /* RLCP, RPCL */
+    {
+    for( uint8_t r = 0; r < nres && ok; ++r )
+      {
+      uint64_t n = 0;
+      for( uint16_t c = 0; c < index->Csiz; ++c )
+        n += nprec[c * nres + r] * L;
+      for( uint64_t k = 0; k < n; ++k )
+        {
+        if( i == npackets ) { ok = false; break; }
+        packets[i++].res = r;
+        }
+      }
+    }
+  free( nprec );
+  return ok && i == npackets;
+}
+
+/*
+ * Copy the segments of the main header from SOC up to the first SOT, drop
+ * TLM/PLM and switch LRCP to RLCP in COD.
+ * When `out` is NULL only compute the number of bytes
+ */
+static bool writemainheader( FILE *in, const codestreamindex *index, FILE *out, uint64_t *size )
+{
+  const uint64_t len = index->mainheaderend - index->socoffset;
+  uint8_t *buffer = malloc( len );
+  if( !buffer ) return false;
+  bool ok = fseeko( in, (off_t)index->socoffset, SEEK_SET ) == 0
+    && fread( buffer, 1, len, in ) == len;
+  uint64_t pos = 2; /* SOC */
+  *size = 2;
+  if( ok && out ) ok = fwrite( buffer, 1, 2, out ) == 2;
+  while( ok && pos + 4 <= len )
+    {
+    uint16_t marker, l;
+    memcpy( &marker, buffer + pos, 2 );
+    memcpy( &l, buffer + pos + 2, 2 );
+    marker = bswap_16( marker );
+    l = bswap_16( l );
+    if( l < 2 || pos + 2 + l > len )
+      {
+      ok = false;
+      break;
+      }
+    if( marker != TLM && marker != PLM )
+      {
+      if( marker == COD && index->ProgressionOrder == 0 )
+        {
+        assert( l >= 5 );
+        buffer[pos + 5] = 1; /* RLCP */
+        }
+      *size += 2 + l;
+      if( out ) ok = fwrite( buffer + pos, 1, 2 + (size_t)l, out ) == 2 + (size_t)l;
+      }
+    pos += 2 + l;
+    }
+  free( buffer );
+  return ok && pos == len;
+}
+
+/*
+ * Copy packets, renumbering SOP when present (A.8.1: Nsop counts the packets
+ * of the tile in codestream order). Adjacent input ranges are copied at once.
+ */
+static bool writepackets( FILE *in, const packetinfo *packets, size_t npackets,
+  bool sop, uint16_t *nsop, FILE *out )
+{
+  size_t i = 0;
+  while( i < npackets )
+    {
+    if( sop && packets[i].length >= 6 )
+      {
+      uint8_t b[6];
+      if( fseeko( in, (off_t)packets[i].offset, SEEK_SET ) != 0 ) return false;
+      if( fread( b, 1, 6, in ) != 6 ) return false;
+      if( b[0] == 0xff && b[1] == 0x91 && b[2] == 0 && b[3] == 4 )
+        {
+        b[4] = (uint8_t)(*nsop >> 8);
+        b[5] = (uint8_t)*nsop;
+        if( fwrite( b, 1, 6, out ) != 6 ) return false;
+        if( !copyrange( in, packets[i].offset + 6, packets[i].length - 6, out ) )
+          return false;
+        ++*nsop;
+        ++i;
+        continue;
+        }
+      }
+    size_t j = i + 1;
+    uint64_t end = packets[i].offset + packets[i].length;
+    if( !sop )
+      while( j < npackets && packets[j].offset == end )
+        end += packets[j++].length;
+    if( !copyrange( in, packets[i].offset, end - packets[i].offset, out ) )
+      return false;
+    *nsop = (uint16_t)(*nsop + (j - i));
+    i = j;
+    }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  if( argc < 3 )
+    {
+    fprintf( stderr, "usage: relayout input output\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  const char *outfilename = argv[2];
+
+  codestreamindex index;
+  if( !buildindex( filename, &index ) )
+    {
+    fprintf( stderr, "could not index: %s\n", filename );
+    return 1;
+    }
+  if( !checkindex( &index ) ) return 1;
+
+  const uint32_t ntiles = getnumberoftiles( &index );
+  const uint8_t nres = getnumberofresolutions( &index );
+  const size_t npackets = index.npacketlengths;
+
+  /* packets of tile t are packets[ first[t] ... first[t+1] ) */
+  size_t *first = calloc( ntiles + 1, sizeof(size_t) );
+  size_t *cursor = calloc( ntiles, sizeof(size_t) );
+  packetinfo *packets = malloc( (npackets + 1) * sizeof(packetinfo) );
+  packetinfo *sorted = malloc( (npackets + 1) * sizeof(packetinfo) );
+  uint32_t *sortedlengths = malloc( (npackets + 1) * sizeof(uint32_t) );
+  size_t *resstart = malloc( (size_t)ntiles * (nres + 1) * sizeof(size_t) );
+  uint64_t *headersize = calloc( ntiles, sizeof(uint64_t) );
+  size_t *ntps = calloc( ntiles, sizeof(size_t) );
+  /* input tile-parts of tile t are tplist[ tpfirst[t] ... tpfirst[t+1] ) */
+  size_t *tpfirst = calloc( ntiles + 1, sizeof(size_t) );
+  size_t *tplist = malloc( (index.ntileparts + 1) * sizeof(size_t) );
+  if( !first || !cursor || !packets || !sorted || !sortedlengths || !resstart || !headersize || !ntps
+    || !tpfirst || !tplist )
+    return 1;
+
+  FILE *in = fopen( filename, "rb" );
+  if( !in ) return 1;
+
+  for( size_t i = 0; i < index.ntileparts; ++i )
+    {
+    const tilepartinfo *tp = index.tileparts + i;
+    first[ tp->Isot + 1 ] += tp->npackets;
+    ++tpfirst[ tp->Isot + 1 ];
+    if( !copysegments( in, tp->offset + 12, tp->dataoffset - 2, pltonly, NULL, headersize + tp->Isot ) )
+      {
+      fprintf( stderr, "invalid tile-part header at %llu\n", (unsigned long long)tp->offset );
+      return 1;
+      }
+    }
+  for( uint32_t t = 0; t < ntiles; ++t )
+    {
+    first[t + 1] += first[t];
+    cursor[t] = first[t];
+    tpfirst[t + 1] += tpfirst[t];
+    }
+  for( size_t i = 0; i < index.ntileparts; ++i )
+    tplist[ tpfirst[ index.tileparts[i].Isot ] + (ntps[ index.tileparts[i].Isot ]++) ] = i;
+  memset( ntps, 0, ntiles * sizeof(size_t) );
+  for( size_t i = 0; i < index.ntileparts; ++i )
+    {
+    const tilepartinfo *tp = index.tileparts + i;
+    uint64_t pos = tp->dataoffset;
+    for( size_t k = 0; k < tp->npackets; ++k )
+      {
+      packetinfo *p = packets + cursor[ tp->Isot ]++;
+      p->offset = pos;
+      p->length = index.packetlengths[ tp->firstpacket + k ];
+      pos += p->length;
+      }
+    if( pos != tp->dataoffset + tp->datalength )
+      {
+      fprintf( stderr, "PLT does not match tile-part length at %llu\n", (unsigned long long)tp->offset );
+      return 1;
+      }
+    }
+
+  /* stable partition of the packets of each tile by resolution level */
+  for( uint32_t t = 0; t < ntiles; ++t )
+    {
+    const size_t n = first[t + 1] - first[t];
+    if( n != getnumberofpackets( &index, t )
+      || !assignresolutions( &index, t, packets + first[t], n ) )
+      {
+      fprintf( stderr, "unexpected number of packets in tile %u\n", t );
+      return 1;
+      }
+    size_t *start = resstart + (size_t)t * (nres + 1);
+    memset( start, 0, (nres + 1) * sizeof(size_t) );
+    for( size_t k = first[t]; k < first[t + 1]; ++k )
+      ++start[ packets[k].res + 1 ];
+    start[0] = first[t];
+    for( uint8_t r = 0; r < nres; ++r )
+      start[r + 1] += start[r];
+    for( size_t k = first[t]; k < first[t + 1]; ++k )
+      {
+      sortedlengths[ start[ packets[k].res ] ] = packets[k].length;
+      sorted[ start[ packets[k].res ]++ ] = packets[k];
+      }
+    /* restore start of each resolution level */
+    for( uint8_t r = nres; r > 0; --r )
+      start[r] = start[r - 1];
+    start[0] = first[t];
+    }
+
+  /* list output tile-parts, an empty tile still gets one tile-part */
+  const size_t maxtps = (size_t)ntiles * nres + 1;
+  outtilepart *tps = malloc( maxtps * sizeof(outtilepart) );
+  uint16_t *Ttlm = malloc( maxtps * sizeof(uint16_t) );
+  uint32_t *Ptlm = malloc( maxtps * sizeof(uint32_t) );
+  if( !tps || !Ttlm || !Ptlm ) return 1;
+  size_t ntp = 0;
+  for( uint8_t r = 0; r < nres; ++r )
+    for( uint32_t t = 0; t < ntiles; ++t )
+      {
+      const size_t *start = resstart + (size_t)t * (nres + 1);
+      const bool empty = first[t] == first[t + 1];
+      if( start[r] == start[r + 1] && !(empty && r == 0) ) continue;
+      outtilepart *otp = tps + ntp;
+      otp->res = r;
+      otp->TPsot = (uint8_t)ntps[t];
+      const uint64_t plt = writeplt( NULL, sortedlengths + start[r], start[r + 1] - start[r] );
+      uint64_t psot = 12 + 2 + (ntps[t] ? 0 : headersize[t]) + plt;
+      for( size_t k = start[r]; k < start[r + 1]; ++k )
+        psot += sorted[k].length;
+      if( psot > UINT32_MAX || ntps[t] == 255 || (start[r + 1] > start[r] && !plt) )
+        {
+        fprintf( stderr, "tile %u cannot be split\n", t );
+        return 1;
+        }
+      Ttlm[ntp] = (uint16_t)t;
+      Ptlm[ntp] = (uint32_t)psot;
+      ++ntp;
+      ++ntps[t];
+      }
+
+  uint64_t mainsize;
+  if( !writemainheader( in, &index, NULL, &mainsize ) )
+    {
+    fprintf( stderr, "invalid main header\n" );
+    return 1;
+    }
+  const uint64_t tlmsize = writetlm( NULL, Ttlm, Ptlm, ntp );
+  if( !tlmsize )
+    {
+    fprintf( stderr, "too many tile-parts for TLM\n" );
+    return 1;
+    }
+  uint64_t codestreamsize = mainsize + tlmsize + 2;
+  for( size_t i = 0; i < ntp; ++i )
+    codestreamsize += Ptlm[i];
+
+  FILE *out = fopen( outfilename, "wb" );
+  if( !out ) return 1;
+  bool ok = true;
+  if( index.isjp2 )
+    {
+    /* I.5.4 Contiguous Codestream box, everything else is kept as is */
+    ok = copyrange( in, 0, index.jp2cbegin, out )
+      && writejp2cheader( out, codestreamsize );
+    }
+  ok = ok && writemainheader( in, &index, out, &mainsize )
+    && writetlm( out, Ttlm, Ptlm, ntp );
+
+  const bool sop = index.Scod & 0x2;
+  uint16_t *nsop = calloc( ntiles, sizeof(uint16_t) );
+  if( !nsop ) return 1;
+  for( size_t i = 0; i < ntp && ok; ++i )
+    {
+    const outtilepart *otp = tps + i;
+    const uint32_t t = Ttlm[i];
+    const size_t *start = resstart + (size_t)t * (nres + 1);
+    const size_t n = start[otp->res + 1] - start[otp->res];
+    write_marker( out, SOT, 8 );
+    write16( out, Ttlm[i] );
+    write32( out, Ptlm[i] );
+    write8( out, otp->TPsot );
+    write8( out, (uint8_t)ntps[t] );
+    if( otp->TPsot == 0 )
+      {
+      uint64_t dummy = 0;
+      for( size_t k = tpfirst[t]; k < tpfirst[t + 1] && ok; ++k )
+        {
+        const tilepartinfo *tp = index.tileparts + tplist[k];
+        ok = copysegments( in, tp->offset + 12, tp->dataoffset - 2, pltonly, out, &dummy );
+        }
+      }
+    ok = ok && (!n || writeplt( out, sortedlengths + start[otp->res], n ));
+    write_marker( out, SOD, 0 );
+    ok = ok && writepackets( in, sorted + start[otp->res], n, sop, nsop + t, out );
+    }
+  write_marker( out, EOC, 0 );
+
+  if( ok && index.isjp2 )
+    {
+    const uint64_t filesize = getfilesize( filename );
+    ok = copyrange( in, index.jp2cend, filesize - index.jp2cend, out );
+    }
+  if( fclose( out ) != 0 ) ok = false;
+  fclose( in );
+  if( !ok )
+    {
+    fprintf( stderr, "could not write: %s\n", outfilename );
+    return 1;
+    }
+
+  free( nsop );
+  free( tplist );
+  free( tpfirst );
+  free( Ptlm );
+  free( Ttlm );
+  free( tps );
+  free( ntps );
+  free( headersize );
+  free( resstart );
+  free( sortedlengths );
+  free( sorted );
+  free( packets );
+  free( cursor );
+  free( first );
+  freeindex( &index );
+
+  return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simplegeometry.h"
+
+#include <string.h>
+#include <assert.h>
+
+static uint64_t ceildiv( uint64_t a, uint64_t b )
+{
+  return (a + b - 1) / b;
+}
+
+static uint64_t ceildivpow2( uint64_t a, unsigned int e )
+{
+  return (a + ((uint64_t)1 << e) - 1) >> e;
+}
+
+/* B-15 numerator can be negative, the result never is */
+static uint64_t bandcoordinate( uint64_t tc, unsigned int offset, unsigned int nb )
+{
+  const uint64_t o = offset ? (uint64_t)1 << (nb - 1) : 0;
+  return tc >= o ? ceildivpow2( tc - o, nb ) : 0;
+}
+
+static void intersect( rectangle *r, const rectangle *clip )
+{
+  if( r->x0 < clip->x0 ) r->x0 = clip->x0;
+  if( r->y0 < clip->y0 ) r->y0 = clip->y0;
+  if( r->x1 > clip->x1 ) r->x1 = clip->x1;
+  if( r->y1 > clip->y1 ) r->y1 = clip->y1;
+  if( r->x0 >= r->x1 || r->y0 >= r->y1 )
+    r->x1 = r->x0, r->y1 = r->y0;
+}
+
+bool gettilerectangle( const codestreamindex *index, uint32_t tile, rectangle *r )
+{
+  if( tile >= getnumberoftiles( index ) ) return false;
+  const uint64_t ntx = ceildiv( index->Xsiz - index->XTOsiz, index->XTsiz );
+  const uint64_t p = tile % ntx;
+  const uint64_t q = tile / ntx;
+  r->x0 = index->XTOsiz + p * index->XTsiz;
+  r->y0 = index->YTOsiz + q * index->YTsiz;
+  r->x1 = r->x0 + index->XTsiz;
+  r->y1 = r->y0 + index->YTsiz;
+  if( r->x0 < index->XOsiz ) r->x0 = index->XOsiz;
+  if( r->y0 < index->YOsiz ) r->y0 = index->YOsiz;
+  if( r->x1 > index->Xsiz ) r->x1 = index->Xsiz;
+  if( r->y1 > index->Ysiz ) r->y1 = index->Ysiz;
+  return true;
+}
+
+void getcomponentrectangle( const rectangle *r, uint8_t XRsiz, uint8_t YRsiz, rectangle *c )
+{
+  assert( XRsiz && YRsiz );
+  c->x0 = ceildiv( r->x0, XRsiz );
+  c->y0 = ceildiv( r->y0, YRsiz );
+  c->x1 = ceildiv( r->x1, XRsiz );
+  c->y1 = ceildiv( r->y1, YRsiz );
+}
+
+bool buildtilegeometry( const codestreamindex *index, uint32_t tile, tilegeometry *g )
+{
+  memset( g, 0, sizeof(*g) );
+  g->index = index;
+  g->tile = tile;
+  if( !gettilerectangle( index, tile, &g->bounds ) ) return false;
+  for( uint16_t c = 0; c < index->Csiz; ++c )
+    {
+    const uint8_t nres = index->components[c].cs.NumberOfDecompositionLevels + 1;
+    if( nres > g->maxres ) g->maxres = nres;
+    }
+  g->components = malloc( index->Csiz * sizeof(rectangle) );
+  g->resolutions = calloc( (size_t)index->Csiz * g->maxres, sizeof(resolutiongeometry) );
+  if( !g->components || !g->resolutions ) return false;
+
+  for( uint16_t c = 0; c < index->Csiz; ++c )
+    {
+    const componentinfo *ci = index->components + c;
+    const codingstyle *cs = &ci->cs;
+    const unsigned int NL = cs->NumberOfDecompositionLevels;
+    const rectangle *tc = g->components + c;
+    getcomponentrectangle( &g->bounds, ci->XRsiz, ci->YRsiz, g->components + c );
+    for( unsigned int r = 0; r <= NL; ++r )
+      {
+      resolutiongeometry *rg = g->resolutions + (size_t)c * g->maxres + r;
+      /* B-14 */
+      const unsigned int e = NL - r;
+      rg->bounds.x0 = ceildivpow2( tc->x0, e );
+      rg->bounds.y0 = ceildivpow2( tc->y0, e );
+      rg->bounds.x1 = ceildivpow2( tc->x1, e );
+      rg->bounds.y1 = ceildivpow2( tc->y1, e );
+      rg->PPx = cs->PrecinctSize[r] & 0xf;
+      rg->PPy = cs->PrecinctSize[r] >> 4;
+      if( r && (!rg->PPx || !rg->PPy) ) return false;
+      /* B-17, B-18 */
+      const unsigned int PPxb = r ? rg->PPx - 1u : rg->PPx;
+      const unsigned int PPyb = r ? rg->PPy - 1u : rg->PPy;
+      rg->xcb = (uint8_t)(cs->xcb < PPxb ? cs->xcb : PPxb);
+      rg->ycb = (uint8_t)(cs->ycb < PPyb ? cs->ycb : PPyb);
+      rg->firstprecinct = g->nprecincts;
+      /* B-15 */
+      rg->nbands = r ? 3 : 1;
+      for( uint8_t b = 0; b < rg->nbands; ++b )
+        {
+        bandgeometry *bg = rg->bands + b;
+        bg->band = r ? b + 1 : 0;
+        if( !r )
+          {
+          bg->bounds = rg->bounds;
+          continue;
+          }
+        const unsigned int nb = NL - r + 1;
+        const unsigned int xob = bg->band & 1;
+        const unsigned int yob = bg->band >> 1;
+        bg->bounds.x0 = bandcoordinate( tc->x0, xob, nb );
+        bg->bounds.y0 = bandcoordinate( tc->y0, yob, nb );
+        bg->bounds.x1 = bandcoordinate( tc->x1, xob, nb );
+        bg->bounds.y1 = bandcoordinate( tc->y1, yob, nb );
+        }
+      if( rg->bounds.x0 == rg->bounds.x1 || rg->bounds.y0 == rg->bounds.y1 ) continue;
+      /* B-16 */
+      const uint64_t wide = ceildivpow2( rg->bounds.x1, rg->PPx ) - (rg->bounds.x0 >> rg->PPx);
+      const uint64_t high = ceildivpow2( rg->bounds.y1, rg->PPy ) - (rg->bounds.y0 >> rg->PPy);
+      if( wide * high > UINT32_MAX ) return false;
+      rg->wide = (uint32_t)wide;
+      rg->high = (uint32_t)high;
+      g->nprecincts += (size_t)(wide * high);
+      }
+    }
+  return true;
+}
+
+const resolutiongeometry *getresolutiongeometry( const tilegeometry *g, uint16_t comp, uint8_t res )
+{
+  if( comp >= g->index->Csiz ) return NULL;
+  if( res > g->index->components[comp].cs.NumberOfDecompositionLevels ) return NULL;
+  return g->resolutions + (size_t)comp * g->maxres + res;
+}
+
+/* precinct partition anchored at 0 on the resolution level grid */
+static void getprecinctpartition( const resolutiongeometry *rg, uint32_t precinct, rectangle *r )
+{
+  assert( precinct < rg->wide * rg->high );
+  const uint64_t i = precinct % rg->wide;
+  const uint64_t j = precinct / rg->wide;
+  r->x0 = ((rg->bounds.x0 >> rg->PPx) + i) << rg->PPx;
+  r->y0 = ((rg->bounds.y0 >> rg->PPy) + j) << rg->PPy;
+  r->x1 = r->x0 + ((uint64_t)1 << rg->PPx);
+  r->y1 = r->y0 + ((uint64_t)1 << rg->PPy);
+}
+
+void getprecinctrectangle( const resolutiongeometry *rg, uint32_t precinct, rectangle *r )
+{
+  getprecinctpartition( rg, precinct, r );
+  intersect( r, &rg->bounds );
+}
+
+void getprecinctcodeblocks( const resolutiongeometry *rg, uint32_t precinct, uint8_t b, rectangle *cb )
+{
+  assert( b < rg->nbands );
+  const bandgeometry *bg = rg->bands + b;
+  rectangle r;
+  getprecinctpartition( rg, precinct, &r );
+  if( bg->band )
+    {
+    /* B-17 the precinct seen on the subbands of the next level */
+    r.x0 >>= 1;
+    r.y0 >>= 1;
+    r.x1 = r.x0 + ((uint64_t)1 << (rg->PPx - 1));
+    r.y1 = r.y0 + ((uint64_t)1 << (rg->PPy - 1));
+    }
+  intersect( &r, &bg->bounds );
+  if( r.x0 == r.x1 )
+    {
+    memset( cb, 0, sizeof(*cb) );
+    return;
+    }
+  cb->x0 = r.x0 >> rg->xcb;
+  cb->y0 = r.y0 >> rg->ycb;
+  cb->x1 = ceildivpow2( r.x1, rg->xcb );
+  cb->y1 = ceildivpow2( r.y1, rg->ycb );
+}
+
+void getcodeblockrectangle( const resolutiongeometry *rg, uint8_t b, uint64_t cbx, uint64_t cby, rectangle *r )
+{
+  assert( b < rg->nbands );
+  r->x0 = cbx << rg->xcb;
+  r->y0 = cby << rg->ycb;
+  r->x1 = (cbx + 1) << rg->xcb;
+  r->y1 = (cby + 1) << rg->ycb;
+  intersect( r, &rg->bands[b].bounds );
+}
+
+void freetilegeometry( tilegeometry *g )
+{
+  free( g->components );
+  free( g->resolutions );
+  memset( g, 0, sizeof(*g) );
+}
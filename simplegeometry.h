@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simplegeometry_h
+#define simplegeometry_h
+
+#include "simpleindex.h"
+
+/*
+ * Annex B: tiles, tile-components, resolution levels, subbands, precincts
+ * and code-blocks, with integer arithmetic only.
+ * The grids of a tile are computed once into flat arrays, rectangles of a
+ * given precinct or code-block are then derived in constant time.
+ */
+
+/* [x0,x1) x [y0,y1) on the reference grid or on a component, resolution
+ * level or subband grid */
+typedef struct
+{
+  uint64_t x0;
+  uint64_t y0;
+  uint64_t x1;
+  uint64_t y1;
+} rectangle;
+
+typedef struct
+{
+  uint8_t   band;   /* 0: LL, 1: HL, 2: LH, 3: HH */
+  rectangle bounds; /* B-15 */
+} bandgeometry;
+
+typedef struct
+{
+  rectangle bounds;   /* B-14 */
+  uint8_t   PPx;      /* precinct size exponents, Table A.21 */
+  uint8_t   PPy;
+  uint8_t   xcb;      /* code-block size exponents within a precinct, B-17 */
+  uint8_t   ycb;
+  uint32_t  wide;     /* number of precincts, B-16 */
+  uint32_t  high;
+  size_t    firstprecinct; /* precincts of the tile are numbered resolution after resolution */
+  uint8_t   nbands;
+  bandgeometry bands[3];
+} resolutiongeometry;
+
+typedef struct
+{
+  const codestreamindex *index;
+  uint32_t  tile;
+  rectangle bounds;       /* B-7 */
+  uint8_t   maxres;       /* largest number of resolution levels of a component */
+  rectangle *components;  /* B-12, Csiz entries */
+  resolutiongeometry *resolutions; /* Csiz x maxres, missing levels are empty */
+  size_t    nprecincts;
+} tilegeometry;
+
+/**
+ * B-7: tile `tile` on the reference grid
+ */
+bool gettilerectangle( const codestreamindex *index, uint32_t tile, rectangle *r );
+
+/**
+ * B-12: a rectangle of the reference grid seen on a component subsampled by
+ * (XRsiz, YRsiz), gives Sdims on the image area
+ */
+void getcomponentrectangle( const rectangle *r, uint8_t XRsiz, uint8_t YRsiz, rectangle *c );
+
+/**
+ * Compute the grids of every tile-component of tile `tile`
+ */
+bool buildtilegeometry( const codestreamindex *index, uint32_t tile, tilegeometry *g );
+
+/**
+ * Return the resolution level `res` of component `comp`, NULL when the
+ * component has fewer levels
+ */
+const resolutiongeometry *getresolutiongeometry( const tilegeometry *g, uint16_t comp, uint8_t res );
+
+/**
+ * B.6: precinct `precinct` (raster order) of a resolution level on the
+ * resolution level grid, clipped to the tile-component
+ */
+void getprecinctrectangle( const resolutiongeometry *rg, uint32_t precinct, rectangle *r );
+
+/**
+ * B.7: range of code-block indices of subband `b` (index in
+ * resolutiongeometry::bands) covered by precinct `precinct`, may be empty
+ */
+void getprecinctcodeblocks( const resolutiongeometry *rg, uint32_t precinct, uint8_t b, rectangle *cb );
+
+/**
+ * B.7: code-block (cbx, cby) of subband `b` on the subband grid, clipped
+ */
+void getcodeblockrectangle( const resolutiongeometry *rg, uint8_t b, uint64_t cbx, uint64_t cby, rectangle *r );
+
+/**
+ * Release memory
+ */
+void freetilegeometry( tilegeometry *g );
+
+#endif
@@ -0,0 +1,665 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simpleindex.h"
+#include "simpleparser.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <byteswap.h>
+#include <sys/types.h> /* off_t */
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+
+static void cread16(const uint8_t *input, uint16_t * ret)
+{
+  uint16_t v;
+  memcpy( &v, input, sizeof(v) );
+  *ret = bswap_16( v );
+}
+
+static void cread32(const uint8_t *input, uint32_t * ret)
+{
+  uint32_t v;
+  memcpy( &v, input, sizeof(v) );
+  *ret = bswap_32( v );
+}
+
+/* parsej2k does not let us pass a user pointer, keep parsing state here */
+static codestreamindex *curindex;
+static bool inmainheader;
+static bool hascod;
+static bool failed;
+static codingstyle defaultcs; /* main header COD, for components without COC */
+static uint32_t pltpartial;
+static size_t maxpacketlengths; /* capacity of curindex->packetlengths */
+static bool skiptileparts; /* jump from SOT to SOT, see buildheaderindex */
+/* PPM: Nppm and Ippm can be split across segments, parse them as one stream */
+typedef struct
+{
+  size_t first;    /* in pphranges */
+  size_t n;
+  uint64_t length; /* Nppm */
+} ppmspan;
+static ppmspan *ppmspans; /* one per tile-part */
+static size_t nppmspans;
+static unsigned int nextzppm;
+static unsigned int nppmbytes; /* bytes of Nppm read so far */
+static uint32_t nppm;
+static uint32_t ppmremaining; /* bytes of Ippm left for the current tile-part */
+static uint8_t *segment;
+static size_t segmentsize;
+
+/* read the marker segment parameters into `segment` */
+static const uint8_t *readsegment( FILE *stream, size_t len )
+{
+  if( len > segmentsize )
+    {
+    uint8_t *p = realloc( segment, len );
+    if( !p ) return NULL;
+    segment = p;
+    segmentsize = len;
+    }
+  if( fread( segment, 1, len, stream ) != len ) return NULL;
+  return segment;
+}
+
+/* SPcod / SPcoc, return the number of bytes used or 0 on error */
+static size_t readcodingstyle( const uint8_t *p, size_t len, bool variable, codingstyle *cs )
+{
+  if( len < 5 ) return 0;
+  cs->NumberOfDecompositionLevels = p[0];
+  cs->xcb = (uint8_t)((p[1] & 0xf) + 2);
+  cs->ycb = (uint8_t)((p[2] & 0xf) + 2);
+  cs->CodeBlockStyle = p[3];
+  cs->Transformation = p[4];
+  cs->VariablePrecinctSize = variable;
+  if( cs->NumberOfDecompositionLevels > 32 ) return 0;
+  const size_t nres = (size_t)cs->NumberOfDecompositionLevels + 1;
+  if( variable && len < 5 + nres ) return 0;
+  for( size_t r = 0; r < nres; ++r )
+    {
+    /* Table A.21: PPx = PPy = 15 when precincts are not specified */
+    cs->PrecinctSize[r] = variable ? p[5 + r] : 0xff;
+    }
+  return variable ? 5 + nres : 5;
+}
+
+static bool indexsiz( const uint8_t *p, size_t len )
+{
+  codestreamindex *index = curindex;
+  if( len < 36 || index->components ) return false;
+  cread16( p, &index->Rsiz );
+  cread32( p + 2, &index->Xsiz );
+  cread32( p + 6, &index->Ysiz );
+  cread32( p + 10, &index->XOsiz );
+  cread32( p + 14, &index->YOsiz );
+  cread32( p + 18, &index->XTsiz );
+  cread32( p + 22, &index->YTsiz );
+  cread32( p + 26, &index->XTOsiz );
+  cread32( p + 30, &index->YTOsiz );
+  cread16( p + 34, &index->Csiz );
+  if( !index->Csiz || len != 36 + 3 * (size_t)index->Csiz ) return false;
+  if( !index->XTsiz || !index->YTsiz ) return false;
+  if( index->XOsiz >= index->Xsiz || index->YOsiz >= index->Ysiz ) return false;
+  if( index->XTOsiz > index->XOsiz || index->YTOsiz > index->YOsiz ) return false;
+  index->components = calloc( index->Csiz, sizeof(componentinfo) );
+  if( !index->components ) return false;
+  for( uint16_t c = 0; c < index->Csiz; ++c )
+    {
+    componentinfo *comp = index->components + c;
+    comp->Ssiz  = p[36 + 3 * c];
+    comp->XRsiz = p[37 + 3 * c];
+    comp->YRsiz = p[38 + 3 * c];
+    if( !comp->XRsiz || !comp->YRsiz ) return false;
+    }
+  return true;
+}
+
+static bool indexcod( const uint8_t *p, size_t len )
+{
+  codestreamindex *index = curindex;
+  if( len < 5 ) return false;
+  index->Scod = p[0];
+  index->ProgressionOrder = p[1];
+  cread16( p + 2, &index->NumberOfLayers );
+  index->MultipleComponentTransformation = p[4];
+  if( !index->NumberOfLayers ) return false;
+  if( readcodingstyle( p + 5, len - 5, index->Scod & 0x1, &defaultcs ) != len - 5 )
+    return false;
+  hascod = true;
+  return true;
+}
+
+static bool indexcoc( const uint8_t *p, size_t len )
+{
+  codestreamindex *index = curindex;
+  if( !index->components ) return false;
+  const size_t n = index->Csiz < 257 ? 1 : 2;
+  if( len < n + 1 ) return false;
+  uint16_t c = p[0];
+  if( n == 2 ) cread16( p, &c );
+  if( c >= index->Csiz ) return false;
+  componentinfo *comp = index->components + c;
+  if( readcodingstyle( p + n + 1, len - n - 1, p[n] & 0x1, &comp->cs ) != len - n - 1 )
+    return false;
+  comp->hascoc = true;
+  return true;
+}
+
+static bool addpphrange( uint64_t offset, uint32_t length )
+{
+  codestreamindex *index = curindex;
+  if( index->npphranges % 256 == 0 )
+    {
+    pphrange *r = realloc( index->pphranges, (index->npphranges + 256) * sizeof(pphrange) );
+    if( !r ) return false;
+    index->pphranges = r;
+    }
+  index->pphranges[ index->npphranges ].offset = offset;
+  index->pphranges[ index->npphranges ].length = length;
+  ++index->npphranges;
+  return true;
+}
+
+/* A.7.4 Packed packet headers, main header (PPM) */
+static bool indexppm( const uint8_t *p, size_t len, uint64_t offset )
+{
+  if( !inmainheader || len < 1 ) return false;
+  /* Zppm, segments are expected in order */
+  if( p[0] != nextzppm++ ) return false;
+  size_t i = 1;
+  while( i < len )
+    {
+    if( ppmremaining )
+      {
+      const uint32_t n = len - i < ppmremaining ? (uint32_t)(len - i) : ppmremaining;
+      if( !addpphrange( offset + i, n ) ) return false;
+      ++ppmspans[ nppmspans - 1 ].n;
+      ppmremaining -= n;
+      i += n;
+      continue;
+      }
+    nppm = (nppm << 8) | p[i++];
+    if( ++nppmbytes == 4 )
+      {
+      if( nppmspans % 256 == 0 )
+        {
+        ppmspan *s = realloc( ppmspans, (nppmspans + 256) * sizeof(ppmspan) );
+        if( !s ) return false;
+        ppmspans = s;
+        }
+      ppmspan *s = ppmspans + nppmspans++;
+      s->first = curindex->npphranges;
+      s->n = 0;
+      s->length = nppm;
+      ppmremaining = nppm;
+      nppm = 0;
+      nppmbytes = 0;
+      }
+    }
+  return true;
+}
+
+/* A.7.5 Packed packet headers, tile-part header (PPT) */
+static bool indexppt( const uint8_t *p, size_t len, uint64_t offset )
+{
+  codestreamindex *index = curindex;
+  if( inmainheader || !index->ntileparts || len < 1 ) return false;
+  tilepartinfo *tp = index->tileparts + index->ntileparts - 1;
+  /* Zppt, segments are expected in order */
+  if( p[0] != tp->npph ) return false;
+  if( !tp->npph ) tp->firstpph = index->npphranges;
+  ++tp->npph;
+  tp->pphlength += len - 1;
+  return addpphrange( offset + 1, (uint32_t)(len - 1) );
+}
+
+/* first SOT: the main header is complete */
+static bool endmainheader( void )
+{
+  codestreamindex *index = curindex;
+  if( !index->components || !hascod ) return false;
+  if( nppmbytes || ppmremaining ) return false; /* truncated PPM */
+  for( uint16_t c = 0; c < index->Csiz; ++c )
+    {
+    componentinfo *comp = index->components + c;
+    if( !comp->hascoc ) comp->cs = defaultcs;
+    }
+  inmainheader = false;
+  return true;
+}
+
+static bool indexsot( const uint8_t *p, size_t len, uint64_t offset )
+{
+  codestreamindex *index = curindex;
+  if( len != 8 ) return false;
+  if( inmainheader )
+    {
+    if( !endmainheader() ) return false;
+    index->mainheaderend = offset;
+    }
+  if( index->ntileparts % 256 == 0 )
+    {
+    tilepartinfo *tp = realloc( index->tileparts,
+      (index->ntileparts + 256) * sizeof(tilepartinfo) );
+    if( !tp ) return false;
+    index->tileparts = tp;
+    }
+  tilepartinfo *tp = index->tileparts + index->ntileparts++;
+  memset( tp, 0, sizeof(*tp) );
+  tp->offset = offset;
+  cread16( p, &tp->Isot );
+  cread32( p + 2, &tp->Psot );
+  tp->TPsot = p[6];
+  tp->TNsot = p[7];
+  tp->firstpacket = index->npacketlengths;
+  if( index->flags & INDEX_PPM )
+    {
+    /* its Nppm / Ippm from the main header */
+    const size_t k = index->ntileparts - 1;
+    if( k >= nppmspans ) return false;
+    tp->firstpph = ppmspans[k].first;
+    tp->npph = ppmspans[k].n;
+    tp->pphlength = ppmspans[k].length;
+    }
+  pltpartial = 0;
+  return tp->Isot < getnumberoftiles( index );
+}
+
+static bool indexplt( const uint8_t *p, size_t len )
+{
+  codestreamindex *index = curindex;
+  if( inmainheader || !index->ntileparts || len < 1 ) return false;
+  /* each Iplt uses at least one byte */
+  if( index->npacketlengths + len - 1 > maxpacketlengths )
+    {
+    size_t n = maxpacketlengths ? 2 * maxpacketlengths : 1024;
+    while( n < index->npacketlengths + len - 1 ) n *= 2;
+    uint32_t *lengths = realloc( index->packetlengths, n * sizeof(uint32_t) );
+    if( !lengths ) return false;
+    index->packetlengths = lengths;
+    maxpacketlengths = n;
+    }
+  const size_t n = decodeplt( p + 1, len - 1,
+    index->packetlengths + index->npacketlengths, &pltpartial );
+  index->npacketlengths += n;
+  index->tileparts[ index->ntileparts - 1 ].npackets += n;
+  return true;
+}
+
+static bool indexpoc( const uint8_t *p, size_t len )
+{
+  codestreamindex *index = curindex;
+  if( !index->components ) return false;
+  if( !inmainheader && !index->ntileparts ) return false;
+  const uint16_t tile = inmainheader ? POCMAINHEADER : index->tileparts[ index->ntileparts - 1 ].Isot;
+  progressionchange *c = realloc( index->pocs,
+    (index->npocs + len / 7) * sizeof(progressionchange) + 1 );
+  if( !c ) return false;
+  index->pocs = c;
+  const size_t n = decodepoc( p, len, index->Csiz, tile, index->pocs + index->npocs );
+  index->npocs += n;
+  return n != 0;
+}
+
+static bool indexmarker( uint_fast16_t marker, size_t len, FILE *stream )
+{
+  codestreamindex *index = curindex;
+  const uint64_t offset = (uint64_t)ftello( stream );
+  const uint8_t *p = NULL;
+  bool ok = true;
+  if( failed ) return true;
+  switch( marker )
+    {
+  case SOC:
+    index->socoffset = offset - 2;
+    return true;
+  case EOC:
+    index->eocoffset = offset - 2;
+    return true;
+  case SOD:
+    if( inmainheader || !index->ntileparts )
+      {
+      failed = true;
+      return true;
+      }
+    index->tileparts[ index->ntileparts - 1 ].dataoffset = offset;
+    index->tileparts[ index->ntileparts - 1 ].datalength = len;
+    return true;
+  case SIZ:
+  case COD:
+  case COC:
+  case SOT:
+  case PLT:
+  case POC:
+    p = readsegment( stream, len );
+    if( !p )
+      {
+      failed = true;
+      return false;
+      }
+    break;
+  case TLM:
+    index->flags |= INDEX_TLM;
+    return true;
+  case PLM:
+    index->flags |= INDEX_PLM;
+    return true;
+  case PPM:
+    index->flags |= INDEX_PPM;
+    /* fall through */
+  case PPT:
+    p = readsegment( stream, len );
+    if( !p )
+      {
+      failed = true;
+      return false;
+      }
+    break;
+  case QCD:
+  case QCC:
+    if( !inmainheader ) index->flags |= INDEX_TILEQCD;
+    return true;
+  default:
+    return true;
+    }
+
+  switch( marker )
+    {
+  case SIZ:
+    ok = inmainheader && indexsiz( p, len );
+    break;
+  case COD:
+  case COC:
+    if( !inmainheader )
+      index->flags |= INDEX_TILECOD;
+    else
+      ok = marker == COD ? indexcod( p, len ) : indexcoc( p, len );
+    break;
+  case SOT:
+    ok = indexsot( p, len, offset - 4 );
+    if( ok && skiptileparts && index->tileparts[ index->ntileparts - 1 ].Psot )
+      {
+      /* the parser resumes at the next SOT (or EOC) */
+      const tilepartinfo *tp = index->tileparts + index->ntileparts - 1;
+      ok = fseeko( stream, (off_t)(tp->offset + tp->Psot), SEEK_SET ) == 0;
+      }
+    break;
+  case PLT:
+    index->flags |= INDEX_PLT;
+    ok = indexplt( p, len );
+    break;
+  case PPM:
+    ok = indexppm( p, len, offset );
+    break;
+  case PPT:
+    index->flags |= INDEX_PPT;
+    ok = indexppt( p, len, offset );
+    break;
+  case POC:
+    index->flags |= INDEX_POC;
+    ok = indexpoc( p, len );
+    break;
+    }
+  if( !ok ) failed = true;
+  return false;
+}
+
+static bool indexbox( uint_fast32_t marker, size_t len, FILE *stream )
+{
+  codestreamindex *index = curindex;
+  if( marker != JP2C ) return true;
+  if( index->isjp2 ) /* only the first codestream is indexed */
+    {
+    failed = true;
+    return true;
+    }
+  /* box header is either LBox TBox or LBox TBox XLBox */
+  const off_t start = ftello( stream );
+  uint8_t header[16];
+  uint32_t lbox = 0;
+  if( start >= 16 )
+    {
+    int v = fseeko( stream, start - 16, SEEK_SET );
+    assert( v == 0 );
+    if( fread( header, 1, sizeof(header), stream ) != sizeof(header) )
+      failed = true;
+    cread32( header, &lbox );
+    }
+  index->isjp2 = true;
+  index->jp2cbegin = (uint64_t)start - (lbox == 1 && header[4] == 'j' ? 16 : 8);
+  index->jp2cend = (uint64_t)start + len - 8;
+  return true;
+}
+
+static bool buildindex_imp( const char *filename, codestreamindex *index, bool skip )
+{
+  bool b;
+  memset( index, 0, sizeof(*index) );
+  curindex = index;
+  skiptileparts = skip;
+  nppmspans = 0;
+  nextzppm = 0;
+  nppmbytes = 0;
+  nppm = 0;
+  ppmremaining = 0;
+  inmainheader = true;
+  hascod = false;
+  failed = false;
+  pltpartial = 0;
+  maxpacketlengths = 0;
+  if( isjp2file( filename ) )
+    b = parsejp2( filename, indexbox, indexmarker );
+  else
+    b = parsej2k( filename, indexmarker );
+  curindex = NULL;
+  free( segment );
+  segment = NULL;
+  segmentsize = 0;
+  /* one Nppm per tile-part */
+  const bool ppmok = !(index->flags & INDEX_PPM) || nppmspans == index->ntileparts;
+  free( ppmspans );
+  ppmspans = NULL;
+  if( !b || failed || inmainheader || !index->eocoffset || !ppmok )
+    {
+    freeindex( index );
+    return false;
+    }
+  return true;
+}
+
+bool buildindex( const char *filename, codestreamindex *index )
+{
+  return buildindex_imp( filename, index, false );
+}
+
+bool buildheaderindex( const char *filename, codestreamindex *index )
+{
+  return buildindex_imp( filename, index, true );
+}
+
+void freeindex( codestreamindex *index )
+{
+  free( index->components );
+  free( index->tileparts );
+  free( index->packetlengths );
+  free( index->pphranges );
+  free( index->pocs );
+  memset( index, 0, sizeof(*index) );
+}
+
+size_t decodeplt( const uint8_t *p, size_t len, uint32_t *lengths, uint32_t *partial )
+{
+  size_t n = 0;
+  uint32_t v = *partial;
+  const uint8_t *end = p + len;
+#if defined(__SSE2__) && defined(__GNUC__)
+  /*
+   * 16 bytes at a time: a single movemask tells whether the block holds 16
+   * complete lengths below 128 (the usual case for the many small packets of
+   * low resolutions and high layers), those are simply widened to 32 bits.
+   */
+  const __m128i zero = _mm_setzero_si128();
+  for( ; end - p >= 16; p += 16 )
+    {
+    const __m128i bytes = _mm_loadu_si128( (const __m128i*)p );
+    if( _mm_movemask_epi8( bytes ) == 0 && v == 0 )
+      {
+      const __m128i lo = _mm_unpacklo_epi8( bytes, zero );
+      const __m128i hi = _mm_unpackhi_epi8( bytes, zero );
+      _mm_storeu_si128( (__m128i*)(lengths + n),      _mm_unpacklo_epi16( lo, zero ) );
+      _mm_storeu_si128( (__m128i*)(lengths + n + 4),  _mm_unpackhi_epi16( lo, zero ) );
+      _mm_storeu_si128( (__m128i*)(lengths + n + 8),  _mm_unpacklo_epi16( hi, zero ) );
+      _mm_storeu_si128( (__m128i*)(lengths + n + 12), _mm_unpackhi_epi16( hi, zero ) );
+      n += 16;
+      continue;
+      }
+    /* mixed block: same as below, one byte at a time */
+    for( unsigned int i = 0; i < 16; ++i )
+      {
+      const uint32_t more = (uint32_t)0 - (p[i] >> 7); /* all ones if continued */
+      v = (v << 7) | (p[i] & 0x7f);
+      lengths[n] = v;
+      n += 1 - (more & 1);
+      v &= more;
+      }
+    }
+#endif
+  /* without branch on the continuation bit, `lengths[n]` is always written */
+  for( ; p != end; ++p )
+    {
+    const uint32_t more = (uint32_t)0 - (*p >> 7); /* all ones if continued */
+    v = (v << 7) | (*p & 0x7f);
+    lengths[n] = v;
+    n += 1 - (more & 1);
+    v &= more;
+    }
+  *partial = v;
+  return n;
+}
+
+size_t decodepoc( const uint8_t *p, size_t len, uint16_t Csiz, uint16_t tile, progressionchange *changes )
+{
+  /* Table A.32, CSpoc and CEpoc are 16 bits when Csiz >= 257 */
+  const size_t n = Csiz < 257 ? 1 : 2;
+  const size_t size = 5 + 2 * n;
+  if( !len || len % size ) return 0;
+  for( size_t i = 0; i < len / size; ++i, p += size )
+    {
+    progressionchange *c = changes + i;
+    c->tile = tile;
+    c->RSpoc = p[0];
+    if( n == 1 )
+      c->CSpoc = p[1];
+    else
+      cread16( p + 1, &c->CSpoc );
+    cread16( p + 1 + n, &c->LYEpoc );
+    c->REpoc = p[3 + n];
+    if( n == 1 )
+      c->CEpoc = p[4 + n] ? p[4 + n] : 256;
+    else
+      cread16( p + 4 + n, &c->CEpoc );
+    c->Ppoc = p[4 + 2 * n];
+    if( c->Ppoc > 4 || c->RSpoc >= c->REpoc || c->CSpoc >= c->CEpoc ) return 0;
+    }
+  return len / size;
+}
+
+static uint64_t ceildiv( uint64_t a, uint64_t b )
+{
+  return (a + b - 1) / b;
+}
+
+static uint64_t ceildivpow2( uint64_t a, unsigned int e )
+{
+  return (a + ((uint64_t)1 << e) - 1) >> e;
+}
+
+uint32_t getnumberoftiles( const codestreamindex *index )
+{
+  const uint64_t ntx = ceildiv( index->Xsiz - index->XTOsiz, index->XTsiz );
+  const uint64_t nty = ceildiv( index->Ysiz - index->YTOsiz, index->YTsiz );
+  /* A.4.2 Isot: 0 to 65534 */
+  if( ntx * nty > 65535 ) return 0;
+  return (uint32_t)(ntx * nty);
+}
+
+uint64_t getnumberofprecincts( const codestreamindex *index, uint32_t tile, uint16_t comp, uint8_t res )
+{
+  assert( comp < index->Csiz );
+  const componentinfo *ci = index->components + comp;
+  const codingstyle *cs = &ci->cs;
+  if( res > cs->NumberOfDecompositionLevels ) return 0;
+
+  /* B-7 */
+  const uint64_t ntx = ceildiv( index->Xsiz - index->XTOsiz, index->XTsiz );
+  const uint64_t p = tile % ntx;
+  const uint64_t q = tile / ntx;
+  uint64_t tx0 = index->XTOsiz + p * index->XTsiz;
+  uint64_t ty0 = index->YTOsiz + q * index->YTsiz;
+  uint64_t tx1 = tx0 + index->XTsiz;
+  uint64_t ty1 = ty0 + index->YTsiz;
+  if( tx0 < index->XOsiz ) tx0 = index->XOsiz;
+  if( ty0 < index->YOsiz ) ty0 = index->YOsiz;
+  if( tx1 > index->Xsiz ) tx1 = index->Xsiz;
+  if( ty1 > index->Ysiz ) ty1 = index->Ysiz;
+
+  /* B-12 */
+  const uint64_t tcx0 = ceildiv( tx0, ci->XRsiz );
+  const uint64_t tcy0 = ceildiv( ty0, ci->YRsiz );
+  const uint64_t tcx1 = ceildiv( tx1, ci->XRsiz );
+  const uint64_t tcy1 = ceildiv( ty1, ci->YRsiz );
+
+  /* B-14 */
+  const unsigned int e = cs->NumberOfDecompositionLevels - res;
+  const uint64_t trx0 = ceildivpow2( tcx0, e );
+  const uint64_t try0 = ceildivpow2( tcy0, e );
+  const uint64_t trx1 = ceildivpow2( tcx1, e );
+  const uint64_t try1 = ceildivpow2( tcy1, e );
+  if( trx0 == trx1 || try0 == try1 ) return 0;
+
+  /* B-16 */
+  const unsigned int PPx = cs->PrecinctSize[res] & 0xf;
+  const unsigned int PPy = cs->PrecinctSize[res] >> 4;
+  const uint64_t numprecinctswide = ceildivpow2( trx1, PPx ) - (trx0 >> PPx);
+  const uint64_t numprecinctshigh = ceildivpow2( try1, PPy ) - (try0 >> PPy);
+  return numprecinctswide * numprecinctshigh;
+}
+
+uint64_t getnumberofpackets( const codestreamindex *index, uint32_t tile )
+{
+  uint64_t n = 0;
+  for( uint16_t c = 0; c < index->Csiz; ++c )
+    {
+    const uint8_t nres = index->components[c].cs.NumberOfDecompositionLevels + 1;
+    for( uint8_t r = 0; r < nres; ++r )
+      n += getnumberofprecincts( index, tile, c, r );
+    }
+  return n * index->NumberOfLayers;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simpleindex_h
+#define simpleindex_h
+
+#include <stdint.h>
+#include <stdlib.h> /* size_t */
+#include <stdbool.h>
+
+/*
+ * In-memory index of a J2K codestream (raw or wrapped in a JP2 file).
+ * It is built in a single pass with parsej2k / parsejp2 and records the main
+ * header parameters required to compute packet counts, the list of tile-parts
+ * with their absolute file offsets and the packet lengths found in PLT.
+ */
+
+/* Table A.15 - Coding style parameter values of the SPcod and SPcoc parameters */
+typedef struct
+{
+  uint8_t NumberOfDecompositionLevels;
+  uint8_t xcb; /* code-block width exponent (xcb = value + 2) */
+  uint8_t ycb;
+  uint8_t CodeBlockStyle;
+  uint8_t Transformation;
+  bool    VariablePrecinctSize;
+  uint8_t PrecinctSize[33]; /* Table A.21, PPx | PPy << 4, one per resolution level */
+} codingstyle;
+
+typedef struct
+{
+  uint8_t Ssiz;
+  uint8_t XRsiz;
+  uint8_t YRsiz;
+  bool hascoc; /* coding style comes from a main header COC */
+  codingstyle cs;
+} componentinfo;
+
+/* A.7.4 / A.7.5 a run of packed packet header bytes (Ippm or Ippt) in the file */
+typedef struct
+{
+  uint64_t offset; /* absolute position */
+  uint32_t length;
+} pphrange;
+
+typedef struct
+{
+  uint64_t offset;     /* absolute position of the SOT marker */
+  uint64_t dataoffset; /* absolute position of the first byte after SOD */
+  uint64_t datalength; /* number of bytes after SOD */
+  uint32_t Psot;       /* as found in the codestream (can be 0) */
+  uint16_t Isot;
+  uint8_t  TPsot;
+  uint8_t  TNsot;
+  size_t   firstpacket; /* index in codestreamindex::packetlengths */
+  size_t   npackets;    /* number of Iplt found in the tile-part header */
+  size_t   firstpph;    /* index in codestreamindex::pphranges */
+  size_t   npph;        /* number of ranges holding the packet headers of the tile-part */
+  uint64_t pphlength;   /* sum of their lengths */
+} tilepartinfo;
+
+/* Table A.32 - Progression order change, tile parameter values */
+typedef struct
+{
+  uint16_t tile;   /* Isot, POCMAINHEADER for the main header */
+  uint8_t  RSpoc;
+  uint16_t CSpoc;
+  uint16_t LYEpoc;
+  uint8_t  REpoc;
+  uint16_t CEpoc;  /* a CEpoc of 0 in the codestream is stored as 256 */
+  uint8_t  Ppoc;
+} progressionchange;
+
+#define POCMAINHEADER 0xffff
+
+/* markers found while indexing */
+typedef enum {
+  INDEX_TLM     = 0x001,
+  INDEX_PLM     = 0x002,
+  INDEX_PLT     = 0x004,
+  INDEX_PPM     = 0x008,
+  INDEX_PPT     = 0x010,
+  INDEX_POC     = 0x020,
+  INDEX_TILECOD = 0x040, /* COD or COC in a tile-part header */
+  INDEX_TILEQCD = 0x080  /* QCD or QCC in a tile-part header */
+} IndexFlags;
+
+typedef struct
+{
+  /* Table A.9 - Image and tile size parameter values */
+  uint16_t Rsiz;
+  uint32_t Xsiz;
+  uint32_t Ysiz;
+  uint32_t XOsiz;
+  uint32_t YOsiz;
+  uint32_t XTsiz;
+  uint32_t YTsiz;
+  uint32_t XTOsiz;
+  uint32_t YTOsiz;
+  uint16_t Csiz;
+  componentinfo *components;
+
+  /* Table A.12 - Coding style default parameter values */
+  uint8_t  Scod;
+  uint8_t  ProgressionOrder;
+  uint16_t NumberOfLayers;
+  uint8_t  MultipleComponentTransformation;
+
+  bool     isjp2;
+  uint64_t jp2cbegin;     /* JP2 only: absolute position of the jp2c box */
+  uint64_t jp2cend;       /* JP2 only: absolute position right after the jp2c box */
+
+  uint64_t socoffset;     /* absolute position of SOC */
+  uint64_t mainheaderend; /* absolute position of the first SOT */
+  uint64_t eocoffset;     /* absolute position of EOC */
+
+  tilepartinfo *tileparts;
+  size_t ntileparts;
+
+  uint32_t *packetlengths;
+  size_t npacketlengths;
+
+  /* packed packet headers, from PPM (split at tile-part and segment
+   * boundaries) or PPT (one range per segment) */
+  pphrange *pphranges;
+  size_t npphranges;
+
+  /* POC entries, main header first then tile-part headers in codestream order */
+  progressionchange *pocs;
+  size_t npocs;
+
+  unsigned int flags; /* IndexFlags */
+} codestreamindex;
+
+/**
+ * Build the index of a J2K codestream or JP2 file.
+ * Return false on failure, in which case `index` does not need freeindex
+ */
+bool buildindex( const char *filename, codestreamindex *index );
+
+/**
+ * Same as buildindex, but only the main header and the SOT of each tile-part
+ * are read: the parser jumps from one SOT to the next using Psot. Tile-parts
+ * with a non zero Psot have no packet lengths and a zero dataoffset /
+ * datalength, their headers are left to the caller.
+ */
+bool buildheaderindex( const char *filename, codestreamindex *index );
+
+/**
+ * buildindex with the tile-part headers (PLT, PPT, COD/COC/QCD/QCC, POC) read
+ * by `nthreads` threads once buildheaderindex has found every tile-part.
+ * The result is identical to buildindex. Defined in simpleindexmt.c, link
+ * with the threads library.
+ */
+bool buildindexparallel( const char *filename, codestreamindex *index, unsigned int nthreads );
+
+/**
+ * Release memory
+ */
+void freeindex( codestreamindex *index );
+
+/**
+ * Decode the Iplt values of a PLT segment (without Zplt) and append them to
+ * `lengths` (which must have room for `len` values at most).
+ * `partial` carries an unfinished packet length from one call to the next,
+ * initialize it to 0.
+ * Return the number of lengths written
+ */
+size_t decodeplt( const uint8_t *p, size_t len, uint32_t *lengths, uint32_t *partial );
+
+/**
+ * Decode the progression order changes of a POC segment found in the main
+ * header (`tile` is POCMAINHEADER) or in a tile-part header of `tile`.
+ * `changes` must have room for len / 7 entries.
+ * Return the number of entries written or 0 on error
+ */
+size_t decodepoc( const uint8_t *p, size_t len, uint16_t Csiz, uint16_t tile, progressionchange *changes );
+
+/* B.3 Division of the image into tiles and tile-components, 0 when SIZ
+ * gives more than 65535 tiles */
+uint32_t getnumberoftiles( const codestreamindex *index );
+
+/**
+ * B.6 Division of resolution levels into precincts: return the number of
+ * precincts of resolution level `res` (0 is the lowest) in tile-component
+ * (`tile`,`comp`) or 0 when the resolution level is empty or does not exist
+ */
+uint64_t getnumberofprecincts( const codestreamindex *index, uint32_t tile, uint16_t comp, uint8_t res );
+
+/**
+ * Return the number of packets of tile `tile` expected from the main header
+ */
+uint64_t getnumberofpackets( const codestreamindex *index, uint32_t tile );
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simpleindex.h"
+#include "simpleparser.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/types.h> /* off_t */
+
+/* what one tile-part header gives, merged in tile-part order at the end */
+typedef struct
+{
+  uint32_t *packetlengths;
+  size_t npackets;
+  unsigned int flags; /* IndexFlags */
+  uint64_t dataoffset;
+  uint64_t datalength;
+  pphrange *pph; /* PPT */
+  size_t npph;
+  uint64_t pphlength;
+  progressionchange *pocs;
+  size_t npocs;
+  bool ok;
+} tilepartresult;
+
+/* thread pool: workers pick the next tile-part until the list is exhausted */
+static const char *curfilename;
+static const codestreamindex *curindex;
+static tilepartresult *results;
+static size_t nexttilepart;
+static pthread_mutex_t nextlock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct
+{
+  FILE *stream;
+  uint8_t *segment;
+  size_t segmentsize;
+} workerstate;
+
+static bool readu16( FILE *stream, uint16_t *v )
+{
+  uint8_t b[2];
+  if( fread( b, 1, 2, stream ) != 2 ) return false;
+  *v = (uint16_t)((b[0] << 8) | b[1]);
+  return true;
+}
+
+/* read the marker segments after SOT up to SOD, mirror of indexmarker */
+static bool indextilepart( workerstate *w, const tilepartinfo *tp, tilepartresult *res )
+{
+  const uint64_t end = tp->offset + tp->Psot;
+  uint64_t pos = tp->offset + 12; /* SOT, Lsot and its 8 bytes */
+  uint32_t partial = 0;
+  size_t maxpackets = 0;
+  if( fseeko( w->stream, (off_t)pos, SEEK_SET ) != 0 ) return false;
+  for( ;; )
+    {
+    uint16_t marker, l;
+    if( pos + 2 > end || !readu16( w->stream, &marker ) ) return false;
+    pos += 2;
+    if( marker == SOD )
+      {
+      res->dataoffset = pos;
+      res->datalength = end - pos;
+      return true;
+      }
+    if( hasnolength( marker ) || pos + 2 > end || !readu16( w->stream, &l ) || l < 2 )
+      return false;
+    const size_t len = (size_t)l - 2;
+    pos += 2 + len;
+    if( pos > end ) return false;
+    switch( marker )
+      {
+    case COD:
+    case COC:
+      res->flags |= INDEX_TILECOD;
+      break;
+    case QCD:
+    case QCC:
+      res->flags |= INDEX_TILEQCD;
+      break;
+    case PPT:
+      res->flags |= INDEX_PPT;
+      {
+      uint8_t Zppt;
+      if( len < 1 || fread( &Zppt, 1, 1, w->stream ) != 1 ) return false;
+      /* Zppt, segments are expected in order */
+      if( Zppt != res->npph ) return false;
+      pphrange *r = realloc( res->pph, (res->npph + 1) * sizeof(pphrange) );
+      if( !r ) return false;
+      res->pph = r;
+      r[res->npph].offset = pos - len + 1;
+      r[res->npph].length = (uint32_t)(len - 1);
+      ++res->npph;
+      res->pphlength += len - 1;
+      if( fseeko( w->stream, (off_t)(len - 1), SEEK_CUR ) != 0 ) return false;
+      }
+      continue;
+    case POC:
+      res->flags |= INDEX_POC;
+      break;
+      }
+    if( marker != PLT && marker != POC )
+      {
+      if( fseeko( w->stream, (off_t)len, SEEK_CUR ) != 0 ) return false;
+      continue;
+      }
+
+    if( len < 1 ) return false;
+    if( len > w->segmentsize )
+      {
+      uint8_t *p = realloc( w->segment, len );
+      if( !p ) return false;
+      w->segment = p;
+      w->segmentsize = len;
+      }
+    if( fread( w->segment, 1, len, w->stream ) != len ) return false;
+    if( marker == POC )
+      {
+      progressionchange *c = realloc( res->pocs, (res->npocs + len / 7) * sizeof(progressionchange) );
+      if( !c ) return false;
+      res->pocs = c;
+      const size_t n = decodepoc( w->segment, len, curindex->Csiz, tp->Isot, res->pocs + res->npocs );
+      if( !n ) return false;
+      res->npocs += n;
+      continue;
+      }
+
+    /* PLT */
+    res->flags |= INDEX_PLT;
+    /* each Iplt uses at least one byte */
+    if( res->npackets + len - 1 > maxpackets )
+      {
+      size_t n = maxpackets ? 2 * maxpackets : 1024;
+      while( n < res->npackets + len - 1 ) n *= 2;
+      uint32_t *p = realloc( res->packetlengths, n * sizeof(uint32_t) );
+      if( !p ) return false;
+      res->packetlengths = p;
+      maxpackets = n;
+      }
+    res->npackets += decodeplt( w->segment + 1, len - 1,
+      res->packetlengths + res->npackets, &partial );
+    }
+}
+
+static void *worker( void *arg )
+{
+  workerstate w;
+  (void)arg;
+  memset( &w, 0, sizeof(w) );
+  w.stream = fopen( curfilename, "rb" );
+  for( ;; )
+    {
+    pthread_mutex_lock( &nextlock );
+    const size_t i = nexttilepart++;
+    pthread_mutex_unlock( &nextlock );
+    if( i >= curindex->ntileparts ) break;
+    const tilepartinfo *tp = curindex->tileparts + i;
+    /* Psot = 0: already read by buildheaderindex */
+    if( !tp->Psot ) continue;
+    results[i].ok = w.stream && indextilepart( &w, tp, results + i );
+    }
+  if( w.stream ) fclose( w.stream );
+  free( w.segment );
+  return NULL;
+}
+
+/* put the per tile-part results back into `index`, in tile-part order */
+static bool mergeresults( codestreamindex *index )
+{
+  size_t total = 0;
+  size_t i;
+  for( i = 0; i < index->ntileparts; ++i )
+    {
+    const tilepartinfo *tp = index->tileparts + i;
+    if( tp->Psot && !results[i].ok ) return false;
+    total += tp->Psot ? results[i].npackets : tp->npackets;
+    }
+  uint32_t *lengths = malloc( total * sizeof(uint32_t) + 1 );
+  if( !lengths ) return false;
+  size_t nranges = index->npphranges;
+  for( i = 0; i < index->ntileparts; ++i )
+    nranges += results[i].npph;
+  pphrange *ranges = realloc( index->pphranges, nranges * sizeof(pphrange) + 1 );
+  if( !ranges )
+    {
+    free( lengths );
+    return false;
+    }
+  index->pphranges = ranges;
+  /* main header POC, then the tile-parts in order; a tile-part with Psot = 0
+   * is the last one and was read by buildheaderindex */
+  size_t npocs = index->npocs;
+  for( i = 0; i < index->ntileparts; ++i )
+    npocs += results[i].npocs;
+  progressionchange *pocs = malloc( npocs * sizeof(progressionchange) + 1 );
+  if( !pocs )
+    {
+    free( lengths );
+    return false;
+    }
+  size_t k = 0, j;
+  for( j = 0; j < index->npocs && index->pocs[j].tile == POCMAINHEADER; ++j )
+    pocs[k++] = index->pocs[j];
+  for( i = 0; i < index->ntileparts; ++i )
+    {
+    memcpy( pocs + k, results[i].pocs, results[i].npocs * sizeof(progressionchange) );
+    k += results[i].npocs;
+    }
+  for( ; j < index->npocs; ++j )
+    pocs[k++] = index->pocs[j];
+  free( index->pocs );
+  index->pocs = pocs;
+  index->npocs = npocs;
+  size_t n = 0;
+  for( i = 0; i < index->ntileparts; ++i )
+    {
+    tilepartinfo *tp = index->tileparts + i;
+    if( tp->Psot )
+      {
+      const tilepartresult *res = results + i;
+      memcpy( lengths + n, res->packetlengths, res->npackets * sizeof(uint32_t) );
+      tp->npackets = res->npackets;
+      tp->dataoffset = res->dataoffset;
+      tp->datalength = res->datalength;
+      index->flags |= res->flags;
+      if( res->npph )
+        {
+        memcpy( ranges + index->npphranges, res->pph, res->npph * sizeof(pphrange) );
+        tp->firstpph = index->npphranges;
+        tp->npph = res->npph;
+        tp->pphlength = res->pphlength;
+        index->npphranges += res->npph;
+        }
+      }
+    else
+      memcpy( lengths + n, index->packetlengths + tp->firstpacket, tp->npackets * sizeof(uint32_t) );
+    tp->firstpacket = n;
+    n += tp->npackets;
+    }
+  free( index->packetlengths );
+  index->packetlengths = lengths;
+  index->npacketlengths = n;
+  return true;
+}
+
+bool buildindexparallel( const char *filename, codestreamindex *index, unsigned int nthreads )
+{
+  bool b;
+  unsigned int t;
+  if( !buildheaderindex( filename, index ) ) return false;
+  if( nthreads < 1 ) nthreads = 1;
+  if( nthreads > index->ntileparts ) nthreads = index->ntileparts ? (unsigned int)index->ntileparts : 1;
+
+  results = calloc( index->ntileparts + 1, sizeof(tilepartresult) );
+  pthread_t *threads = calloc( nthreads, sizeof(pthread_t) );
+  b = results && threads;
+  curfilename = filename;
+  curindex = index;
+  nexttilepart = 0;
+  for( t = 0; b && t < nthreads; ++t )
+    if( pthread_create( threads + t, NULL, worker, NULL ) != 0 )
+      {
+      /* the threads already started will do the work */
+      b = t != 0;
+      break;
+      }
+  const unsigned int started = t;
+  for( t = 0; t < started; ++t )
+    pthread_join( threads[t], NULL );
+  b = b && mergeresults( index );
+
+  if( results )
+    for( size_t i = 0; i < index->ntileparts; ++i )
+      {
+      free( results[i].packetlengths );
+      free( results[i].pph );
+      free( results[i].pocs );
+      }
+  free( results );
+  free( threads );
+  results = NULL;
+  curindex = NULL;
+  if( !b ) freeindex( index );
+  return b;
+}
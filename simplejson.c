@@ -0,0 +1,573 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simplejson.h"
+#include "simpleparser.h"
+#include "simpleoutput.h"
+
+#include <assert.h>
+#include <string.h>
+#include <sys/types.h> /* off_t */
+
+#define BPCC 0x62706363
+
+/* parsej2k/parsejp2 callbacks do not take a user pointer */
+static jsonwriter w;
+static FILE *jsonout;
+static uint_fast16_t Csiz;    /* from SIZ, Ccoc and friends depend on it */
+static uint64_t nextbox;      /* top-level boxes are contiguous */
+static uint8_t segment[1 << 16];
+
+static uint_fast16_t get16( const uint8_t *p )
+{
+  return (uint_fast16_t)((p[0] << 8) | p[1]);
+}
+
+static uint_fast32_t get32( const uint8_t *p )
+{
+  return ((uint_fast32_t)p[0] << 24) | ((uint_fast32_t)p[1] << 16)
+    | ((uint_fast32_t)p[2] << 8) | p[3];
+}
+
+static const char *markernames[MARKERSLOTS] = {
+  [MARKERSLOT(SOC)] = "SOC",
+  [MARKERSLOT(CAP)] = "CAP",
+  [MARKERSLOT(SIZ)] = "SIZ",
+  [MARKERSLOT(COD)] = "COD",
+  [MARKERSLOT(COC)] = "COC",
+  [MARKERSLOT(NSI)] = "NSI",
+  [MARKERSLOT(TLM)] = "TLM",
+  [MARKERSLOT(PLM)] = "PLM",
+  [MARKERSLOT(PLT)] = "PLT",
+  [MARKERSLOT(QCD)] = "QCD",
+  [MARKERSLOT(QCC)] = "QCC",
+  [MARKERSLOT(RGN)] = "RGN",
+  [MARKERSLOT(POC)] = "POC",
+  [MARKERSLOT(PPM)] = "PPM",
+  [MARKERSLOT(PPT)] = "PPT",
+  [MARKERSLOT(CRG)] = "CRG",
+  [MARKERSLOT(COM)] = "COM",
+  [MARKERSLOT(DCO)] = "DCO",
+  [MARKERSLOT(MCT)] = "MCT",
+  [MARKERSLOT(MCC)] = "MCC",
+  [MARKERSLOT(NLT)] = "NLT",
+  [MARKERSLOT(MCO)] = "MCO",
+  [MARKERSLOT(CBD)] = "CBD",
+  [MARKERSLOT(ATK)] = "ATK",
+  [MARKERSLOT(SOT)] = "SOT",
+  [MARKERSLOT(SOP)] = "SOP",
+  [MARKERSLOT(EPH)] = "EPH",
+  [MARKERSLOT(SOD)] = "SOD",
+  [MARKERSLOT(EOC)] = "EOC",
+};
+
+static void jsonmarkername( uint_fast16_t marker )
+{
+  const char *name = NULL;
+  if( (marker & 0xff00) == 0xff00 )
+    name = markernames[ MARKERSLOT( marker ) ];
+  if( !name ) name = "unknown";
+  jsonstring( &w, "marker", name, strlen( name ) );
+}
+
+static void jsonfourcc( const char *key, uint_fast32_t type )
+{
+  const char s[4] = { (char)(type >> 24), (char)(type >> 16), (char)(type >> 8), (char)type };
+  jsonstring( &w, key, s, sizeof(s) );
+}
+
+/* SPcod / SPcoc, Table A.15 */
+static void jsoncodingstyle( const uint8_t *p, size_t len, bool precincts )
+{
+  uint_fast8_t i;
+  if( len < 5 ) return;
+  jsonuint( &w, "levels", p[0] );
+  jsonuint( &w, "codeblock_width", 1u << ((p[1] & 0xf) + 2) );
+  jsonuint( &w, "codeblock_height", 1u << ((p[2] & 0xf) + 2) );
+  jsonuint( &w, "codeblock_style", p[3] );
+  jsonuint( &w, "transformation", p[4] );
+  jsonbool( &w, "reversible", p[4] == 1 );
+  if( precincts )
+    {
+    jsonarray( &w, "precincts" );
+    for( i = 0; i <= p[0] && 5u + i < len; ++i )
+      {
+      jsonobject( &w, NULL );
+      jsonuint( &w, "ppx", p[5+i] & 0x0f );
+      jsonuint( &w, "ppy", p[5+i] >> 4 );
+      jsonclose( &w );
+      }
+    jsonclose( &w );
+    }
+}
+
+/* Sqcd / Sqcc and the step sizes that follow, Table A.28 */
+static void jsonquantization( const uint8_t *p, size_t len )
+{
+  static const char *styles[] = { "none", "scalar derived", "scalar expounded" };
+  size_t i;
+  if( len < 1 ) return;
+  const uint8_t style = p[0] & 0x1f;
+  jsonuint( &w, "guard_bits", p[0] >> 5 );
+  jsonuint( &w, "quantization_style", style );
+  if( style < 3 )
+    jsonstring( &w, "quantization", styles[style], strlen( styles[style] ) );
+  jsonarray( &w, "exponents" );
+  if( style == 0 )
+    for( i = 1; i < len; ++i )
+      jsonuint( &w, NULL, p[i] >> 3 );
+  else
+    for( i = 1; i + 1 < len; i += 2 )
+      jsonuint( &w, NULL, get16( p + i ) >> 11 );
+  jsonclose( &w );
+  if( style != 0 )
+    {
+    jsonarray( &w, "mantissas" );
+    for( i = 1; i + 1 < len; i += 2 )
+      jsonuint( &w, NULL, get16( p + i ) & 0x7ff );
+    jsonclose( &w );
+    }
+}
+
+/* component index of COC, QCC, RGN and POC */
+static size_t jsoncomponent( const char *key, const uint8_t *p )
+{
+  if( Csiz < 257 )
+    {
+    jsonuint( &w, key, p[0] );
+    return 1;
+    }
+  jsonuint( &w, key, get16( p ) );
+  return 2;
+}
+
+static void jsonsegment( uint_fast16_t marker, const uint8_t *p, size_t len )
+{
+  size_t i, n;
+  switch( marker )
+    {
+  case SIZ:
+    if( len < 36 ) break;
+    jsonuint( &w, "rsiz", get16( p ) );
+    jsonuint( &w, "xsiz", get32( p + 2 ) );
+    jsonuint( &w, "ysiz", get32( p + 6 ) );
+    jsonuint( &w, "xosiz", get32( p + 10 ) );
+    jsonuint( &w, "yosiz", get32( p + 14 ) );
+    jsonuint( &w, "xtsiz", get32( p + 18 ) );
+    jsonuint( &w, "ytsiz", get32( p + 22 ) );
+    jsonuint( &w, "xtosiz", get32( p + 26 ) );
+    jsonuint( &w, "ytosiz", get32( p + 30 ) );
+    Csiz = get16( p + 34 );
+    jsonarray( &w, "components" );
+    for( i = 0; i < Csiz && 36 + 3 * i + 3 <= len; ++i )
+      {
+      const uint8_t *c = p + 36 + 3 * i;
+      jsonobject( &w, NULL );
+      jsonuint( &w, "precision", (c[0] & 0x7f) + 1u );
+      jsonbool( &w, "signed", c[0] >> 7 );
+      jsonuint( &w, "xrsiz", c[1] );
+      jsonuint( &w, "yrsiz", c[2] );
+      jsonclose( &w );
+      }
+    jsonclose( &w );
+    break;
+  case COD:
+    if( len < 5 ) break;
+    jsonuint( &w, "scod", p[0] );
+    jsonbool( &w, "sop", p[0] & 0x02 );
+    jsonbool( &w, "eph", p[0] & 0x04 );
+    jsonuint( &w, "progression_order", p[1] );
+    jsonuint( &w, "layers", get16( p + 2 ) );
+    jsonuint( &w, "mct", p[4] );
+    jsoncodingstyle( p + 5, len - 5, p[0] & 0x01 );
+    break;
+  case COC:
+    if( len < 2 ) break;
+    n = jsoncomponent( "component", p );
+    if( len < n + 1 ) break;
+    jsonuint( &w, "scoc", p[n] );
+    jsoncodingstyle( p + n + 1, len - n - 1, p[n] & 0x01 );
+    break;
+  case QCD:
+    jsonquantization( p, len );
+    break;
+  case QCC:
+    if( len < 2 ) break;
+    n = jsoncomponent( "component", p );
+    jsonquantization( p + n, len - n );
+    break;
+  case RGN:
+    if( len < 3 ) break;
+    n = jsoncomponent( "component", p );
+    if( len < n + 2 ) break;
+    jsonuint( &w, "srgn", p[n] );
+    jsonuint( &w, "sprgn", p[n+1] );
+    break;
+  case POC:
+    n = Csiz < 257 ? 7 : 9;
+    jsonarray( &w, "progressions" );
+    for( i = 0; i + n <= len; i += n )
+      {
+      const uint8_t *c = p + i;
+      size_t k = 1;
+      jsonobject( &w, NULL );
+      jsonuint( &w, "rspoc", c[0] );
+      k += jsoncomponent( "cspoc", c + k );
+      jsonuint( &w, "lyepoc", get16( c + k ) );
+      k += 2;
+      jsonuint( &w, "repoc", c[k++] );
+      k += jsoncomponent( "cepoc", c + k );
+      jsonuint( &w, "ppoc", c[k] );
+      jsonclose( &w );
+      }
+    jsonclose( &w );
+    break;
+  case SOT:
+    if( len < 8 ) break;
+    jsonuint( &w, "isot", get16( p ) );
+    jsonuint( &w, "psot", get32( p + 2 ) );
+    jsonuint( &w, "tpsot", p[6] );
+    jsonuint( &w, "tnsot", p[7] );
+    break;
+  case TLM:
+    {
+    if( len < 2 ) break;
+    const unsigned int ST = (p[1] >> 4) & 0x3;
+    const unsigned int SP = (p[1] >> 6) & 0x1;
+    const size_t entry = ST + (SP ? 4 : 2);
+    jsonuint( &w, "ztlm", p[0] );
+    jsonuint( &w, "st", ST );
+    jsonuint( &w, "sp", SP );
+    if( ST )
+      {
+      jsonarray( &w, "ttlm" );
+      for( i = 2; i + entry <= len; i += entry )
+        jsonuint( &w, NULL, ST == 1 ? p[i] : get16( p + i ) );
+      jsonclose( &w );
+      }
+    jsonarray( &w, "ptlm" );
+    for( i = 2; i + entry <= len; i += entry )
+      jsonuint( &w, NULL, SP ? get32( p + i + ST ) : get16( p + i + ST ) );
+    jsonclose( &w );
+    }
+    break;
+  case PLT:
+    {
+    uint_fast32_t packet = 0;
+    if( len < 1 ) break;
+    jsonuint( &w, "zplt", p[0] );
+    jsonarray( &w, "lengths" );
+    for( i = 1; i < len; ++i )
+      {
+      packet = (packet << 7) | (p[i] & 0x7f);
+      if( !(p[i] & 0x80) )
+        {
+        jsonuint( &w, NULL, packet );
+        packet = 0;
+        }
+      }
+    jsonclose( &w );
+    /* a packet length may continue in the next PLT */
+    jsonbool( &w, "continued", len > 1 && (p[len-1] & 0x80) );
+    }
+    break;
+  case PLM:
+  case PPM:
+  case PPT:
+    if( len < 1 ) break;
+    jsonuint( &w, marker == PLM ? "zplm" : marker == PPM ? "zppm" : "zppt", p[0] );
+    jsonuint( &w, "data_length", len - 1 );
+    break;
+  case CRG:
+    jsonarray( &w, "xcrg" );
+    for( i = 0; i + 4 <= len; i += 4 )
+      jsonuint( &w, NULL, get16( p + i ) );
+    jsonclose( &w );
+    jsonarray( &w, "ycrg" );
+    for( i = 0; i + 4 <= len; i += 4 )
+      jsonuint( &w, NULL, get16( p + i + 2 ) );
+    jsonclose( &w );
+    break;
+  case CAP:
+    if( len < 4 ) break;
+    jsonuint( &w, "pcap", get32( p ) );
+    jsonarray( &w, "ccap" );
+    for( i = 4; i + 2 <= len; i += 2 )
+      jsonuint( &w, NULL, get16( p + i ) );
+    jsonclose( &w );
+    break;
+  case COM:
+    if( len < 2 ) break;
+    jsonuint( &w, "rcom", get16( p ) );
+    if( get16( p ) == 1 ) /* Latin-1 text */
+      jsonstring( &w, "text", (const char*)p + 2, len - 2 );
+    else
+      jsonuint( &w, "data_length", len - 2 );
+    break;
+    }
+}
+
+static bool jsonj2k( uint_fast16_t marker, size_t len, FILE *stream )
+{
+  const bool nolength = hasnolength( marker );
+  const off_t offset = ftello( stream ) - (nolength ? 2 : 4);
+  jsonbegin( &w, jsonout );
+  jsonuint( &w, "offset", (uintmax_t)offset );
+  jsonmarkername( marker );
+  jsonuint( &w, "code", marker );
+  if( nolength )
+    {
+    if( marker == SOD )
+      jsonuint( &w, "data_length", len );
+    jsonend( &w );
+    return true;
+    }
+  jsonuint( &w, "length", len + 2 );
+  if( fread( segment, 1, len, stream ) != len )
+    {
+    jsonbool( &w, "truncated", true );
+    jsonend( &w );
+    return false;
+    }
+  jsonsegment( marker, segment, len );
+  jsonend( &w );
+  return false;
+}
+
+static void jsonbox( uint_fast32_t type, const uint8_t *p, size_t len )
+{
+  size_t i;
+  switch( type )
+    {
+  case FTYP:
+    if( len < 8 ) break;
+    jsonfourcc( "brand", get32( p ) );
+    jsonuint( &w, "minor_version", get32( p + 4 ) );
+    jsonarray( &w, "compatibility" );
+    for( i = 8; i + 4 <= len; i += 4 )
+      jsonfourcc( NULL, get32( p + i ) );
+    jsonclose( &w );
+    break;
+  case IHDR:
+    if( len < 14 ) break;
+    jsonuint( &w, "height", get32( p ) );
+    jsonuint( &w, "width", get32( p + 4 ) );
+    jsonuint( &w, "nc", get16( p + 8 ) );
+    jsonuint( &w, "bpc", p[10] );
+    jsonuint( &w, "c", p[11] );
+    jsonuint( &w, "unkc", p[12] );
+    jsonuint( &w, "ipr", p[13] );
+    break;
+  case BPCC:
+    jsonarray( &w, "bpc" );
+    for( i = 0; i < len; ++i )
+      jsonuint( &w, NULL, p[i] );
+    jsonclose( &w );
+    break;
+  case COLR:
+    if( len < 3 ) break;
+    jsonuint( &w, "meth", p[0] );
+    jsonuint( &w, "prec", p[1] );
+    jsonuint( &w, "approx", p[2] );
+    if( p[0] == 1 && len >= 7 )
+      jsonuint( &w, "enumcs", get32( p + 3 ) );
+    else
+      jsonuint( &w, "profile_length", len - 3 );
+    break;
+  case CDEF:
+    jsonarray( &w, "channels" );
+    for( i = 2; i + 6 <= len; i += 6 )
+      {
+      jsonobject( &w, NULL );
+      jsonuint( &w, "cn", get16( p + i ) );
+      jsonuint( &w, "typ", get16( p + i + 2 ) );
+      jsonuint( &w, "asoc", get16( p + i + 4 ) );
+      jsonclose( &w );
+      }
+    jsonclose( &w );
+    break;
+  case CMAP:
+    jsonarray( &w, "channels" );
+    for( i = 0; i + 4 <= len; i += 4 )
+      {
+      jsonobject( &w, NULL );
+      jsonuint( &w, "cmp", get16( p + i ) );
+      jsonuint( &w, "mtyp", p[i+2] );
+      jsonuint( &w, "pcol", p[i+3] );
+      jsonclose( &w );
+      }
+    jsonclose( &w );
+    break;
+  case PCLR:
+    if( len < 3 ) break;
+    jsonuint( &w, "ne", get16( p ) );
+    jsonuint( &w, "npc", p[2] );
+    break;
+  case RESC:
+  case RESD:
+    if( len < 10 ) break;
+    jsonuint( &w, "vrn", get16( p ) );
+    jsonuint( &w, "vrd", get16( p + 2 ) );
+    jsonuint( &w, "hrn", get16( p + 4 ) );
+    jsonuint( &w, "hrd", get16( p + 6 ) );
+    jsonuint( &w, "vre", p[8] );
+    jsonuint( &w, "hre", p[9] );
+    break;
+  case UUID:
+    {
+    static const char xdigits[] = "0123456789abcdef";
+    char uuid[32];
+    if( len < 16 ) break;
+    for( i = 0; i < 16; ++i )
+      {
+      uuid[2*i] = xdigits[p[i] >> 4];
+      uuid[2*i+1] = xdigits[p[i] & 0xf];
+      }
+    jsonstring( &w, "uuid", uuid, sizeof(uuid) );
+    jsonuint( &w, "data_length", len - 16 );
+    }
+    break;
+  case URL:
+    if( len < 4 ) break;
+    jsonuint( &w, "version", p[0] );
+    jsonuint( &w, "flags", ((uint_fast32_t)p[1] << 16) | (p[2] << 8) | p[3] );
+    jsonstring( &w, "location", (const char*)p + 4, strnlen( (const char*)p + 4, len - 4 ) );
+    break;
+    }
+}
+
+static bool issuperbox( uint_fast32_t type )
+{
+  return type == JP2H || type == RES || type == UINF || type == ASOC
+    || type == JPCH || type == JPLH;
+}
+
+/* one record for the box at `offset` whose payload is at the current
+ * position, then its children for a super box. Return false when the
+ * payload was neither read nor skipped (the caller skips it) */
+static bool jsonboxrecord( uint_fast32_t type, uint64_t offset, uint64_t length,
+  uint64_t payload, uint_fast32_t parent, FILE *stream );
+
+static bool jsonchildren( FILE *stream, uint64_t begin, uint64_t end, uint_fast32_t parent )
+{
+  uint64_t offset = begin;
+  while( offset + 8 <= end )
+    {
+    uint8_t header[16];
+    if( fseeko( stream, (off_t)offset, SEEK_SET ) != 0
+      || fread( header, 1, 8, stream ) != 8 ) return false;
+    uint64_t length = get32( header );
+    const uint_fast32_t type = get32( header + 4 );
+    uint64_t payload = offset + 8;
+    if( length == 1 )
+      {
+      if( fread( header + 8, 1, 8, stream ) != 8 ) return false;
+      length = ((uint64_t)get32( header + 8 ) << 32) | get32( header + 12 );
+      payload += 8;
+      }
+    else if( length == 0 )
+      length = end - offset;
+    if( length < payload - offset || offset + length > end ) return false;
+    if( !jsonboxrecord( type, offset, length, payload, parent, stream ) ) return false;
+    offset += length;
+    }
+  return fseeko( stream, (off_t)end, SEEK_SET ) == 0;
+}
+
+static bool jsonboxrecord( uint_fast32_t type, uint64_t offset, uint64_t length,
+  uint64_t payload, uint_fast32_t parent, FILE *stream )
+{
+  const uint64_t datalength = length - (payload - offset);
+  jsonbegin( &w, jsonout );
+  jsonuint( &w, "offset", offset );
+  jsonfourcc( "box", type );
+  jsonuint( &w, "length", length );
+  if( parent )
+    jsonfourcc( "parent", parent );
+  if( issuperbox( type ) )
+    {
+    jsonend( &w );
+    return jsonchildren( stream, payload, payload + datalength, type );
+    }
+  if( datalength <= sizeof(segment) )
+    {
+    if( fread( segment, 1, (size_t)datalength, stream ) != datalength )
+      {
+      jsonbool( &w, "truncated", true );
+      jsonend( &w );
+      return false;
+      }
+    jsonbox( type, segment, (size_t)datalength );
+    }
+  jsonend( &w );
+  return fseeko( stream, (off_t)(payload + datalength), SEEK_SET ) == 0;
+}
+
+static bool jsonjp2( uint_fast32_t type, size_t len, FILE *stream )
+{
+  const uint64_t payload = (uint64_t)ftello( stream );
+  const uint64_t offset = nextbox;
+  /* len is the box length without XLBox */
+  const uint64_t length = payload - offset + len - 8;
+  nextbox = offset + length;
+  if( type == JP2C )
+    {
+    jsonbegin( &w, jsonout );
+    jsonuint( &w, "offset", offset );
+    jsonfourcc( "box", type );
+    jsonuint( &w, "length", length );
+    jsonend( &w );
+    return true; /* walk the codestream */
+    }
+  if( !jsonboxrecord( type, offset, length, payload, 0, stream ) )
+    {
+    /* leave the stream where parsejp2 expects it */
+    (void)fseeko( stream, (off_t)(payload + len - 8), SEEK_SET );
+    }
+  return false;
+}
+
+bool dumpjson( const char *filename, FILE *out )
+{
+  jsonout = out;
+  Csiz = 0;
+  nextbox = 0;
+  if( isjp2file( filename ) )
+    return parsejp2( filename, jsonjp2, jsonj2k );
+  return parsej2k( filename, jsonj2k );
+}
+
+bool takejsonoption( int *argc, char **argv[] )
+{
+  if( *argc > 1 && strcmp( (*argv)[1], "--json" ) == 0 )
+    {
+    (*argv)[1] = (*argv)[0];
+    --*argc;
+    ++*argv;
+    return true;
+    }
+  return false;
+}
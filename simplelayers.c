@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simplelayers.h"
+#include "simpleregion.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/*
+ * Packets are first summed up per layer: last end, first offset and total
+ * length of the packets of exactly that layer. Prefix maximums and sums then
+ * give the end and size of each truncation point, a suffix minimum tells
+ * whether a packet of a higher layer shows up before it.
+ */
+typedef struct
+{
+  uint64_t end;
+  uint64_t first;
+  uint64_t bytes;
+} layerstats;
+
+static void resetstats( layerstats *s, uint16_t nlayers )
+{
+  for( uint16_t l = 0; l < nlayers; ++l )
+    {
+    s[l].end = 0;
+    s[l].first = UINT64_MAX;
+    s[l].bytes = 0;
+    }
+}
+
+static void accumulate( const layerstats *s, uint16_t nlayers, uint64_t start, layerend *ends )
+{
+  uint64_t end = start, bytes = 0, first = UINT64_MAX;
+  for( uint16_t l = 0; l < nlayers; ++l )
+    {
+    if( s[l].end > end ) end = s[l].end;
+    bytes += s[l].bytes;
+    ends[l].end = end;
+    ends[l].bytes = bytes;
+    }
+  for( uint16_t l = nlayers; l-- > 0; )
+    {
+    ends[l].exact = first >= ends[l].end;
+    if( s[l].first < first ) first = s[l].first;
+    }
+}
+
+bool buildlayertable( FILE *in, const codestreamindex *index, layertable *table )
+{
+  memset( table, 0, sizeof(*table) );
+  table->nlayers = index->NumberOfLayers;
+  table->ntiles = getnumberoftiles( index );
+  const uint16_t nlayers = table->nlayers;
+  table->tiles = calloc( (size_t)table->ntiles * nlayers + 1, sizeof(layerend) );
+  table->file = calloc( (size_t)nlayers + 1, sizeof(layerend) );
+  layerstats *tile = malloc( ((size_t)nlayers + 1) * sizeof(layerstats) );
+  layerstats *file = malloc( ((size_t)nlayers + 1) * sizeof(layerstats) );
+  size_t *first = NULL, *tileparts = NULL;
+  bool ok = table->tiles && table->file && tile && file
+    && grouptileparts( index, &first, &tileparts );
+  if( ok ) resetstats( file, nlayers );
+
+  tilepacketlist packets;
+  memset( &packets, 0, sizeof(packets) );
+  for( uint32_t t = 0; ok && t < table->ntiles; ++t )
+    {
+    const size_t n = first[t + 1] - first[t];
+    packets.npackets = 0;
+    ok = gettilepartpackets( in, index, t, tileparts + first[t], n, &packets );
+    resetstats( tile, nlayers );
+    for( size_t k = 0; ok && k < packets.npackets; ++k )
+      {
+      const tilepacket *p = packets.packets + k;
+      assert( p->id.layer < nlayers );
+      layerstats *s = tile + p->id.layer;
+      if( p->offset + p->length > s->end ) s->end = p->offset + p->length;
+      if( p->offset < s->first ) s->first = p->offset;
+      s->bytes += p->length;
+      }
+    const uint64_t start = n ? index->tileparts[ tileparts[ first[t] ] ].dataoffset : 0;
+    layerend *ends = table->tiles + (size_t)t * nlayers;
+    accumulate( tile, nlayers, start, ends );
+    for( uint16_t l = 0; l < nlayers; ++l )
+      {
+      if( ends[l].end > file[l].end ) file[l].end = ends[l].end;
+      if( tile[l].first < file[l].first ) file[l].first = tile[l].first;
+      file[l].bytes += tile[l].bytes;
+      }
+    }
+  if( ok ) accumulate( file, nlayers, index->mainheaderend, table->file );
+
+  freetilepacketlist( &packets );
+  free( tileparts );
+  free( first );
+  free( tile );
+  free( file );
+  if( !ok ) freelayertable( table );
+  return ok;
+}
+
+void freelayertable( layertable *table )
+{
+  free( table->tiles );
+  free( table->file );
+  memset( table, 0, sizeof(*table) );
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simplelayers_h
+#define simplelayers_h
+
+#include "simpleindex.h"
+
+#include <stdio.h>
+
+/*
+ * Quality layer truncation points: where the packets of a layer and of the
+ * layers below end, per tile and over the whole file. In a layer
+ * progressive codestream (LRCP, or tile-parts split by layer) the first
+ * `end` bytes of the file hold exactly the first layers, so one range
+ * request fetches the prefix meeting a bitrate budget.
+ */
+
+typedef struct
+{
+  uint64_t end;   /* absolute position right after the last packet of this layer or a lower one */
+  uint64_t bytes; /* sum of the lengths of these packets */
+  bool     exact; /* no packet of a higher layer comes before `end` */
+} layerend;
+
+typedef struct
+{
+  uint16_t nlayers;
+  uint32_t ntiles;
+  layerend *tiles; /* ntiles x nlayers, tile after tile */
+  layerend *file;  /* nlayers */
+} layertable;
+
+/**
+ * Fill `table` from the packet lengths (PLT, or else the packet headers)
+ * and the progression order of each tile. A tile without any packet up to
+ * a layer ends at the end of its first tile-part header (0 when missing).
+ * Return false when the packet order of a tile cannot be derived
+ */
+bool buildlayertable( FILE *in, const codestreamindex *index, layertable *table );
+
+/**
+ * Release memory
+ */
+void freelayertable( layertable *table );
+
+#endif
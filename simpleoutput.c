@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* fwrite_unlocked */
+#endif
+
+#include "simpleoutput.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#define writeout fwrite_unlocked
+#else
+#define writeout fwrite
+#endif
+
+#define OUTPUTBUFFERSIZE (1 << 20)
+#define MAXINDENT 64
+
+static char outputbuffer[OUTPUTBUFFERSIZE];
+
+static const char spaces[MAXINDENT+1] =
+  "                                                                ";
+
+void setoutputbuffer( FILE *out )
+{
+  setvbuf( out, outputbuffer, _IOFBF, sizeof(outputbuffer) );
+}
+
+void printindent( FILE *out, unsigned int indent )
+{
+  while( indent > MAXINDENT )
+    {
+    writeout( spaces, 1, MAXINDENT, out );
+    indent -= MAXINDENT;
+    }
+  writeout( spaces, 1, indent, out );
+}
+
+void printstr( FILE *out, const char *s )
+{
+  writeout( s, 1, strlen( s ), out );
+}
+
+/* digits are written from the end of `buffer`, return the first one */
+static char *formatdec( char *end, uintmax_t value )
+{
+  char *p = end;
+  do
+    {
+    *--p = (char)('0' + value % 10);
+    value /= 10;
+    } while( value );
+  return p;
+}
+
+void printdec( FILE *out, uintmax_t value, int width )
+{
+  char buffer[20];
+  char *end = buffer + sizeof(buffer);
+  char *p = formatdec( end, value );
+  const unsigned int n = (unsigned int)(end - p);
+  if( width > 0 && (unsigned int)width > n )
+    printindent( out, (unsigned int)width - n );
+  writeout( p, 1, n, out );
+  if( width < 0 && (unsigned int)-width > n )
+    printindent( out, (unsigned int)-width - n );
+}
+
+void printhex( FILE *out, uintmax_t value, unsigned int digits, bool upper )
+{
+  const char *xdigits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  char buffer[16];
+  char *end = buffer + sizeof(buffer);
+  char *p = end;
+  do
+    {
+    *--p = xdigits[value & 0xf];
+    value >>= 4;
+    } while( value );
+  while( (unsigned int)(end - p) < digits && p != buffer )
+    *--p = '0';
+  writeout( p, 1, (size_t)(end - p), out );
+}
+
+static void jsonseparator( jsonwriter *w, const char *key )
+{
+  if( !w->first[w->depth] )
+    writeout( ",", 1, 1, w->out );
+  w->first[w->depth] = false;
+  if( key )
+    {
+    writeout( "\"", 1, 1, w->out );
+    printstr( w->out, key );
+    writeout( "\":", 1, 2, w->out );
+    }
+}
+
+static void jsonopen( jsonwriter *w, const char *key, char opener, char closer )
+{
+  jsonseparator( w, key );
+  writeout( &opener, 1, 1, w->out );
+  assert( w->depth + 1 < JSONMAXDEPTH );
+  ++w->depth;
+  w->first[w->depth] = true;
+  w->closer[w->depth] = closer;
+}
+
+void jsonbegin( jsonwriter *w, FILE *out )
+{
+  w->out = out;
+  w->depth = 0;
+  w->first[0] = true;
+  jsonopen( w, NULL, '{', '}' );
+}
+
+void jsonend( jsonwriter *w )
+{
+  assert( w->depth == 1 );
+  jsonclose( w );
+  writeout( "\n", 1, 1, w->out );
+}
+
+void jsonobject( jsonwriter *w, const char *key )
+{
+  jsonopen( w, key, '{', '}' );
+}
+
+void jsonarray( jsonwriter *w, const char *key )
+{
+  jsonopen( w, key, '[', ']' );
+}
+
+void jsonclose( jsonwriter *w )
+{
+  assert( w->depth > 0 );
+  writeout( &w->closer[w->depth], 1, 1, w->out );
+  --w->depth;
+}
+
+void jsonuint( jsonwriter *w, const char *key, uintmax_t value )
+{
+  jsonseparator( w, key );
+  printdec( w->out, value, 0 );
+}
+
+void jsonbool( jsonwriter *w, const char *key, bool value )
+{
+  jsonseparator( w, key );
+  printstr( w->out, value ? "true" : "false" );
+}
+
+void jsonstring( jsonwriter *w, const char *key, const char *s, size_t len )
+{
+  const char *p = s;
+  const char *end = s + len;
+  jsonseparator( w, key );
+  writeout( "\"", 1, 1, w->out );
+  /* copy runs of plain characters, escape the others */
+  while( p != end )
+    {
+    const char *run = p;
+    while( p != end && (unsigned char)*p >= 0x20 && *p != '"' && *p != '\\' && (unsigned char)*p < 0x7f )
+      ++p;
+    writeout( run, 1, (size_t)(p - run), w->out );
+    if( p == end ) break;
+    if( *p == '"' || *p == '\\' )
+      {
+      char escaped[2] = { '\\', *p };
+      writeout( escaped, 1, 2, w->out );
+      }
+    else
+      {
+      /* control characters and bytes outside ASCII, read as Latin-1 */
+      printstr( w->out, "\\u00" );
+      printhex( w->out, (unsigned char)*p, 2, false );
+      }
+    ++p;
+    }
+  writeout( "\"", 1, 1, w->out );
+}
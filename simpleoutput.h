@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simpleoutput_h
+#define simpleoutput_h
+
+#include <stdint.h>
+#include <stdlib.h> /* size_t */
+#include <stdbool.h>
+#include <stdio.h> /* FILE */
+
+/**
+ * Text output helpers for the dumpers: on a file with millions of markers
+ * the cost is in printf parsing its format, not in writing the bytes
+ */
+
+/**
+ * Give `out` a large buffer, call before anything is written to it
+ */
+void setoutputbuffer( FILE *out );
+
+/**
+ * Write `indent` spaces (same as "%*s" with an empty string)
+ */
+void printindent( FILE *out, unsigned int indent );
+
+/**
+ * Write a string as is
+ */
+void printstr( FILE *out, const char *s );
+
+/**
+ * Decimal value, padded with spaces to `width` characters: right aligned
+ * like "%*ju", left aligned like "%-*ju" when `width` is negative
+ */
+void printdec( FILE *out, uintmax_t value, int width );
+
+/**
+ * Hexadecimal value, zero padded to `digits` like "%0*jx" (or "%0*jX")
+ */
+void printhex( FILE *out, uintmax_t value, unsigned int digits, bool upper );
+
+/**
+ * Streaming JSON writer: values go straight to the FILE, nothing is built in
+ * memory. Keys are written as is (callers pass plain identifiers), strings
+ * values are escaped.
+ */
+#define JSONMAXDEPTH 16
+
+typedef struct
+{
+  FILE *out;
+  unsigned int depth;
+  bool first[JSONMAXDEPTH];   /* no value written yet at that depth */
+  char closer[JSONMAXDEPTH];  /* '}' or ']' */
+} jsonwriter;
+
+/* open the top-level object of a record */
+void jsonbegin( jsonwriter *w, FILE *out );
+/* close the top-level object, one record per line */
+void jsonend( jsonwriter *w );
+
+/* `key` is NULL for the elements of an array */
+void jsonobject( jsonwriter *w, const char *key );
+void jsonarray( jsonwriter *w, const char *key );
+void jsonclose( jsonwriter *w ); /* last object or array */
+
+void jsonuint( jsonwriter *w, const char *key, uintmax_t value );
+void jsonbool( jsonwriter *w, const char *key, bool value );
+void jsonstring( jsonwriter *w, const char *key, const char *s, size_t len );
+
+#endif
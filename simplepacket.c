@@ -0,0 +1,605 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simplepacket.h"
+#include "simpleprogression.h"
+#include "simplegeometry.h"
+#include "simpleparser.h"
+
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h> /* off_t */
+
+/* Table A.19 - Code-block style for the SPcod and SPcoc parameters */
+#define STYLE_BYPASS  0x01
+#define STYLE_RESTART 0x04 /* termination on each coding pass */
+
+/* a stream made of ranges of the file: tile-part data or packed packet headers */
+typedef struct
+{
+  FILE *in;
+  const pphrange *ranges;
+  size_t nranges;
+  size_t cur;        /* current range */
+  uint64_t pos;      /* position in the current range */
+  uint64_t consumed; /* bytes read or skipped so far */
+  uint8_t buffer[4096];
+  size_t bufcur;     /* buffer holds [bufstart, bufstart + buflen) of ranges[bufcur] */
+  uint64_t bufstart;
+  size_t buflen;
+} rangestream;
+
+static void initstream( rangestream *s, FILE *in, const pphrange *ranges, size_t n )
+{
+  s->in = in;
+  s->ranges = ranges;
+  s->nranges = n;
+  s->cur = 0;
+  s->pos = 0;
+  s->consumed = 0;
+  s->bufcur = 0;
+  s->bufstart = 0;
+  s->buflen = 0;
+}
+
+/* move to the next range when the current one is done, return false at the end */
+static bool normalize( rangestream *s )
+{
+  while( s->cur < s->nranges && s->pos == s->ranges[s->cur].length )
+    {
+    ++s->cur;
+    s->pos = 0;
+    }
+  return s->cur < s->nranges;
+}
+
+static bool readbyte( rangestream *s, uint8_t *v )
+{
+  if( !normalize( s ) ) return false;
+  if( s->bufcur != s->cur || s->pos < s->bufstart || s->pos >= s->bufstart + s->buflen )
+    {
+    const pphrange *r = s->ranges + s->cur;
+    const uint64_t left = r->length - s->pos;
+    const size_t n = left < sizeof(s->buffer) ? (size_t)left : sizeof(s->buffer);
+    if( fseeko( s->in, (off_t)(r->offset + s->pos), SEEK_SET ) != 0 ) return false;
+    if( fread( s->buffer, 1, n, s->in ) != n ) return false;
+    s->bufcur = s->cur;
+    s->bufstart = s->pos;
+    s->buflen = n;
+    }
+  *v = s->buffer[ s->pos - s->bufstart ];
+  ++s->pos;
+  ++s->consumed;
+  return true;
+}
+
+static bool skipbytes( rangestream *s, uint64_t n )
+{
+  while( n )
+    {
+    if( !normalize( s ) ) return false;
+    const uint64_t left = s->ranges[s->cur].length - s->pos;
+    const uint64_t k = left < n ? left : n;
+    s->pos += k;
+    s->consumed += k;
+    n -= k;
+    }
+  return true;
+}
+
+/* absolute file position of the next byte */
+static uint64_t tell( rangestream *s )
+{
+  if( !normalize( s ) )
+    return s->nranges ? s->ranges[s->nranges - 1].offset + s->ranges[s->nranges - 1].length : 0;
+  return s->ranges[s->cur].offset + s->pos;
+}
+
+/* B.10.1 Bit-stuffing routine: a byte following 0xFF only holds 7 bits */
+typedef struct
+{
+  rangestream *s;
+  uint8_t byte;
+  unsigned int bits; /* left in `byte` */
+  bool ok;
+} bitreader;
+
+static unsigned int readbit( bitreader *b )
+{
+  if( !b->bits )
+    {
+    const bool stuffed = b->byte == 0xff;
+    if( !readbyte( b->s, &b->byte ) )
+      {
+      b->ok = false;
+      b->byte = 0;
+      return 0;
+      }
+    b->bits = stuffed ? 7 : 8;
+    }
+  --b->bits;
+  return (b->byte >> b->bits) & 1;
+}
+
+static uint64_t readbits( bitreader *b, unsigned int n )
+{
+  uint64_t v = 0;
+  while( n-- )
+    v = (v << 1) | readbit( b );
+  return v;
+}
+
+/* end of the packet header: a 0xFF last byte is followed by a stuffed byte */
+static void alignbits( bitreader *b )
+{
+  if( b->byte == 0xff )
+    {
+    uint8_t v;
+    if( !readbyte( b->s, &v ) ) b->ok = false;
+    }
+  b->byte = 0;
+  b->bits = 0;
+}
+
+/* B.10.2 Tag trees, a node value is unknown until decoded */
+typedef struct
+{
+  uint32_t value;
+  uint32_t low;
+} tagnode;
+
+#define TAGUNKNOWN UINT32_MAX
+
+static size_t getnumberoftagnodes( uint32_t w, uint32_t h )
+{
+  size_t n = 0;
+  for( ;; )
+    {
+    n += (size_t)w * h;
+    if( w <= 1 && h <= 1 ) break;
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    }
+  return n;
+}
+
+/* decode leaf (x,y) up to `threshold`, return whether its value is below it */
+static bool decodetagtree( bitreader *b, tagnode *nodes, uint32_t w, uint32_t h,
+  uint32_t x, uint32_t y, uint32_t threshold )
+{
+  size_t offsets[33];
+  uint32_t widths[33];
+  unsigned int nlevels = 0;
+  size_t offset = 0;
+  for( ;; )
+    {
+    offsets[nlevels] = offset;
+    widths[nlevels] = w;
+    ++nlevels;
+    offset += (size_t)w * h;
+    if( w <= 1 && h <= 1 ) break;
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    }
+  uint32_t low = 0;
+  tagnode *node = NULL;
+  for( unsigned int k = nlevels; k-- > 0; )
+    {
+    node = nodes + offsets[k] + (size_t)(y >> k) * widths[k] + (x >> k);
+    if( low > node->low )
+      node->low = low;
+    else
+      low = node->low;
+    while( low < threshold && low < node->value )
+      {
+      if( readbit( b ) )
+        node->value = low;
+      else
+        ++low;
+      }
+    node->low = low;
+    }
+  return node->value < threshold;
+}
+
+/* Table B.4 - Codewords for the number of coding passes for each code-block */
+static uint32_t decodepasses( bitreader *b )
+{
+  uint32_t n;
+  if( !readbit( b ) ) return 1;
+  if( !readbit( b ) ) return 2;
+  n = (uint32_t)readbits( b, 2 );
+  if( n != 3 ) return 3 + n;
+  n = (uint32_t)readbits( b, 5 );
+  if( n != 31 ) return 6 + n;
+  return 37 + (uint32_t)readbits( b, 7 );
+}
+
+/* D.4.1 / D.6: pass index right after the codeword segment holding pass `done` */
+static uint32_t segmentend( uint8_t style, uint32_t done )
+{
+  if( style & STYLE_RESTART ) return done + 1;
+  if( style & STYLE_BYPASS )
+    {
+    /* 4 bit-planes with the arithmetic coder, then raw significance and
+     * refinement passes, arithmetic cleanup pass */
+    if( done < 10 ) return 10;
+    const uint32_t k = (done - 10) % 3;
+    return done + (k < 2 ? 2 - k : 1);
+    }
+  return UINT32_MAX;
+}
+
+static unsigned int floorlog2( uint32_t v )
+{
+  unsigned int n = 0;
+  while( v >>= 1 ) ++n;
+  return n;
+}
+
+/* code-blocks of one subband inside one precinct */
+typedef struct
+{
+  uint8_t band;
+  uint32_t cbx0; /* first code-block index in the subband */
+  uint32_t cby0;
+  uint32_t w;    /* code-blocks wide, high */
+  uint32_t h;
+  size_t firstcb;   /* in tiledecoder::codeblocks */
+  size_t firstnode; /* in tiledecoder::inclusion and ::zerobitplanes */
+} precinctband;
+
+typedef struct
+{
+  size_t firstband; /* in tiledecoder::bands */
+  uint8_t nbands;
+} precinctinfo;
+
+typedef struct
+{
+  uint32_t lblock;
+  uint32_t passes;
+  bool included;
+} codeblockstate;
+
+typedef struct
+{
+  tilegeometry geometry;
+  precinctinfo *precincts; /* as numbered by the geometry */
+  precinctband *bands;
+  size_t nbands;
+  codeblockstate *codeblocks;
+  size_t ncodeblocks;
+  tagnode *inclusion;
+  tagnode *zerobitplanes;
+  size_t nnodes;
+} tiledecoder;
+
+static void freetiledecoder( tiledecoder *d )
+{
+  freetilegeometry( &d->geometry );
+  free( d->precincts );
+  free( d->bands );
+  free( d->codeblocks );
+  free( d->inclusion );
+  free( d->zerobitplanes );
+  memset( d, 0, sizeof(*d) );
+}
+
+/*
+ * The code-blocks each precinct holds in each subband (B.7), and their
+ * decoding state. Done twice, the first pass only counts.
+ */
+static bool buildtiledecoder( const codestreamindex *index, uint32_t tile, tiledecoder *d )
+{
+  memset( d, 0, sizeof(*d) );
+  if( !buildtilegeometry( index, tile, &d->geometry ) ) return false;
+  const tilegeometry *g = &d->geometry;
+  d->precincts = malloc( (g->nprecincts + 1) * sizeof(precinctinfo) );
+  if( !d->precincts ) return false;
+  for( int pass = 0; pass < 2; ++pass )
+    {
+    size_t nbands = 0, ncodeblocks = 0, nnodes = 0;
+    for( uint16_t c = 0; c < index->Csiz; ++c )
+      for( uint8_t r = 0; r <= index->components[c].cs.NumberOfDecompositionLevels; ++r )
+        {
+        const resolutiongeometry *rg = getresolutiongeometry( g, c, r );
+        for( uint32_t k = 0; k < rg->wide * rg->high; ++k )
+          {
+          if( pass )
+            {
+            precinctinfo *pi = d->precincts + rg->firstprecinct + k;
+            pi->firstband = nbands;
+            pi->nbands = rg->nbands;
+            }
+          for( uint8_t b = 0; b < rg->nbands; ++b )
+            {
+            rectangle cb;
+            getprecinctcodeblocks( rg, k, b, &cb );
+            const uint64_t w = cb.x1 - cb.x0;
+            const uint64_t h = cb.y1 - cb.y0;
+            if( w * h > UINT32_MAX || cb.x1 > UINT32_MAX || cb.y1 > UINT32_MAX ) return false;
+            if( pass )
+              {
+              precinctband *pb = d->bands + nbands;
+              pb->band = rg->bands[b].band;
+              pb->cbx0 = (uint32_t)cb.x0;
+              pb->cby0 = (uint32_t)cb.y0;
+              pb->w = (uint32_t)w;
+              pb->h = (uint32_t)h;
+              pb->firstcb = ncodeblocks;
+              pb->firstnode = nnodes;
+              }
+            ++nbands;
+            ncodeblocks += (size_t)(w * h);
+            if( w && h ) nnodes += getnumberoftagnodes( (uint32_t)w, (uint32_t)h );
+            }
+          }
+        }
+    if( !pass )
+      {
+      d->bands = malloc( (nbands + 1) * sizeof(precinctband) );
+      d->codeblocks = malloc( (ncodeblocks + 1) * sizeof(codeblockstate) );
+      d->inclusion = malloc( (nnodes + 1) * sizeof(tagnode) );
+      d->zerobitplanes = malloc( (nnodes + 1) * sizeof(tagnode) );
+      if( !d->bands || !d->codeblocks || !d->inclusion || !d->zerobitplanes )
+        return false;
+      }
+    d->nbands = nbands;
+    d->ncodeblocks = ncodeblocks;
+    d->nnodes = nnodes;
+    }
+
+  /* B.10.7.1 Lblock starts at 3 */
+  for( size_t i = 0; i < d->ncodeblocks; ++i )
+    {
+    d->codeblocks[i].lblock = 3;
+    d->codeblocks[i].passes = 0;
+    d->codeblocks[i].included = false;
+    }
+  for( size_t i = 0; i < d->nnodes; ++i )
+    {
+    d->inclusion[i].value = d->zerobitplanes[i].value = TAGUNKNOWN;
+    d->inclusion[i].low = d->zerobitplanes[i].low = 0;
+    }
+  return true;
+}
+
+static packetheaderinfo *appendpacket( packetlist *list )
+{
+  if( list->npackets == list->maxpackets )
+    {
+    const size_t n = list->maxpackets ? 2 * list->maxpackets : 256;
+    packetheaderinfo *p = realloc( list->packets, n * sizeof(packetheaderinfo) );
+    if( !p ) return NULL;
+    list->packets = p;
+    list->maxpackets = n;
+    }
+  packetheaderinfo *p = list->packets + list->npackets++;
+  memset( p, 0, sizeof(*p) );
+  return p;
+}
+
+static codeblockcontribution *appendcontribution( packetlist *list )
+{
+  if( list->ncontributions == list->maxcontributions )
+    {
+    const size_t n = list->maxcontributions ? 2 * list->maxcontributions : 1024;
+    codeblockcontribution *p = realloc( list->contributions, n * sizeof(codeblockcontribution) );
+    if( !p ) return NULL;
+    list->contributions = p;
+    list->maxcontributions = n;
+    }
+  return list->contributions + list->ncontributions++;
+}
+
+/* B.10 decode one packet header, then locate the code-block data in the body */
+static bool decodepacket( const codestreamindex *index, tiledecoder *d,
+  rangestream *header, rangestream *body, uint16_t l, uint8_t r, uint16_t c, uint32_t k,
+  packetlist *list )
+{
+  const bool sop = index->Scod & 0x02;
+  const bool eph = index->Scod & 0x04;
+  const uint8_t style = index->components[c].cs.CodeBlockStyle;
+  const precinctinfo *pi = d->precincts + getresolutiongeometry( &d->geometry, c, r )->firstprecinct + k;
+  packetheaderinfo *pk = appendpacket( list );
+  if( !pk ) return false;
+  pk->layer = l;
+  pk->res = r;
+  pk->comp = c;
+  pk->precinct = k;
+  pk->offset = tell( body );
+  pk->firstcontribution = list->ncontributions;
+  const uint64_t bodystart = body->consumed;
+
+  /* A.8.1 SOP is optional, even when Scod allows it */
+  if( sop )
+    {
+    rangestream save = *body;
+    uint8_t m[2];
+    if( readbyte( body, m ) && readbyte( body, m + 1 ) && m[0] == 0xff && m[1] == 0x91 )
+      {
+      /* with PPM/PPT too the SOP stays in the bit stream, before the body */
+      if( !skipbytes( body, 4 ) ) return false;
+      save = *body;
+      }
+    *body = save;
+    }
+
+  pk->headeroffset = tell( header );
+  const uint64_t headerstart = header->consumed;
+  bitreader b;
+  b.s = header;
+  b.byte = 0;
+  b.bits = 0;
+  b.ok = true;
+  if( readbit( &b ) ) /* B.10.3 zero length packet */
+    {
+    for( uint8_t i = 0; i < pi->nbands; ++i )
+      {
+      const precinctband *pb = d->bands + pi->firstband + i;
+      for( uint32_t y = 0; y < pb->h; ++y )
+        for( uint32_t x = 0; x < pb->w; ++x )
+          {
+          codeblockstate *cb = d->codeblocks + pb->firstcb + (size_t)y * pb->w + x;
+          tagnode *inclusion = d->inclusion + pb->firstnode;
+          tagnode *zerobitplanes = d->zerobitplanes + pb->firstnode;
+          /* B.10.4 Code-block inclusion */
+          const bool included = cb->included
+            ? readbit( &b ) != 0
+            : decodetagtree( &b, inclusion, pb->w, pb->h, x, y, (uint32_t)l + 1 );
+          if( !b.ok ) return false;
+          if( !included ) continue;
+          codeblockcontribution *cc = appendcontribution( list );
+          if( !cc ) return false;
+          cc->band = pb->band;
+          cc->x = pb->cbx0 + x;
+          cc->y = pb->cby0 + y;
+          cc->first = !cb->included;
+          cc->zerobitplanes = 0;
+          /* B.10.5 Zero bit-plane information */
+          if( !cb->included )
+            {
+            uint32_t t = 1;
+            while( !decodetagtree( &b, zerobitplanes, pb->w, pb->h, x, y, t ) && b.ok && t < 255 )
+              ++t;
+            cc->zerobitplanes = (uint8_t)(t - 1);
+            cb->included = true;
+            }
+          /* B.10.6 Number of coding passes */
+          const uint32_t passes = decodepasses( &b );
+          cc->passes = (uint8_t)passes;
+          /* B.10.7.1 Lblock increment */
+          while( readbit( &b ) && b.ok )
+            ++cb->lblock;
+          /* B.10.7.2 one length per codeword segment */
+          uint64_t length = 0;
+          uint32_t done = cb->passes;
+          uint32_t left = passes;
+          while( left && b.ok )
+            {
+            const uint32_t end = segmentend( style, done );
+            const uint32_t n = end - done < left ? end - done : left;
+            const unsigned int nbits = cb->lblock + floorlog2( n );
+            if( nbits > 32 ) return false;
+            length += readbits( &b, nbits );
+            done += n;
+            left -= n;
+            }
+          cb->passes = done;
+          if( !b.ok || length > UINT32_MAX ) return false;
+          cc->length = (uint32_t)length;
+          }
+      }
+    }
+  alignbits( &b );
+  if( !b.ok ) return false;
+  if( eph )
+    {
+    uint8_t m[2];
+    if( !readbyte( header, m ) || !readbyte( header, m + 1 ) || m[0] != 0xff || m[1] != 0x92 )
+      return false;
+    }
+  pk->headerlength = (uint32_t)(header->consumed - headerstart);
+
+  /* B.9 the data follows in the same order */
+  pk->bodyoffset = tell( body );
+  pk->ncontributions = list->ncontributions - pk->firstcontribution;
+  for( size_t i = 0; i < pk->ncontributions; ++i )
+    {
+    codeblockcontribution *cc = list->contributions + pk->firstcontribution + i;
+    cc->offset = tell( body );
+    if( !skipbytes( body, cc->length ) ) return false;
+    pk->bodylength += cc->length;
+    }
+  pk->length = body->consumed - bodystart;
+  return true;
+}
+
+bool decodepacketheaders( FILE *in, const codestreamindex *index, uint32_t tile, packetlist *list )
+{
+  /* the data of the tile-parts of `tile`, and their packed packet headers */
+  size_t ndata = 0, npph = 0;
+  for( size_t i = 0; i < index->ntileparts; ++i )
+    if( index->tileparts[i].Isot == tile )
+      {
+      ++ndata;
+      npph += index->tileparts[i].npph;
+      }
+  pphrange *data = malloc( (ndata + 1) * sizeof(pphrange) );
+  pphrange *pph = malloc( (npph + 1) * sizeof(pphrange) );
+  tiledecoder d;
+  memset( &d, 0, sizeof(d) );
+  bool ok = data && pph && buildtiledecoder( index, tile, &d );
+  ndata = npph = 0;
+  for( size_t i = 0; ok && i < index->ntileparts; ++i )
+    {
+    const tilepartinfo *tp = index->tileparts + i;
+    if( tp->Isot != tile ) continue;
+    if( tp->datalength > UINT32_MAX ) ok = false;
+    data[ndata].offset = tp->dataoffset;
+    data[ndata].length = (uint32_t)tp->datalength;
+    ++ndata;
+    memcpy( pph + npph, index->pphranges + tp->firstpph, tp->npph * sizeof(pphrange) );
+    npph += tp->npph;
+    }
+
+  rangestream body, packed;
+  initstream( &body, in, data, ndata );
+  initstream( &packed, in, pph, npph );
+  const bool instream = !(index->flags & (INDEX_PPM | INDEX_PPT));
+  rangestream *header = instream ? &body : &packed;
+  packetiterator it;
+  packetid id;
+  ok = initpacketiterator( &it, index, tile ) && ok;
+  while( ok && nextpacket( &it, &id ) )
+    {
+    /* truncated codestream, keep the complete packets */
+    if( !normalize( header ) ) break;
+    const size_t n = list->npackets;
+    const size_t m = list->ncontributions;
+    if( !decodepacket( index, &d, header, &body, id.layer, id.res, id.comp, id.precinct, list ) )
+      {
+      list->npackets = n;
+      list->ncontributions = m;
+      /* the last packet may be cut */
+      if( !normalize( header ) || !normalize( &body ) ) break;
+      ok = false;
+      }
+    }
+  freepacketiterator( &it );
+  freetiledecoder( &d );
+  free( pph );
+  free( data );
+  return ok;
+}
+
+void freepacketlist( packetlist *list )
+{
+  free( list->packets );
+  free( list->contributions );
+  memset( list, 0, sizeof(*list) );
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simplepacket_h
+#define simplepacket_h
+
+#include <stdint.h>
+#include <stdlib.h> /* size_t */
+#include <stdbool.h>
+#include <stdio.h> /* FILE */
+
+#include "simpleindex.h"
+
+/*
+ * B.10 Packet header decoding: inclusion and zero bit-plane tag trees,
+ * number of coding passes and Lblock length coding. Nothing is decoded
+ * beyond the packet headers, the result is where the data of each
+ * code-block lives in the file. Packet headers are read in the bit stream,
+ * or from PPM / PPT when the codestream has them.
+ */
+
+/* one code-block contribution to a packet */
+typedef struct
+{
+  uint8_t  band;          /* 0: LL, 1: HL, 2: LH, 3: HH */
+  uint8_t  passes;        /* number of new coding passes */
+  uint8_t  zerobitplanes; /* missing most significant bit-planes (B.10.5) */
+  bool     first;         /* first inclusion of the code-block */
+  uint32_t x;             /* code-block index in the subband */
+  uint32_t y;
+  uint64_t offset;        /* absolute position of its data */
+  uint32_t length;
+} codeblockcontribution;
+
+typedef struct
+{
+  uint16_t layer;
+  uint8_t  res;
+  uint16_t comp;
+  uint32_t precinct;
+  uint64_t offset;        /* absolute position of the packet in the bit stream (SOP or header) */
+  uint64_t length;        /* bytes in the bit stream, as in PLT */
+  uint64_t headeroffset;  /* absolute position of the header, in PPM/PPT when used */
+  uint32_t headerlength;  /* including EPH */
+  uint64_t bodyoffset;    /* absolute position of the packet body */
+  uint64_t bodylength;
+  size_t   firstcontribution; /* index in packetlist::contributions */
+  size_t   ncontributions;
+} packetheaderinfo;
+
+typedef struct
+{
+  packetheaderinfo *packets;
+  size_t npackets;
+  size_t maxpackets;
+  codeblockcontribution *contributions;
+  size_t ncontributions;
+  size_t maxcontributions;
+} packetlist;
+
+/**
+ * Decode the headers of the packets of tile `tile` in stream order and
+ * append them to `list` (zero initialized by the caller). A truncated tile
+ * gives the complete packets only.
+ * Return false on a corrupted header or when the packet order cannot be
+ * derived (tile-part COD/COC, see initpacketiterator).
+ */
+bool decodepacketheaders( FILE *in, const codestreamindex *index, uint32_t tile, packetlist *list );
+
+/**
+ * Release memory
+ */
+void freepacketlist( packetlist *list );
+
+#endif
@@ -37,6 +37,24 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+/* Never called: two box types sharing a BOXSLOT give a duplicate case value
+ * and stop the build. Keep in sync with OtherType */
+static inline void checkboxslots( uint32_t type )
+{
+  switch( BOXSLOT( type ) )
+    {
+  case BOXSLOT(JP):   case BOXSLOT(FTYP): case BOXSLOT(JP2H): case BOXSLOT(JP2C):
+  case BOXSLOT(JP2):  case BOXSLOT(IHDR): case BOXSLOT(COLR): case BOXSLOT(XML):
+  case BOXSLOT(CDEF): case BOXSLOT(CMAP): case BOXSLOT(PCLR): case BOXSLOT(RES):
+  case BOXSLOT(IPTR): case BOXSLOT(MDAT): case BOXSLOT(MOOV): case BOXSLOT(ASOC):
+  case BOXSLOT(CIDX): case BOXSLOT(FIDX): case BOXSLOT(JPCH): case BOXSLOT(JPLH):
+  case BOXSLOT(LBL):  case BOXSLOT(RESC): case BOXSLOT(RESD): case BOXSLOT(RREQ):
+  case BOXSLOT(UINF): case BOXSLOT(ULST): case BOXSLOT(URL):  case BOXSLOT(UUID):
+  case BOXSLOT(FREE):
+    break;
+    }
+}
+
 bool hasnolength( uint_fast16_t marker )
 {
   switch( marker )
@@ -282,6 +300,66 @@ bool parsej2k( const char *filename, PrintFunctionJP2 printfun )
   return b;
 }
 
+/* parsejp2 does not take a user pointer */
+static boxinfo *listedboxes;
+static size_t nlistedboxes;
+static uint64_t listedend; /* boxes are contiguous: end of the previous one */
+static bool listfailed;
+
+static bool listbox( uint_fast32_t marker, size_t len, FILE *stream )
+{
+  const uint64_t start = (uint64_t)ftello( stream );
+  if( nlistedboxes % 64 == 0 )
+    {
+    boxinfo *p = realloc( listedboxes, (nlistedboxes + 64) * sizeof(boxinfo) );
+    if( !p )
+      {
+      listfailed = true;
+      return true;
+      }
+    listedboxes = p;
+    }
+  boxinfo *b = listedboxes + nlistedboxes++;
+  b->type = (uint32_t)marker;
+  b->offset = listedend;
+  /* len does not account for XLBox */
+  b->length = start - listedend + len - 8;
+  listedend = b->offset + b->length;
+  if( marker == JP2C )
+    {
+    /* no need to walk the codestream */
+    int v = fseeko( stream, (off_t)(len - 8), SEEK_CUR );
+    assert( v == 0 );
+    return false;
+    }
+  return true;
+}
+
+static bool listnothing( uint_fast16_t marker, size_t len, FILE *stream )
+{
+  (void)marker; (void)len; (void)stream;
+  return true;
+}
+
+bool listboxes( const char *filename, boxinfo **boxes, size_t *nboxes )
+{
+  listedboxes = NULL;
+  nlistedboxes = 0;
+  listedend = 0;
+  listfailed = false;
+  bool b = parsejp2( filename, listbox, listnothing );
+  if( !b || listfailed )
+    {
+    free( listedboxes );
+    listedboxes = NULL;
+    return false;
+    }
+  *boxes = listedboxes;
+  *nboxes = nlistedboxes;
+  listedboxes = NULL;
+  return true;
+}
+
 bool isjp2file( const char *filename )
 {
   FILE *stream = fopen( filename, "rb" );
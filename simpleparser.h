@@ -63,7 +63,8 @@ typedef enum {
   UINF = 0x75696e66,
   ULST = 0x756c7374,
   URL  = 0x75726c20,
-  UUID = 0x75756964
+  UUID = 0x75756964,
+  FREE = 0x66726565
 } OtherType;
 
 /* Part 1  Table A.2 List of markers and marker segments */
@@ -116,6 +117,20 @@ typedef enum {
   EOC = 0XFFD9  /* EOI in old jpeg */
 } MarkerType;
 
+/**
+ * Dictionaries of markers and boxes are direct tables, filled at compile
+ * time with designated initializers:
+ *   dict[ MARKERSLOT(SOC) ]  = { SOC, ... }   (MARKERSLOTS entries)
+ *   dict2[ BOXSLOT(JP2H) ]   = { JP2H, ... }  (BOXSLOTS entries)
+ * A lookup is one index plus a compare with the stored value, unknown ones
+ * land on an empty entry. BOXSLOT is a multiplicative perfect hash of the
+ * OtherType values, simpleparser.c fails to compile if two of them collide.
+ */
+#define MARKERSLOTS 256
+#define MARKERSLOT(marker) ((unsigned)(marker) & 0xff)
+#define BOXSLOTS 64
+#define BOXSLOT(type) ((unsigned)((uint32_t)((uint32_t)(type) * UINT32_C(0xd5b12ab1)) >> 26))
+
 /**
  * Function param that will be used to print an element (marker + len + data)
  * when this function return true this is the default behavior and the simple
@@ -145,6 +160,22 @@ bool parsej2k( const char *filename, PrintFunctionJ2K fj2k );
  */
 bool parsejp2( const char *filename, PrintFunctionJP2 fjp2, PrintFunctionJ2K fj2k );
 
+/**
+ * Top-level box of a JP2 file as found by listboxes
+ */
+typedef struct
+{
+  uint32_t type;
+  uint64_t offset; /* absolute position of LBox */
+  uint64_t length; /* whole box, header included */
+} boxinfo;
+
+/**
+ * Walk the top-level boxes of a JP2 file (codestreams are skipped, not
+ * parsed). `*boxes` must be released with free()
+ */
+bool listboxes( const char *filename, boxinfo **boxes, size_t *nboxes );
+
 /**
  * Return whether or not a marker has no length
  */
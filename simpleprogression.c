@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simpleprogression.h"
+
+#include <string.h>
+#include <assert.h>
+
+/* the loops of B.12.1, a precinct is either counted (layer-resolution orders)
+ * or found from a position on the reference grid */
+enum { DIM_L, DIM_R, DIM_C, DIM_P, DIM_Y, DIM_X };
+
+/* Table A.16 - Progression order for the SGcod, SPcoc and Ppoc parameters */
+static const uint8_t orders[5][5] = {
+  { DIM_L, DIM_R, DIM_C, DIM_P, 0 },     /* LRCP */
+  { DIM_R, DIM_L, DIM_C, DIM_P, 0 },     /* RLCP */
+  { DIM_R, DIM_Y, DIM_X, DIM_C, DIM_L }, /* RPCL */
+  { DIM_Y, DIM_X, DIM_C, DIM_R, DIM_L }, /* PCRL */
+  { DIM_C, DIM_Y, DIM_X, DIM_R, DIM_L }, /* CPRL */
+};
+static const unsigned int ndims[5] = { 4, 4, 5, 5, 5 };
+
+static uint64_t ceildiv( uint64_t a, uint64_t b )
+{
+  return (a + b - 1) / b;
+}
+
+static const resolutiongeometry *getgrid( const packetiterator *it, uint64_t c, uint64_t r )
+{
+  if( c >= it->index->Csiz || r >= it->geometry.maxres ) return NULL;
+  return getresolutiongeometry( &it->geometry, (uint16_t)c, (uint8_t)r );
+}
+
+static uint64_t getbegin( const packetiterator *it, unsigned int dim )
+{
+  const progressionchange *pc = it->changes + it->cur;
+  switch( dim )
+    {
+  case DIM_R: return pc->RSpoc;
+  case DIM_C: return pc->CSpoc;
+  case DIM_Y: return it->geometry.bounds.y0;
+  case DIM_X: return it->geometry.bounds.x0;
+  default: return 0;
+    }
+}
+
+static uint64_t getend( const packetiterator *it, unsigned int dim )
+{
+  const progressionchange *pc = it->changes + it->cur;
+  const codestreamindex *index = it->index;
+  switch( dim )
+    {
+  case DIM_L:
+    return pc->LYEpoc < index->NumberOfLayers ? pc->LYEpoc : index->NumberOfLayers;
+  case DIM_R:
+    return pc->REpoc < it->geometry.maxres ? pc->REpoc : it->geometry.maxres;
+  case DIM_C:
+    return pc->CEpoc < index->Csiz ? pc->CEpoc : index->Csiz;
+  case DIM_P:
+      {
+      const resolutiongeometry *g = getgrid( it, it->counters[DIM_C], it->counters[DIM_R] );
+      return g ? (uint64_t)g->wide * g->high : 0;
+      }
+  case DIM_Y: return it->geometry.bounds.y1;
+  default: return it->geometry.bounds.x1;
+    }
+}
+
+/* positions are visited at multiples of the smallest precinct step */
+static uint64_t advance( const packetiterator *it, unsigned int dim, uint64_t v )
+{
+  if( dim == DIM_Y ) return v + (it->dy - v % it->dy);
+  if( dim == DIM_X ) return v + (it->dx - v % it->dx);
+  return v + 1;
+}
+
+/* B.12.1.3 - B.12.1.5: the precinct whose upper left corner is at (x,y) on
+ * the reference grid, the first precinct of a row or column can start
+ * before the tile */
+static bool getprecinctat( const packetiterator *it, uint16_t c, uint8_t r, uint32_t *precinct )
+{
+  const componentinfo *ci = it->index->components + c;
+  const resolutiongeometry *g = getgrid( it, c, r );
+  const uint64_t trx0 = g->bounds.x0;
+  const uint64_t try0 = g->bounds.y0;
+  const uint64_t x = it->counters[DIM_X];
+  const uint64_t y = it->counters[DIM_Y];
+  const unsigned int levelno = ci->cs.NumberOfDecompositionLevels - r;
+  const unsigned int rpx = g->PPx + levelno;
+  const unsigned int rpy = g->PPy + levelno;
+  if( !(y % ((uint64_t)ci->YRsiz << rpy) == 0
+      || (y == it->geometry.bounds.y0 && ((try0 << levelno) % ((uint64_t)1 << rpy)) != 0)) )
+    return false;
+  if( !(x % ((uint64_t)ci->XRsiz << rpx) == 0
+      || (x == it->geometry.bounds.x0 && ((trx0 << levelno) % ((uint64_t)1 << rpx)) != 0)) )
+    return false;
+  const uint64_t i = (ceildiv( x, (uint64_t)ci->XRsiz << levelno ) >> g->PPx) - (trx0 >> g->PPx);
+  const uint64_t j = (ceildiv( y, (uint64_t)ci->YRsiz << levelno ) >> g->PPy) - (try0 >> g->PPy);
+  if( i >= g->wide || j >= g->high ) return false;
+  *precinct = (uint32_t)(j * g->wide + i);
+  return true;
+}
+
+/* the counters designate a packet not seen before */
+static bool getpacket( packetiterator *it, packetid *packet )
+{
+  const progressionchange *pc = it->changes + it->cur;
+  const uint8_t *order = orders[ pc->Ppoc ];
+  for( unsigned int k = 0; k < ndims[ pc->Ppoc ]; ++k )
+    if( it->counters[ order[k] ] >= getend( it, order[k] ) ) return false;
+
+  const uint16_t c = (uint16_t)it->counters[DIM_C];
+  const uint8_t r = (uint8_t)it->counters[DIM_R];
+  const uint16_t l = (uint16_t)it->counters[DIM_L];
+  const resolutiongeometry *g = getgrid( it, c, r );
+  if( !g || !g->wide || !g->high ) return false;
+  uint32_t p;
+  if( pc->Ppoc < 2 )
+    p = (uint32_t)it->counters[DIM_P];
+  else if( !getprecinctat( it, c, r, &p ) )
+    return false;
+  /* B.12.2 a packet already sent by a previous progression is skipped */
+  uint16_t *next = it->nextlayer + g->firstprecinct + p;
+  if( l < *next ) return false;
+  *next = (uint16_t)(l + 1);
+  packet->layer = l;
+  packet->res = r;
+  packet->comp = c;
+  packet->precinct = p;
+  return true;
+}
+
+bool initpacketiterator( packetiterator *it, const codestreamindex *index, uint32_t tile )
+{
+  memset( it, 0, sizeof(*it) );
+  it->index = index;
+  /* the coding style of a tile-part COD/COC is not kept */
+  if( index->flags & INDEX_TILECOD ) return false;
+  if( tile >= getnumberoftiles( index ) ) return false;
+
+  /* A.6.6 a tile-part header POC replaces the main header one for its tile,
+   * the tile-parts of other tiles may come in between */
+  size_t n = 0;
+  uint16_t owner = (uint16_t)tile;
+  for( size_t i = 0; i < index->npocs; ++i )
+    if( index->pocs[i].tile == owner ) ++n;
+  if( !n )
+    {
+    owner = POCMAINHEADER;
+    for( size_t i = 0; i < index->npocs; ++i )
+      if( index->pocs[i].tile == owner ) ++n;
+    }
+  it->changes = malloc( (n ? n : 1) * sizeof(progressionchange) );
+  if( !it->changes ) return false;
+  if( n )
+    {
+    size_t j = 0;
+    for( size_t i = 0; i < index->npocs; ++i )
+      if( index->pocs[i].tile == owner )
+        it->changes[j++] = index->pocs[i];
+    }
+  else
+    {
+    progressionchange *pc = it->changes;
+    if( index->ProgressionOrder > 4 ) return false;
+    pc->tile = (uint16_t)tile;
+    pc->RSpoc = 0;
+    pc->CSpoc = 0;
+    pc->LYEpoc = index->NumberOfLayers;
+    pc->REpoc = 33;
+    pc->CEpoc = index->Csiz;
+    pc->Ppoc = index->ProgressionOrder;
+    n = 1;
+    }
+  it->nchanges = n;
+
+  if( !buildtilegeometry( index, tile, &it->geometry ) ) return false;
+  /* smallest precinct, as seen on the reference grid */
+  it->dx = it->dy = UINT64_MAX;
+  for( uint16_t c = 0; c < index->Csiz; ++c )
+    {
+    const componentinfo *ci = index->components + c;
+    for( uint8_t r = 0; r <= ci->cs.NumberOfDecompositionLevels; ++r )
+      {
+      const resolutiongeometry *g = getresolutiongeometry( &it->geometry, c, r );
+      if( !g->wide || !g->high ) continue;
+      const unsigned int e = ci->cs.NumberOfDecompositionLevels - r;
+      const uint64_t dx = (uint64_t)ci->XRsiz << (g->PPx + e);
+      const uint64_t dy = (uint64_t)ci->YRsiz << (g->PPy + e);
+      if( dx < it->dx ) it->dx = dx;
+      if( dy < it->dy ) it->dy = dy;
+      }
+    }
+  it->nextlayer = calloc( it->geometry.nprecincts + 1, sizeof(uint16_t) );
+  return it->nextlayer != NULL;
+}
+
+bool nextpacket( packetiterator *it, packetid *packet )
+{
+  while( it->cur < it->nchanges )
+    {
+    const progressionchange *pc = it->changes + it->cur;
+    const uint8_t *order = orders[ pc->Ppoc ];
+    const int n = (int)ndims[ pc->Ppoc ];
+    int k = 0;
+    if( it->started )
+      {
+      /* odometer: step the innermost loop, carry into the outer ones */
+      for( k = n - 1; k >= 0; --k )
+        {
+        const unsigned int dim = order[k];
+        it->counters[dim] = advance( it, dim, it->counters[dim] );
+        if( it->counters[dim] < getend( it, dim ) ) break;
+        }
+      if( k < 0 )
+        {
+        /* this progression is over */
+        ++it->cur;
+        it->started = false;
+        continue;
+        }
+      ++k;
+      }
+    for( ; k < n; ++k )
+      it->counters[ order[k] ] = getbegin( it, order[k] );
+    it->started = true;
+    if( getpacket( it, packet ) ) return true;
+    }
+  return false;
+}
+
+void freepacketiterator( packetiterator *it )
+{
+  free( it->changes );
+  freetilegeometry( &it->geometry );
+  free( it->nextlayer );
+  memset( it, 0, sizeof(*it) );
+}
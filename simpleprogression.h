@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simpleprogression_h
+#define simpleprogression_h
+
+#include "simplegeometry.h"
+
+/*
+ * B.12 Progression order: the sequence of the packets of a tile, from the
+ * main header COD/COC and the main header or tile-part header POC.
+ */
+
+typedef struct
+{
+  uint16_t layer;
+  uint8_t  res;
+  uint16_t comp;
+  uint32_t precinct; /* raster order within the resolution level */
+} packetid;
+
+typedef struct
+{
+  const codestreamindex *index;
+  tilegeometry geometry;
+  uint16_t *nextlayer; /* one per precinct of the tile */
+  /* one progression per POC entry, or the COD one */
+  progressionchange *changes;
+  size_t nchanges;
+  size_t cur;
+  /* smallest precinct step on the reference grid, for RPCL, PCRL and CPRL */
+  uint64_t dx;
+  uint64_t dy;
+  /* loop counters: layer, resolution, component, precinct, y, x */
+  uint64_t counters[6];
+  bool started;
+} packetiterator;
+
+/**
+ * Prepare the packet sequence of tile `tile`.
+ * Return false when a tile-part COD/COC is found (the coding style of the
+ * tile is not kept in the index) or on allocation failure.
+ */
+bool initpacketiterator( packetiterator *it, const codestreamindex *index, uint32_t tile );
+
+/**
+ * Get the next packet of the tile, return false after the last one
+ */
+bool nextpacket( packetiterator *it, packetid *packet );
+
+/**
+ * Release memory
+ */
+void freepacketiterator( packetiterator *it );
+
+#endif
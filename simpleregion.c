@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simpleregion.h"
+#include "simplepacket.h"
+
+#include <string.h>
+#include <assert.h>
+
+static bool appendrange( byterangelist *l, uint64_t offset, uint64_t length )
+{
+  if( !length ) return true;
+  if( l->nranges == l->maxranges )
+    {
+    const size_t n = l->maxranges ? 2 * l->maxranges : 256;
+    byterange *r = realloc( l->ranges, n * sizeof(byterange) );
+    if( !r ) return false;
+    l->ranges = r;
+    l->maxranges = n;
+    }
+  l->ranges[l->nranges].offset = offset;
+  l->ranges[l->nranges].length = length;
+  ++l->nranges;
+  return true;
+}
+
+static int compareranges( const void *a, const void *b )
+{
+  const byterange *x = a;
+  const byterange *y = b;
+  if( x->offset != y->offset ) return x->offset < y->offset ? -1 : 1;
+  return 0;
+}
+
+/* sort, then merge overlapping and adjacent ranges */
+static void coalesce( byterangelist *l )
+{
+  size_t n = 0;
+  if( !l->nranges ) return;
+  qsort( l->ranges, l->nranges, sizeof(byterange), compareranges );
+  for( size_t i = 1; i < l->nranges; ++i )
+    {
+    byterange *last = l->ranges + n;
+    const byterange *r = l->ranges + i;
+    if( r->offset <= last->offset + last->length )
+      {
+      const uint64_t end = r->offset + r->length;
+      if( end > last->offset + last->length ) last->length = end - last->offset;
+      }
+    else
+      l->ranges[++n] = *r;
+    }
+  l->nranges = n + 1;
+}
+
+static bool intersects( const rectangle *a, const rectangle *b )
+{
+  return a->x0 < b->x1 && b->x0 < a->x1 && a->y0 < b->y1 && b->y0 < a->y1;
+}
+
+/*
+ * The region seen on resolution level `res` of component `comp`, widened by
+ * the support of the synthesis filters: about 2 samples per level for the
+ * 5-3 filter and 4 for the 9-7 one, less than twice that over all levels.
+ */
+static void getregiononresolution( const codestreamindex *index, const rectangle *region,
+  uint16_t comp, uint8_t res, rectangle *r )
+{
+  const componentinfo *ci = index->components + comp;
+  const unsigned int e = ci->cs.NumberOfDecompositionLevels - res;
+  /* Table A.20 - Transformation for the SPcod and SPcoc parameters */
+  const uint64_t margin = ci->cs.Transformation == 1 ? 4 : 8;
+  rectangle c;
+  getcomponentrectangle( region, ci->XRsiz, ci->YRsiz, &c );
+  r->x0 = c.x0 >> e;
+  r->y0 = c.y0 >> e;
+  r->x1 = ((c.x1 + ((uint64_t)1 << e) - 1) >> e) + margin;
+  r->y1 = ((c.y1 + ((uint64_t)1 << e) - 1) >> e) + margin;
+  r->x0 = r->x0 > margin ? r->x0 - margin : 0;
+  r->y0 = r->y0 > margin ? r->y0 - margin : 0;
+}
+
+static bool appendpacket( tilepacketlist *l, const packetid *id, uint64_t offset, uint64_t length )
+{
+  if( l->npackets == l->maxpackets )
+    {
+    const size_t n = l->maxpackets ? 2 * l->maxpackets : 256;
+    tilepacket *p = realloc( l->packets, n * sizeof(tilepacket) );
+    if( !p ) return false;
+    l->packets = p;
+    l->maxpackets = n;
+    }
+  tilepacket *p = l->packets + l->npackets++;
+  p->id = *id;
+  p->offset = offset;
+  p->length = length;
+  return true;
+}
+
+bool isregionpacket( const tilegeometry *g, const regionrequest *request, const packetid *id )
+{
+  const codestreamindex *index = g->index;
+  const uint8_t NL = index->components[id->comp].cs.NumberOfDecompositionLevels;
+  const uint8_t maxres = NL > request->reduce ? (uint8_t)(NL - request->reduce) : 0;
+  if( request->components && !request->components[id->comp] )
+    {
+    /* the multiple component transformation needs the first three */
+    const bool *c = request->components;
+    if( !index->MultipleComponentTransformation || index->Csiz < 3 || id->comp > 2
+      || !(c[0] || c[1] || c[2]) )
+      return false;
+    }
+  if( request->layers && id->layer >= request->layers ) return false;
+  if( id->res > maxres ) return false;
+  const resolutiongeometry *rg = getresolutiongeometry( g, id->comp, id->res );
+  rectangle p, r;
+  getprecinctrectangle( rg, id->precinct, &p );
+  getregiononresolution( index, &request->region, id->comp, id->res, &r );
+  return intersects( &p, &r );
+}
+
+bool gettilepartpackets( FILE *in, const codestreamindex *index, uint32_t tile,
+  const size_t *tileparts, size_t n, tilepacketlist *packets )
+{
+  bool plt = true;
+  for( size_t i = 0; i < n; ++i )
+    {
+    const tilepartinfo *tp = index->tileparts + tileparts[i];
+    if( !tp->npackets && tp->datalength ) plt = false;
+    }
+  bool ok = true;
+  if( plt )
+    {
+    /* the n-th packet of the progression is the n-th Iplt of the tile */
+    packetiterator it;
+    packetid id;
+    size_t i = 0, j = 0;
+    uint64_t offset = n ? index->tileparts[ tileparts[0] ].dataoffset : 0;
+    ok = initpacketiterator( &it, index, tile );
+    while( ok && nextpacket( &it, &id ) )
+      {
+      while( i < n && j == index->tileparts[ tileparts[i] ].npackets )
+        {
+        if( ++i < n ) offset = index->tileparts[ tileparts[i] ].dataoffset;
+        j = 0;
+        }
+      if( i == n ) break; /* truncated */
+      const tilepartinfo *tp = index->tileparts + tileparts[i];
+      const uint32_t length = index->packetlengths[ tp->firstpacket + j++ ];
+      ok = appendpacket( packets, &id, offset, length );
+      offset += length;
+      }
+    freepacketiterator( &it );
+    }
+  else
+    {
+    packetlist list;
+    memset( &list, 0, sizeof(list) );
+    ok = decodepacketheaders( in, index, tile, &list );
+    for( size_t k = 0; ok && k < list.npackets; ++k )
+      {
+      const packetheaderinfo *pk = list.packets + k;
+      packetid id;
+      id.layer = pk->layer;
+      id.res = pk->res;
+      id.comp = pk->comp;
+      id.precinct = pk->precinct;
+      ok = appendpacket( packets, &id, pk->offset, pk->length );
+      }
+    freepacketlist( &list );
+    }
+  return ok;
+}
+
+bool grouptileparts( const codestreamindex *index, size_t **first, size_t **tileparts )
+{
+  const uint32_t ntiles = getnumberoftiles( index );
+  size_t *f = calloc( (size_t)ntiles + 1, sizeof(size_t) );
+  size_t *t = malloc( (index->ntileparts + 1) * sizeof(size_t) );
+  size_t *next = malloc( ((size_t)ntiles + 1) * sizeof(size_t) );
+  const bool ok = f && t && next;
+  if( ok )
+    {
+    for( size_t i = 0; i < index->ntileparts; ++i )
+      ++f[ index->tileparts[i].Isot + 1 ];
+    for( uint32_t k = 0; k < ntiles; ++k )
+      f[k + 1] += f[k];
+    memcpy( next, f, ntiles * sizeof(size_t) );
+    for( size_t i = 0; i < index->ntileparts; ++i )
+      t[ next[ index->tileparts[i].Isot ]++ ] = i;
+    }
+  free( next );
+  *first = f;
+  *tileparts = t;
+  return ok;
+}
+
+bool gettilepackets( FILE *in, const codestreamindex *index, uint32_t tile, tilepacketlist *packets )
+{
+  size_t n = 0;
+  for( size_t i = 0; i < index->ntileparts; ++i )
+    if( index->tileparts[i].Isot == tile ) ++n;
+  size_t *tileparts = malloc( (n + 1) * sizeof(size_t) );
+  if( !tileparts ) return false;
+  n = 0;
+  for( size_t i = 0; i < index->ntileparts; ++i )
+    if( index->tileparts[i].Isot == tile ) tileparts[n++] = i;
+  const bool ok = gettilepartpackets( in, index, tile, tileparts, n, packets );
+  free( tileparts );
+  return ok;
+}
+
+/* tile-part headers and packets of tile `tile` */
+static bool plantile( FILE *in, const codestreamindex *index, const regionrequest *request,
+  uint32_t tile, const size_t *tileparts, size_t n, byterangelist *ranges )
+{
+  for( size_t i = 0; i < n; ++i )
+    {
+    const tilepartinfo *tp = index->tileparts + tileparts[i];
+    if( !appendrange( ranges, tp->offset, tp->dataoffset - tp->offset ) ) return false;
+    }
+  tilegeometry g;
+  tilepacketlist packets;
+  memset( &packets, 0, sizeof(packets) );
+  bool ok = buildtilegeometry( index, tile, &g )
+    && gettilepartpackets( in, index, tile, tileparts, n, &packets );
+  for( size_t k = 0; ok && k < packets.npackets; ++k )
+    {
+    const tilepacket *p = packets.packets + k;
+    if( isregionpacket( &g, request, &p->id ) )
+      ok = appendrange( ranges, p->offset, p->length );
+    }
+  freetilepacketlist( &packets );
+  freetilegeometry( &g );
+  return ok;
+}
+
+bool planregion( FILE *in, const codestreamindex *index, const regionrequest *request, byterangelist *ranges )
+{
+  /* the JP2 boxes before the codestream come with the main header */
+  const uint64_t start = index->isjp2 ? 0 : index->socoffset;
+  if( !appendrange( ranges, start, index->mainheaderend - start ) ) return false;
+
+  rectangle region = request->region;
+  const rectangle image = { index->XOsiz, index->YOsiz, index->Xsiz, index->Ysiz };
+  if( !intersects( &region, &image ) )
+    {
+    coalesce( ranges );
+    return true;
+    }
+  if( region.x0 < image.x0 ) region.x0 = image.x0;
+  if( region.y0 < image.y0 ) region.y0 = image.y0;
+  if( region.x1 > image.x1 ) region.x1 = image.x1;
+  if( region.y1 > image.y1 ) region.y1 = image.y1;
+
+  size_t *first, *tileparts;
+  bool ok = grouptileparts( index, &first, &tileparts );
+
+  /* B-7, tiles crossing the region */
+  const uint64_t ntx = (index->Xsiz - index->XTOsiz + index->XTsiz - 1) / index->XTsiz;
+  const uint64_t p0 = (region.x0 - index->XTOsiz) / index->XTsiz;
+  const uint64_t p1 = (region.x1 - 1 - index->XTOsiz) / index->XTsiz;
+  const uint64_t q0 = (region.y0 - index->YTOsiz) / index->YTsiz;
+  const uint64_t q1 = (region.y1 - 1 - index->YTOsiz) / index->YTsiz;
+  for( uint64_t q = q0; ok && q <= q1; ++q )
+    for( uint64_t p = p0; ok && p <= p1; ++p )
+      {
+      const uint32_t t = (uint32_t)(q * ntx + p);
+      ok = plantile( in, index, request, t, tileparts + first[t], first[t + 1] - first[t], ranges );
+      }
+  if( ok ) coalesce( ranges );
+
+  free( tileparts );
+  free( first );
+  return ok;
+}
+
+void freebyterangelist( byterangelist *ranges )
+{
+  free( ranges->ranges );
+  memset( ranges, 0, sizeof(*ranges) );
+}
+
+void freetilepacketlist( tilepacketlist *packets )
+{
+  free( packets->packets );
+  memset( packets, 0, sizeof(*packets) );
+}
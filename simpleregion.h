@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simpleregion_h
+#define simpleregion_h
+
+#include "simplegeometry.h"
+#include "simpleprogression.h"
+
+#include <stdio.h>
+
+/*
+ * Byte ranges of a file needed to decode a region of the image at a given
+ * resolution, number of quality layers and set of components: the main
+ * header, the tile-part headers of the tiles crossing the region and the
+ * packets of the precincts contributing to it.
+ */
+
+typedef struct
+{
+  uint64_t offset; /* absolute position */
+  uint64_t length;
+} byterange;
+
+typedef struct
+{
+  byterange *ranges;
+  size_t nranges;
+  size_t maxranges;
+} byterangelist;
+
+typedef struct
+{
+  rectangle region;      /* on the reference grid */
+  uint8_t   reduce;      /* number of highest resolution levels discarded */
+  uint16_t  layers;      /* 0 for all */
+  const bool *components; /* Csiz flags, NULL for all */
+} regionrequest;
+
+/* a packet of a tile and where it lies in the bit stream */
+typedef struct
+{
+  packetid id;
+  uint64_t offset; /* absolute position */
+  uint64_t length; /* as in PLT, without the header when in PPM/PPT */
+} tilepacket;
+
+typedef struct
+{
+  tilepacket *packets;
+  size_t npackets;
+  size_t maxpackets;
+} tilepacketlist;
+
+/**
+ * Group the tile-parts by tile: the tile-parts of tile t, in codestream
+ * order, are (*tileparts)[(*first)[t]] to (*tileparts)[(*first)[t + 1] - 1].
+ * Both arrays are to be released by the caller
+ */
+bool grouptileparts( const codestreamindex *index, size_t **first, size_t **tileparts );
+
+/**
+ * Append the packets of tile `tile` in stream order to `packets` (zero
+ * initialized by the caller), from PLT or else from the packet headers
+ */
+bool gettilepackets( FILE *in, const codestreamindex *index, uint32_t tile, tilepacketlist *packets );
+
+/**
+ * Same as gettilepackets, with the `n` tile-parts of the tile given by
+ * their index in codestreamindex::tileparts, in codestream order
+ */
+bool gettilepartpackets( FILE *in, const codestreamindex *index, uint32_t tile,
+  const size_t *tileparts, size_t n, tilepacketlist *packets );
+
+/**
+ * Return whether packet `id` of the tile described by `g` contributes to
+ * `request`
+ */
+bool isregionpacket( const tilegeometry *g, const regionrequest *request, const packetid *id );
+
+/**
+ * Append to `ranges` (zero initialized by the caller) the byte ranges of
+ * `in` needed for `request`, sorted and coalesced.
+ * Packet positions come from PLT, or from the packet headers when a
+ * tile-part has no PLT. With PPM/PPT all packet headers of a selected tile
+ * are kept, they live in the main header and tile-part headers.
+ * Return false when the packet order of a tile cannot be derived or on a
+ * corrupted packet header.
+ */
+bool planregion( FILE *in, const codestreamindex *index, const regionrequest *request, byterangelist *ranges );
+
+/**
+ * Release memory
+ */
+void freebyterangelist( byterangelist *ranges );
+
+/**
+ * Release memory
+ */
+void freetilepacketlist( tilepacketlist *packets );
+
+#endif
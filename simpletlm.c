@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simpletlm.h"
+
+#include <string.h>
+#include <assert.h>
+
+void inittlm( tlmtable *table )
+{
+  memset( table, 0, sizeof(*table) );
+}
+
+void freetlm( tlmtable *table )
+{
+  free( table->entries );
+  inittlm( table );
+}
+
+static bool reserve( tlmtable *table, size_t n )
+{
+  size_t max = table->maxentries ? table->maxentries : 256;
+  tlmentry *entries;
+  if( table->nentries + n <= table->maxentries ) return true;
+  while( max < table->nentries + n ) max *= 2;
+  entries = realloc( table->entries, max * sizeof(tlmentry) );
+  if( !entries ) return false;
+  table->entries = entries;
+  table->maxentries = max;
+  return true;
+}
+
+bool readtlm( tlmtable *table, FILE *stream, size_t len, uint8_t *ztlm )
+{
+  uint8_t buffer[6 * 64]; /* 64 entries of Ttlm (2) + Ptlm (4) */
+  size_t i, n, entrysize;
+  uint8_t z, ST, SP;
+  tlmentry *e;
+  if( len < 2 || fread( buffer, 1, 2, stream ) != 2 ) return false;
+  z = buffer[0];
+  /* Table A.33 - Size parameters for Stlm */
+  ST = ( buffer[1] >> 4 ) & 0x3;
+  SP = ( buffer[1] >> 6 ) & 0x1;
+  if( ST == 3 || table->seen[z] || table->merged ) return false;
+  entrysize = ST + ( SP ? 4u : 2u );
+  len -= 2;
+  if( len % entrysize ) return false;
+  n = len / entrysize;
+  if( !reserve( table, n ) ) return false;
+
+  e = table->entries + table->nentries;
+  i = 0;
+  while( i != n )
+    {
+    /* read a few entries at a time, segments can hold more than 10000 */
+    const size_t chunk = n - i < 64 ? n - i : 64;
+    const uint8_t *p = buffer;
+    size_t j;
+    if( fread( buffer, entrysize, chunk, stream ) != chunk ) return false;
+    for( j = 0; j != chunk; ++j, ++e )
+      {
+      if( ST == 0 )
+        e->Isot = 0;
+      else if( ST == 1 )
+        e->Isot = *p;
+      else
+        e->Isot = (uint16_t)(( p[0] << 8 ) | p[1]);
+      p += ST;
+      if( SP )
+        e->Ptlm = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+      else
+        e->Ptlm = (uint32_t)(( p[0] << 8 ) | p[1]);
+      p += SP ? 4 : 2;
+      }
+    i += chunk;
+    }
+
+  table->first[z] = table->nentries;
+  table->count[z] = n;
+  table->ST[z] = ST;
+  table->SP[z] = SP;
+  table->seen[z] = true;
+  table->nentries += n;
+  table->nsegments++;
+  *ztlm = z;
+  return true;
+}
+
+bool mergetlm( tlmtable *table )
+{
+  tlmentry *entries;
+  size_t pos = 0;
+  unsigned int z;
+  if( table->merged ) return true;
+  table->merged = true;
+  if( !table->nentries ) return true;
+  entries = malloc( table->nentries * sizeof(tlmentry) );
+  if( !entries ) return false;
+  for( z = 0; z < 256; ++z )
+    {
+    size_t i;
+    if( !table->seen[z] ) continue;
+    memcpy( entries + pos, table->entries + table->first[z], table->count[z] * sizeof(tlmentry) );
+    table->first[z] = pos;
+    /* A.7.1: without Ttlm there is one tile-part per tile, in order */
+    if( table->ST[z] == 0 )
+      for( i = 0; i != table->count[z]; ++i )
+        entries[pos + i].Isot = (uint16_t)(pos + i);
+    pos += table->count[z];
+    }
+  assert( pos == table->nentries );
+  free( table->entries );
+  table->entries = entries;
+  table->maxentries = table->nentries;
+  return true;
+}
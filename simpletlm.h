@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simpletlm_h
+#define simpletlm_h
+
+#include <stdint.h>
+#include <stdlib.h> /* size_t */
+#include <stdbool.h>
+#include <stdio.h> /* FILE */
+
+/*
+ * A.7.1 Tile-part lengths, main header (TLM).
+ * Segments are decoded straight from the stream, there is no limit on the
+ * number of tile-parts. A codestream can have up to 256 TLM segments (Ztlm)
+ * in any order, mergetlm concatenates them into a single table ordered by
+ * Ztlm, which is the order of the tile-parts in the codestream.
+ */
+
+typedef struct
+{
+  uint16_t Isot; /* Ttlm, or the tile-part position when Ttlm is absent */
+  uint32_t Ptlm;
+} tlmentry;
+
+typedef struct
+{
+  tlmentry *entries;
+  size_t nentries;
+  size_t maxentries;
+  /* where the entries of segment Ztlm start in `entries`, and how many */
+  size_t first[256];
+  size_t count[256];
+  uint8_t ST[256]; /* size of Ttlm, 0 means tiles are in order */
+  uint8_t SP[256]; /* size of Ptlm */
+  bool seen[256];
+  unsigned int nsegments;
+  bool merged;
+} tlmtable;
+
+/**
+ * Initialize an empty table
+ */
+void inittlm( tlmtable *table );
+
+/**
+ * Decode the TLM segment parameters (`len` bytes after Ltlm) from `stream`
+ * and append its entries to `table`. On success `*ztlm` is the index of the
+ * segment, its entries are entries[first[ztlm]] .. entries[first[ztlm] + count[ztlm] - 1]
+ * Return false on a truncated or invalid segment, or a repeated Ztlm
+ */
+bool readtlm( tlmtable *table, FILE *stream, size_t len, uint8_t *ztlm );
+
+/**
+ * Put the segments in Ztlm order and give an index to tile-parts of segments
+ * without Ttlm. Call once all TLM segments are read (at the first SOT).
+ */
+bool mergetlm( tlmtable *table );
+
+/**
+ * Release memory
+ */
+void freetlm( tlmtable *table );
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* copy_file_range */
+#endif
+
+#include "simplewriter.h"
+#include "simpleparser.h"
+
+#include <assert.h>
+#include <byteswap.h>
+#include <sys/types.h> /* off_t */
+#include <unistd.h>
+
+bool write8(FILE *output, const uint8_t ret)
+{
+  union { uint8_t v; char bytes[1]; } u;
+  u.v = ret;
+  size_t l = fwrite(u.bytes,sizeof(char),1,output);
+  if( l != 1 || feof(output) ) return false;
+  return true;
+}
+
+bool write16(FILE *output, const uint16_t ret)
+{
+  union { uint16_t v; char bytes[2]; } u;
+  u.v = bswap_16(ret);
+  size_t l = fwrite(u.bytes,sizeof(char),2,output);
+  if( l != 2 || feof(output) ) return false;
+  return true;
+}
+
+bool write32(FILE *output, const uint32_t ret)
+{
+  union { uint32_t v; char bytes[4]; } u;
+  u.v = bswap_32(ret);
+  size_t l = fwrite(u.bytes,sizeof(char),4,output);
+  if( l != 4 || feof(output) ) return false;
+  return true;
+}
+
+void write_marker( FILE *out, uint_fast16_t marker, size_t len )
+{
+  union { uint16_t v; char bytes[2]; } u;
+  u.v = bswap_16(marker);
+  size_t s = fwrite(u.bytes, 1, 2, out);
+  assert( s == 2 );
+  // length
+  const bool nolen = hasnolength( marker );
+  if(!nolen)
+    {
+    assert( len + 2 <= 0xffff );
+    u.v = bswap_16((uint16_t)len+2);
+    s = fwrite(u.bytes, 1, 2, out);
+    assert( s == 2 );
+    }
+}
+
+bool copyrange( FILE *in, uint64_t offset, uint64_t len, FILE *out )
+{
+  char buffer[64 * 1024];
+#ifdef __linux__
+  /* let the kernel move the bytes (no copy through user space, reflink on
+   * file systems supporting it). Anything it could not do (pipes, old
+   * kernels...) is done by the read/write loop below */
+  if( len && fflush( out ) == 0 )
+    {
+    const int fdout = fileno( out );
+    loff_t pos = (loff_t)offset;
+    while( len )
+      {
+      const size_t chunk = len < (1u << 30) ? (size_t)len : (1u << 30);
+      const ssize_t n = copy_file_range( fileno( in ), &pos, fdout, NULL, chunk, 0 );
+      if( n <= 0 ) break;
+      len -= (uint64_t)n;
+      }
+    if( (uint64_t)pos != offset )
+      {
+      /* stdio does not know the file position moved */
+      const off_t end = lseek( fdout, 0, SEEK_CUR );
+      if( end < 0 || fseeko( out, end, SEEK_SET ) != 0 ) return false;
+      offset = (uint64_t)pos;
+      }
+    }
+#endif
+  if( fseeko( in, (off_t)offset, SEEK_SET ) != 0 ) return false;
+  while( len )
+    {
+    const size_t n = len < sizeof(buffer) ? (size_t)len : sizeof(buffer);
+    if( fread( buffer, 1, n, in ) != n ) return false;
+    if( fwrite( buffer, 1, n, out ) != n ) return false;
+    len -= n;
+    }
+  return true;
+}
+
+bool copysegments( FILE *in, uint64_t begin, uint64_t end,
+  const uint_fast16_t *skip, FILE *out, uint64_t *size )
+{
+  uint64_t pos = begin;
+  while( pos < end )
+    {
+    uint8_t b[4];
+    if( fseeko( in, (off_t)pos, SEEK_SET ) != 0 ) return false;
+    if( fread( b, 1, 4, in ) != 4 ) return false;
+    const uint_fast16_t marker = (uint_fast16_t)(b[0] << 8 | b[1]);
+    const uint16_t l = (uint16_t)(b[2] << 8 | b[3]);
+    if( l < 2 || pos + 2 + l > end ) return false;
+    bool keep = true;
+    for( const uint_fast16_t *s = skip; s && *s; ++s )
+      if( *s == marker ) keep = false;
+    if( keep )
+      {
+      *size += 2 + (uint64_t)l;
+      if( out && !copyrange( in, pos, 2 + (uint64_t)l, out ) ) return false;
+      }
+    pos += 2 + (uint64_t)l;
+    }
+  return pos == end;
+}
+
+static size_t getvbytesize( uint32_t v )
+{
+  size_t n = 1;
+  while( v >>= 7 ) ++n;
+  return n;
+}
+
+static bool writevbyte( FILE *out, uint32_t v )
+{
+  uint8_t b[5];
+  const size_t n = getvbytesize( v );
+  for( size_t k = 0; k < n; ++k )
+    {
+    b[k] = (uint8_t)((v >> (7 * (n - 1 - k))) & 0x7f);
+    if( k + 1 != n ) b[k] |= 0x80;
+    }
+  return fwrite( b, 1, n, out ) == n;
+}
+
+uint64_t writeppt( FILE *in, const pphrange *ranges, size_t n, FILE *out )
+{
+  /* Lppt = 3 + len <= 65535 */
+  const uint64_t maxlen = 65532;
+  uint64_t total = 0;
+  size_t i;
+  for( i = 0; i < n; ++i )
+    total += ranges[i].length;
+  const uint64_t nsegments = total ? (total + maxlen - 1) / maxlen : 1;
+  if( nsegments > 256 ) return 0;
+  if( out )
+    {
+    uint64_t done = 0; /* in ranges[i] */
+    i = 0;
+    for( unsigned int zppt = 0; zppt < nsegments; ++zppt )
+      {
+      uint64_t len = total - zppt * maxlen < maxlen ? total - zppt * maxlen : maxlen;
+      write_marker( out, PPT, 1 + (size_t)len );
+      write8( out, (uint8_t)zppt );
+      while( len )
+        {
+        const uint64_t left = ranges[i].length - done;
+        const uint64_t chunk = left < len ? left : len;
+        if( !copyrange( in, ranges[i].offset + done, chunk, out ) ) return 0;
+        len -= chunk;
+        done += chunk;
+        if( done == ranges[i].length )
+          {
+          ++i;
+          done = 0;
+          }
+        }
+      }
+    }
+  return 5 * nsegments + total;
+}
+
+uint64_t writeplt( FILE *out, const uint32_t *lengths, size_t n )
+{
+  uint64_t total = 0;
+  unsigned int zplt = 0;
+  size_t i = 0;
+  while( i < n )
+    {
+    size_t j = i;
+    size_t len = 0;
+    /* Lplt = 3 + len <= 65535 */
+    while( j < n && len + getvbytesize( lengths[j] ) <= 65532 )
+      len += getvbytesize( lengths[j++] );
+    if( zplt == 256 ) return 0;
+    if( out )
+      {
+      write_marker( out, PLT, 1 + len );
+      write8( out, (uint8_t)zplt );
+      for( size_t k = i; k < j; ++k )
+        writevbyte( out, lengths[k] );
+      }
+    total += 5 + len;
+    i = j;
+    ++zplt;
+    }
+  if( out && ferror( out ) ) return 0;
+  return total;
+}
+
+uint64_t writetlm( FILE *out, const uint16_t *Ttlm, const uint32_t *Ptlm, size_t n )
+{
+  const size_t maxentries = (65535 - 4) / 6;
+  uint64_t total = 0;
+  unsigned int ztlm = 0;
+  for( size_t i = 0; i < n; i += maxentries, ++ztlm )
+    {
+    const size_t count = n - i < maxentries ? n - i : maxentries;
+    if( ztlm == 256 ) return 0;
+    if( out )
+      {
+      write_marker( out, TLM, 2 + 6 * count );
+      write8( out, (uint8_t)ztlm );
+      write8( out, 0x60 );
+      for( size_t k = i; k < i + count; ++k )
+        {
+        write16( out, Ttlm[k] );
+        write32( out, Ptlm[k] );
+        }
+      }
+    total += 6 + 6 * count;
+    }
+  if( out && ferror( out ) ) return 0;
+  return total;
+}
+
+bool writejp2cheader( FILE *out, uint64_t codestreamlen )
+{
+  if( codestreamlen + 8 <= UINT32_MAX )
+    {
+    return write32( out, (uint32_t)(codestreamlen + 8) )
+      && write32( out, JP2C );
+    }
+  return write32( out, 1 )
+    && write32( out, JP2C )
+    && write32( out, (uint32_t)((codestreamlen + 16) >> 32) )
+    && write32( out, (uint32_t)(codestreamlen + 16) );
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef simplewriter_h
+#define simplewriter_h
+
+#include <stdint.h>
+#include <stdlib.h> /* size_t */
+#include <stdbool.h>
+#include <stdio.h> /* FILE */
+
+#include "simpleindex.h" /* pphrange */
+
+/**
+ * Big endian writers, return false on short write
+ */
+bool write8( FILE *output, const uint8_t val );
+bool write16( FILE *output, const uint16_t val );
+bool write32( FILE *output, const uint32_t val );
+
+/**
+ * Write a marker, followed by its length (Lxxx) when the marker has one.
+ * `len` is the length of the segment parameters only (the 2 bytes of the
+ * length field itself are added internally)
+ */
+void write_marker( FILE *out, uint_fast16_t marker, size_t len );
+
+/**
+ * Copy `len` bytes starting at absolute position `offset` of stream `in` at
+ * the current position of `out`. On Linux copy_file_range is used so that
+ * the data does not go through user space.
+ * `in` is left positioned right after the copied range.
+ */
+bool copyrange( FILE *in, uint64_t offset, uint64_t len, FILE *out );
+
+/**
+ * Copy the marker segments found in [begin, end) of `in`, except the ones
+ * whose marker is listed in `skip` (0 terminated list, can be NULL).
+ * The number of bytes copied is added to `size`; when `out` is NULL nothing
+ * is written, which is handy to compute a Psot before writing.
+ */
+bool copysegments( FILE *in, uint64_t begin, uint64_t end,
+  const uint_fast16_t *skip, FILE *out, uint64_t *size );
+
+/**
+ * A.7.3 Write as many PLT segments as needed for `lengths`, a packet length
+ * is never split across two segments. When `out` is NULL nothing is
+ * written. Return the number of bytes, 0 when `n` is 0, when more than 256
+ * segments would be needed or on write error.
+ */
+uint64_t writeplt( FILE *out, const uint32_t *lengths, size_t n );
+
+/**
+ * A.7.5 Write the `n` runs of packed packet header bytes found at `ranges` of
+ * `in` as PPT segments (at least one, even without any byte). When `out` is
+ * NULL nothing is written. Return the number of bytes, 0 when more than 256
+ * segments would be needed or on read error.
+ */
+uint64_t writeppt( FILE *in, const pphrange *ranges, size_t n, FILE *out );
+
+/**
+ * A.7.1 Write as many TLM segments as needed (Stlm: ST=2, SP=1).
+ * When `out` is NULL nothing is written. Return the number of bytes, 0 when
+ * `n` is 0, when more than 256 segments would be needed or on write error.
+ */
+uint64_t writetlm( FILE *out, const uint16_t *Ttlm, const uint32_t *Ptlm, size_t n );
+
+/**
+ * I.5.4 Write the header of a Contiguous Codestream box holding
+ * `codestreamlen` bytes (XLBox is used only when required)
+ */
+bool writejp2cheader( FILE *out, uint64_t codestreamlen );
+
+#endif
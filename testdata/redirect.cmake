@@ -0,0 +1,12 @@
+# Run PROGRAM with ARGS (space separated) and write its standard output to
+# OUTPUT, for the tools that only print:
+#   cmake -DPROGRAM=... -DARGS=... -DOUTPUT=... -P redirect.cmake
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+execute_process(
+  COMMAND ${PROGRAM} ${args}
+  OUTPUT_FILE ${OUTPUT}
+  RESULT_VARIABLE res
+  )
+if(res)
+  message(FATAL_ERROR "${PROGRAM} failed: ${res}")
+endif()
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Extract the (first) codestream of a JP2 file, the Contiguous Codestream
+ * box is located with listboxes and its payload copied with copyrange
+ * (copy_file_range on Linux).
+ *
+ * Usage: unwrap input.jp2 output.j2k
+ */
+#include <simpleparser.h>
+#include <simplewriter.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h> /* off_t */
+
+int main(int argc, char *argv[])
+{
+  if( argc < 3 )
+    {
+    fprintf( stderr, "usage: unwrap input.jp2 output.j2k\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  const char *outfilename = argv[2];
+
+  boxinfo *boxes;
+  size_t nboxes;
+  if( !isjp2file( filename ) || !listboxes( filename, &boxes, &nboxes ) )
+    {
+    fprintf( stderr, "could not parse: %s\n", filename );
+    return 1;
+    }
+  size_t i = 0;
+  while( i < nboxes && boxes[i].type != JP2C ) ++i;
+  if( i == nboxes )
+    {
+    fprintf( stderr, "no codestream: %s\n", filename );
+    return 1;
+    }
+
+  FILE *in = fopen( filename, "rb" );
+  if( !in ) return 1;
+  /* LBox == 1 means XLBox follows TBox */
+  uint8_t lbox[4];
+  bool ok = fseeko( in, (off_t)boxes[i].offset, SEEK_SET ) == 0
+    && fread( lbox, 1, sizeof(lbox), in ) == sizeof(lbox);
+  const uint64_t headerlen = ok && !lbox[0] && !lbox[1] && !lbox[2] && lbox[3] == 1 ? 16 : 8;
+  FILE *out = fopen( outfilename, "wb" );
+  if( !out ) return 1;
+  ok = ok && boxes[i].length >= headerlen
+    && copyrange( in, boxes[i].offset + headerlen, boxes[i].length - headerlen, out );
+  if( fclose( out ) != 0 ) ok = false;
+  fclose( in );
+  if( !ok )
+    {
+    fprintf( stderr, "could not write: %s\n", outfilename );
+    return 1;
+    }
+
+  free( boxes );
+
+  return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2012, Mathieu Malaterre <mathieu.malaterre@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Wrap a raw codestream into a JP2 file: the JPEG 2000 signature, File Type
+ * and JP2 Header boxes are built from SIZ, then the codestream is appended
+ * with copyrange (copy_file_range on Linux, no decoding involved).
+ *
+ * The Colour Specification box can only be a guess: greyscale for one or
+ * two components, sYCC for three or more components with sub-sampled
+ * chroma, sRGB otherwise.
+ *
+ * Usage: wrap input.j2k output.jp2
+ */
+#include <simpleparser.h>
+#include <simplewriter.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <byteswap.h>
+
+/* Table I.10 - Colourspace enumerations */
+typedef enum {
+  SRGB      = 16,
+  GREYSCALE = 17,
+  SYCC      = 18
+} EnumCS;
+
+static void cread16(const uint8_t *input, uint16_t * ret)
+{
+  uint16_t v;
+  memcpy( &v, input, sizeof(v) );
+  *ret = bswap_16( v );
+}
+
+static void cread32(const uint8_t *input, uint32_t * ret)
+{
+  uint32_t v;
+  memcpy( &v, input, sizeof(v) );
+  *ret = bswap_32( v );
+}
+
+static bool writeboxheader( FILE *out, uint32_t len, uint32_t type )
+{
+  return write32( out, len ) && write32( out, type );
+}
+
+int main(int argc, char *argv[])
+{
+  if( argc < 3 )
+    {
+    fprintf( stderr, "usage: wrap input.j2k output.jp2\n" );
+    return 1;
+    }
+  const char *filename = argv[1];
+  const char *outfilename = argv[2];
+  if( isjp2file( filename ) )
+    {
+    fprintf( stderr, "already a JP2 file: %s\n", filename );
+    return 1;
+    }
+
+  /* A.5.1: SIZ is the first marker segment after SOC */
+  FILE *in = fopen( filename, "rb" );
+  if( !in ) return 1;
+  uint8_t header[6];
+  uint8_t siz[38 + 3 * 16384];
+  uint16_t marker, lsiz = 0;
+  bool ok = fread( header, 1, sizeof(header), in ) == sizeof(header);
+  if( ok )
+    {
+    cread16( header, &marker );
+    ok = marker == SOC;
+    cread16( header + 2, &marker );
+    ok = ok && marker == SIZ;
+    cread16( header + 4, &lsiz );
+    ok = ok && lsiz >= 41 && (size_t)lsiz - 2 <= sizeof(siz)
+      && fread( siz, 1, lsiz - 2u, in ) == lsiz - 2u;
+    }
+  uint32_t Xsiz, Ysiz, XOsiz, YOsiz;
+  uint16_t Csiz = 0;
+  if( ok )
+    {
+    cread32( siz + 2, &Xsiz );
+    cread32( siz + 6, &Ysiz );
+    cread32( siz + 10, &XOsiz );
+    cread32( siz + 14, &YOsiz );
+    cread16( siz + 34, &Csiz );
+    ok = Csiz && lsiz == 38 + 3 * Csiz && Xsiz > XOsiz && Ysiz > YOsiz;
+    }
+  if( !ok )
+    {
+    fprintf( stderr, "no SIZ found: %s\n", filename );
+    return 1;
+    }
+  const uint8_t *ssiz = siz + 36; /* Ssiz XRsiz YRsiz, Csiz times */
+
+  /* I.5.3.1 Image Header box: BPC is 255 when components differ */
+  bool samebpc = true;
+  for( uint16_t c = 1; c < Csiz; ++c )
+    if( ssiz[3 * c] != ssiz[0] ) samebpc = false;
+  const uint8_t bpc = samebpc ? ssiz[0] : 0xff;
+
+  uint32_t enumcs = Csiz < 3 ? GREYSCALE : SRGB;
+  if( Csiz >= 3 && (ssiz[4] != ssiz[1] || ssiz[5] != ssiz[2]) )
+    enumcs = SYCC;
+
+  const uint32_t ihdrlen = 8 + 14;
+  const uint32_t bpcclen = samebpc ? 0 : 8 + (uint32_t)Csiz;
+  const uint32_t colrlen = 8 + 7;
+  const uint32_t jp2hlen = 8 + ihdrlen + bpcclen + colrlen;
+
+  FILE *out = fopen( outfilename, "wb" );
+  if( !out ) return 1;
+  /* I.5.1 JPEG 2000 Signature box */
+  ok = writeboxheader( out, 12, JP ) && write32( out, 0x0d0a870a );
+  /* I.5.2 File Type box */
+  ok = ok && writeboxheader( out, 8 + 12, FTYP )
+    && write32( out, JP2 ) && write32( out, 0 ) && write32( out, JP2 );
+  /* I.5.3 JP2 Header box */
+  ok = ok && writeboxheader( out, jp2hlen, JP2H )
+    && writeboxheader( out, ihdrlen, IHDR )
+    && write32( out, Ysiz - YOsiz ) && write32( out, Xsiz - XOsiz )
+    && write16( out, Csiz ) && write8( out, bpc )
+    && write8( out, 7 ) /* C: JPEG 2000 */
+    && write8( out, 0 ) /* UnkC */
+    && write8( out, 0 ); /* IPR */
+  if( ok && !samebpc )
+    {
+    ok = writeboxheader( out, bpcclen, 0x62706363 /* bpcc */ );
+    for( uint16_t c = 0; c < Csiz && ok; ++c )
+      ok = write8( out, ssiz[3 * c] );
+    }
+  ok = ok && writeboxheader( out, colrlen, COLR )
+    && write8( out, 1 ) /* METH: enumerated */
+    && write8( out, 0 ) && write8( out, 0 ) /* PREC APPROX */
+    && write32( out, enumcs );
+  /* I.5.4 Contiguous Codestream box */
+  const uint64_t len = getfilesize( filename );
+  ok = ok && writejp2cheader( out, len ) && copyrange( in, 0, len, out );
+  if( fclose( out ) != 0 ) ok = false;
+  fclose( in );
+  if( !ok )
+    {
+    fprintf( stderr, "could not write: %s\n", outfilename );
+    return 1;
+    }
+
+  return 0;
+}